@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_ADC_H
+#define AMBROLIB_LINUX_ADC_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/FixedPoint.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+
+#include <aprinter/BeginNamespace.h>
+
+/**
+ * Virtual ADC for the Linux host platform.
+ * 
+ * Each pin reads as the value last given to setValue(), initially
+ * the middle of the range.
+ */
+template <typename Arg>
+class LinuxAdc {
+    using Context        = typename Arg::Context;
+    using ParentObject   = typename Arg::ParentObject;
+    using ParamsPinsList = typename Arg::PinsList;
+    
+    static int const NumPins = TypeListLength<ParamsPinsList>::Value;
+    
+public:
+    struct Object;
+    using FixedType = FixedPoint<16, false, -16>;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        for (int i = 0; i < NumPins; i++) {
+            o->m_value[i] = UINT16_C(0x8000);
+        }
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static FixedType getValue (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        static int const PinIndex = TypeListIndex<ParamsPinsList, Pin>::Value;
+        
+        return FixedType::importBits(*(uint16_t volatile *)&o->m_value[PinIndex]);
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static void setValue (ThisContext c, FixedType value)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        static int const PinIndex = TypeListIndex<ParamsPinsList, Pin>::Value;
+        
+        *(uint16_t volatile *)&o->m_value[PinIndex] = value.bitsValue();
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxAdc, ParentObject, MakeTypeList<TheDebugObject>> {
+        uint16_t m_value[NumPins > 0 ? NumPins : 1];
+    };
+};
+
+struct LinuxAdcService {
+    APRINTER_ALIAS_STRUCT_EXT(Adc, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(PinsList)
+    ), (
+        APRINTER_DEF_INSTANCE(Adc, LinuxAdc)
+    ))
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_CLOCK_H
+#define AMBROLIB_LINUX_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <aprinter/base/Object.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/system/InterruptLock.h>
+
+#include <aprinter/BeginNamespace.h>
+
+template <int TimerNumber>
+struct LinuxClockTc {};
+
+template <typename Arg>
+class LinuxClock {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Params       = typename Arg::Params;
+    
+    static uint32_t const Prescale = Params::Prescale;
+    
+public:
+    struct Object;
+    using TimeType = uint32_t;
+    
+    static constexpr TimeType prescale_divide = (TimeType)Prescale + 1;
+    static constexpr double base_freq = 1e9;
+    
+    static constexpr double time_unit = (double)prescale_divide / base_freq;
+    static constexpr double time_freq = (double)base_freq / prescale_divide;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->m_start_ns = get_ns();
+        o->m_num_timers = 0;
+        
+        linux_trace_start(time_freq);
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename ThisContext>
+    static TimeType getTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (TimeType)((get_ns() - o->m_start_ns) / prescale_divide);
+    }
+    
+    // Clock ticks since init. Unlike getTime() this does not wrap around.
+    template <typename ThisContext>
+    static uint64_t getTime64 (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (get_ns() - o->m_start_ns) / prescale_divide;
+    }
+    
+private:
+    static uint64_t get_ns ()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+    }
+    
+    // Convert a clock time, which must be near the current time,
+    // into an absolute CLOCK_MONOTONIC time.
+    static struct timespec time_to_timespec (Context c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        
+        uint64_t now_ticks = (get_ns() - o->m_start_ns) / prescale_divide;
+        uint64_t ticks = now_ticks + (int32_t)(time - (TimeType)now_ticks);
+        uint64_t ns = o->m_start_ns + ticks * prescale_divide;
+        
+        struct timespec ts;
+        ts.tv_sec = ns / UINT64_C(1000000000);
+        ts.tv_nsec = ns % UINT64_C(1000000000);
+        return ts;
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxClock, ParentObject, MakeTypeList<TheDebugObject>> {
+        uint64_t m_start_ns;
+        uint16_t m_num_timers;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(LinuxClockService, (
+    APRINTER_AS_VALUE(uint32_t, Prescale)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Clock, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(TcsList)
+    ), (
+        using Params = LinuxClockService;
+        APRINTER_DEF_INSTANCE(Clock, LinuxClock)
+    ))
+))
+
+template <typename Arg>
+class LinuxClockInterruptTimer {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Handler      = typename Arg::Handler;
+    
+public:
+    struct Object;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    using HandlerContext = InterruptContext<Context>;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->m_enabled = false;
+        o->m_quit = false;
+        o->m_trace_id = Clock::Object::self(c)->m_num_timers++;
+#ifdef AMBROLIB_ASSERTIONS
+        o->m_running = false;
+#endif
+        
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&o->m_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        
+        int res = pthread_create(&o->m_thread, nullptr, &LinuxClockInterruptTimer::thread_main, nullptr);
+        AMBRO_ASSERT_FORCE(res == 0)
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_quit = true;
+            pthread_cond_signal(&o->m_cond);
+        }
+        
+        pthread_join(o->m_thread, nullptr);
+        pthread_cond_destroy(&o->m_cond);
+    }
+    
+    template <typename ThisContext>
+    static void setFirst (ThisContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_running)
+        AMBRO_ASSERT(!o->m_enabled)
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_time = time;
+            o->m_enabled = true;
+#ifdef AMBROLIB_ASSERTIONS
+            o->m_running = true;
+#endif
+            pthread_cond_signal(&o->m_cond);
+        }
+    }
+    
+    static void setNext (HandlerContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_running)
+        AMBRO_ASSERT(o->m_enabled)
+        
+        o->m_time = time;
+    }
+    
+    template <typename ThisContext>
+    static void unset (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_enabled = false;
+#ifdef AMBROLIB_ASSERTIONS
+            o->m_running = false;
+#endif
+        }
+    }
+    
+    template <typename ThisContext>
+    static TimeType getLastSetTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        
+        return o->m_time;
+    }
+    
+private:
+    // Runs in its own thread and plays the role of the interrupt handler.
+    // The interrupt mutex is held all the time except while waiting, so the
+    // handler is serialized with other handlers and with cli() sections.
+    static void * thread_main (void *)
+    {
+        Context c;
+        auto *o = Object::self(c);
+        
+        cli();
+        
+        while (!o->m_quit) {
+            if (!o->m_enabled) {
+                pthread_cond_wait(&o->m_cond, &linux_interrupt_mutex);
+                continue;
+            }
+            
+            TimeType now = Clock::getTime(c);
+            now -= o->m_time;
+            
+            if (now < UINT32_C(0x80000000)) {
+                if (linux_trace_file) {
+                    linux_trace_record(Clock::getTime64(c), LINUX_TRACE_TIMER, 0, o->m_trace_id, now);
+                }
+                if (!Handler::call(MakeInterruptContext(c))) {
+#ifdef AMBROLIB_ASSERTIONS
+                    o->m_running = false;
+#endif
+                    o->m_enabled = false;
+                }
+                continue;
+            }
+            
+            struct timespec ts = Clock::time_to_timespec(c, o->m_time);
+            pthread_cond_timedwait(&o->m_cond, &linux_interrupt_mutex, &ts);
+        }
+        
+        sei();
+        
+        return nullptr;
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxClockInterruptTimer, ParentObject, MakeTypeList<TheDebugObject>> {
+        TimeType m_time;
+        bool m_enabled;
+        bool m_quit;
+        uint16_t m_trace_id;
+#ifdef AMBROLIB_ASSERTIONS
+        bool m_running;
+#endif
+        pthread_t m_thread;
+        pthread_cond_t m_cond;
+    };
+};
+
+struct LinuxClockInterruptTimerService {
+    APRINTER_ALIAS_STRUCT_EXT(InterruptTimer, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(Handler)
+    ), (
+        APRINTER_DEF_INSTANCE(InterruptTimer, LinuxClockInterruptTimer)
+    ))
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_PINS_H
+#define AMBROLIB_LINUX_PINS_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Hints.h>
+
+#include <aprinter/BeginNamespace.h>
+
+template <int TPinIndex>
+struct LinuxPin {
+    static int const PinIndex = TPinIndex;
+};
+
+template <bool TPullUp>
+struct LinuxPinInputMode {
+    static bool const PullUp = TPullUp;
+};
+using LinuxPinInputModeNormal = LinuxPinInputMode<false>;
+using LinuxPinInputModePullUp = LinuxPinInputMode<true>;
+
+struct LinuxPinOutputModeNormal {};
+
+/**
+ * Virtual pins for the Linux host platform.
+ * 
+ * Pin levels are just kept in memory. An input pin reads as whatever
+ * was last set to it, or as its pull level if nothing was.
+ * If tracing is enabled (see linux_support.h), the level of an output
+ * pin is recorded when it is configured and on every change.
+ */
+template <typename Arg>
+class LinuxPins {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    
+public:
+    struct Object;
+    static int const NumPins = 256;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        for (int i = 0; i < NumPins; i++) {
+            o->m_state[i] = false;
+        }
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename Pin, typename Mode = LinuxPinInputModeNormal, typename ThisContext>
+    static void setInput (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        o->m_state[pin_index<Pin>()] = Mode::PullUp;
+    }
+    
+    template <typename Pin, typename Mode = LinuxPinOutputModeNormal, typename ThisContext>
+    static void setOutput (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        // Record the initial level, which tells trace analysis the idle level.
+        if (AMBRO_UNLIKELY(linux_trace_file != nullptr)) {
+            linux_trace_record(Context::Clock::getTime64(c), LINUX_TRACE_PIN, o->m_state[pin_index<Pin>()], pin_index<Pin>(), 0);
+        }
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static bool get (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return *(bool volatile *)&o->m_state[pin_index<Pin>()];
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static void set (ThisContext c, bool x)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        bool volatile *state = &o->m_state[pin_index<Pin>()];
+        if (AMBRO_UNLIKELY(linux_trace_file != nullptr) && *state != x) {
+            linux_trace_record(Context::Clock::getTime64(c), LINUX_TRACE_PIN, x, pin_index<Pin>(), 0);
+        }
+        *state = x;
+    }
+    
+    template <typename Pin>
+    static void emergencySet (bool x)
+    {
+        auto *o = Object::self(Context());
+        
+        *(bool volatile *)&o->m_state[pin_index<Pin>()] = x;
+    }
+    
+private:
+    template <typename Pin>
+    static constexpr int pin_index ()
+    {
+        static_assert(Pin::PinIndex >= 0 && Pin::PinIndex < NumPins, "Invalid Linux pin number");
+        return Pin::PinIndex;
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxPins, ParentObject, MakeTypeList<TheDebugObject>> {
+        bool m_state[NumPins];
+    };
+};
+
+struct LinuxPinsService {
+    APRINTER_ALIAS_STRUCT_EXT(Pins, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject)
+    ), (
+        APRINTER_DEF_INSTANCE(Pins, LinuxPins)
+    ))
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
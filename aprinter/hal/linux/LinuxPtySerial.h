@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_PTY_SERIAL_H
+#define AMBROLIB_LINUX_PTY_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include <aprinter/meta/BoundedInt.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/system/InterruptLock.h>
+
+#include <aprinter/BeginNamespace.h>
+
+/**
+ * Serial port for the Linux host platform, backed by a pseudo-terminal.
+ * 
+ * The path of the slave side is printed to stderr on startup, and can
+ * be opened by a host program the same way as a real serial port.
+ * A thread does the I/O on the master side and acts as the interrupt
+ * handler, in the same way as AvrSerial's RX and UDRE interrupts.
+ * Unlike a real UART there is no overrun; if the receive buffer is full
+ * we just stop reading until there is space again.
+ */
+template <typename Context, typename ParentObject, int RecvBufferBits, int SendBufferBits, typename RecvHandler, typename SendHandler, typename Params>
+class LinuxPtySerial {
+private:
+    using RecvFastEvent = typename Context::EventLoop::template FastEventSpec<LinuxPtySerial>;
+    using SendFastEvent = typename Context::EventLoop::template FastEventSpec<RecvFastEvent>;
+    
+public:
+    struct Object;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    using RecvSizeType = BoundedInt<RecvBufferBits, false>;
+    using SendSizeType = BoundedInt<SendBufferBits, false>;
+    
+    static void init (Context c, uint32_t baud)
+    {
+        auto *o = Object::self(c);
+        
+        Context::EventLoop::template initFastEvent<RecvFastEvent>(c, LinuxPtySerial::recv_event_handler);
+        o->m_recv_start = RecvSizeType::import(0);
+        o->m_recv_end = RecvSizeType::import(0);
+        o->m_recv_paused = false;
+        
+        Context::EventLoop::template initFastEvent<SendFastEvent>(c, LinuxPtySerial::send_event_handler);
+        o->m_send_start = SendSizeType::import(0);
+        o->m_send_end = SendSizeType::import(0);
+        o->m_send_event = SendSizeType::import(0);
+        
+        o->m_quit = false;
+        
+        o->m_master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+        AMBRO_ASSERT_FORCE(o->m_master_fd >= 0)
+        AMBRO_ASSERT_FORCE(grantpt(o->m_master_fd) == 0)
+        AMBRO_ASSERT_FORCE(unlockpt(o->m_master_fd) == 0)
+        AMBRO_ASSERT_FORCE(fcntl(o->m_master_fd, F_SETFL, O_NONBLOCK) == 0)
+        
+        char const *slave_path = ptsname(o->m_master_fd);
+        AMBRO_ASSERT_FORCE(slave_path)
+        
+        // Keep the slave side open ourselves, so that the master does not
+        // see a hangup while no client is connected. Also put it into raw
+        // mode so that the line discipline passes data through unchanged.
+        o->m_slave_fd = open(slave_path, O_RDWR | O_NOCTTY);
+        AMBRO_ASSERT_FORCE(o->m_slave_fd >= 0)
+        struct termios tio;
+        AMBRO_ASSERT_FORCE(tcgetattr(o->m_slave_fd, &tio) == 0)
+        cfmakeraw(&tio);
+        AMBRO_ASSERT_FORCE(tcsetattr(o->m_slave_fd, TCSANOW, &tio) == 0)
+        
+        AMBRO_ASSERT_FORCE(pipe(o->m_wake_fds) == 0)
+        AMBRO_ASSERT_FORCE(fcntl(o->m_wake_fds[0], F_SETFL, O_NONBLOCK) == 0)
+        AMBRO_ASSERT_FORCE(fcntl(o->m_wake_fds[1], F_SETFL, O_NONBLOCK) == 0)
+        
+        fprintf(stderr, "Serial port: %s\n", slave_path);
+        
+        AMBRO_ASSERT_FORCE(pthread_create(&o->m_thread, nullptr, &LinuxPtySerial::thread_main, nullptr) == 0)
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_quit = true;
+        }
+        wake_thread(c);
+        pthread_join(o->m_thread, nullptr);
+        
+        close(o->m_wake_fds[1]);
+        close(o->m_wake_fds[0]);
+        close(o->m_slave_fd);
+        close(o->m_master_fd);
+        
+        Context::EventLoop::template resetFastEvent<SendFastEvent>(c);
+        Context::EventLoop::template resetFastEvent<RecvFastEvent>(c);
+    }
+    
+    static RecvSizeType recvQuery (Context c, bool *out_overrun)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(out_overrun)
+        
+        RecvSizeType end;
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            end = o->m_recv_end;
+        }
+        
+        *out_overrun = false;
+        return recv_avail(o->m_recv_start, end);
+    }
+    
+    static char * recvGetChunkPtr (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (o->m_recv_buffer + o->m_recv_start.value());
+    }
+    
+    static void recvConsume (Context c, RecvSizeType amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        bool wake;
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            AMBRO_ASSERT(amount <= recv_avail(o->m_recv_start, o->m_recv_end))
+            o->m_recv_start = BoundedModuloAdd(o->m_recv_start, amount);
+            wake = o->m_recv_paused;
+            o->m_recv_paused = false;
+        }
+        
+        if (wake) {
+            wake_thread(c);
+        }
+    }
+    
+    static void recvClearOverrun (Context c)
+    {
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(false)
+    }
+    
+    static void recvForceEvent (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        Context::EventLoop::template triggerFastEvent<RecvFastEvent>(c);
+    }
+    
+    static SendSizeType sendQuery (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        SendSizeType start;
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            start = o->m_send_start;
+        }
+        
+        return send_avail(start, o->m_send_end);
+    }
+    
+    static SendSizeType sendGetChunkLen (Context c, SendSizeType rem_length)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        if (o->m_send_end.value() > 0 && rem_length > BoundedModuloNegative(o->m_send_end)) {
+            rem_length = BoundedModuloNegative(o->m_send_end);
+        }
+        
+        return rem_length;
+    }
+    
+    static char * sendGetChunkPtr (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (o->m_send_buffer + o->m_send_end.value());
+    }
+    
+    static void sendProvide (Context c, SendSizeType amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        bool wake;
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            AMBRO_ASSERT(amount <= send_avail(o->m_send_start, o->m_send_end))
+            wake = (o->m_send_start == o->m_send_end);
+            o->m_send_end = BoundedModuloAdd(o->m_send_end, amount);
+        }
+        
+        if (wake) {
+            wake_thread(c);
+        }
+    }
+    
+    static void sendPoke (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+    }
+    
+    static void sendRequestEvent (Context c, SendSizeType min_amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_send_event = min_amount;
+            Context::EventLoop::template triggerFastEvent<SendFastEvent>(lock_c);
+        }
+    }
+    
+    using EventLoopFastEvents = MakeTypeList<RecvFastEvent, SendFastEvent>;
+    
+private:
+    static RecvSizeType recv_avail (RecvSizeType start, RecvSizeType end)
+    {
+        return BoundedModuloSubtract(end, start);
+    }
+    
+    static SendSizeType send_avail (SendSizeType start, SendSizeType end)
+    {
+        return BoundedModuloDec(BoundedModuloSubtract(start, end));
+    }
+    
+    static void wake_thread (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        char ch = 0;
+        ssize_t res = write(o->m_wake_fds[1], &ch, 1);
+        (void)res;
+    }
+    
+    static void do_recv (InterruptContext<Context> c)
+    {
+        auto *o = Object::self(c);
+        
+        size_t const buffer_size = (size_t)RecvSizeType::maxIntValue() + 1;
+        
+        while (true) {
+            RecvSizeType space = BoundedModuloDec(BoundedModuloSubtract(o->m_recv_start, o->m_recv_end));
+            if (space.value() == 0) {
+                o->m_recv_paused = true;
+                break;
+            }
+            
+            size_t end = o->m_recv_end.value();
+            size_t amount = space.value();
+            if (amount > buffer_size - end) {
+                amount = buffer_size - end;
+            }
+            
+            ssize_t res = read(o->m_master_fd, o->m_recv_buffer + end, amount);
+            if (res <= 0) {
+                break;
+            }
+            
+            // Mirror the data into the second half, so that all received
+            // data is always contiguous starting at m_recv_start.
+            memcpy(o->m_recv_buffer + buffer_size + end, o->m_recv_buffer + end, res);
+            o->m_recv_end = BoundedModuloAdd(o->m_recv_end, RecvSizeType::import(res));
+            
+            Context::EventLoop::template triggerFastEvent<RecvFastEvent>(c);
+        }
+    }
+    
+    static void do_send (InterruptContext<Context> c)
+    {
+        auto *o = Object::self(c);
+        
+        while (o->m_send_start != o->m_send_end) {
+            size_t start = o->m_send_start.value();
+            size_t amount = (o->m_send_end.value() > start) ? (o->m_send_end.value() - start) : ((size_t)SendSizeType::maxIntValue() + 1 - start);
+            
+            ssize_t res = write(o->m_master_fd, o->m_send_buffer + start, amount);
+            if (res <= 0) {
+                break;
+            }
+            
+            o->m_send_start = BoundedModuloAdd(o->m_send_start, SendSizeType::import(res));
+            
+            if (o->m_send_event != SendSizeType::import(0)) {
+                Context::EventLoop::template triggerFastEvent<SendFastEvent>(c);
+            }
+        }
+    }
+    
+    static void * thread_main (void *)
+    {
+        Context c;
+        auto *o = Object::self(c);
+        
+        cli();
+        
+        while (!o->m_quit) {
+            struct pollfd pfds[2];
+            pfds[0].fd = o->m_master_fd;
+            pfds[0].events = (o->m_recv_paused ? 0 : POLLIN) | (o->m_send_start != o->m_send_end ? POLLOUT : 0);
+            pfds[1].fd = o->m_wake_fds[0];
+            pfds[1].events = POLLIN;
+            
+            sei();
+            poll(pfds, 2, -1);
+            cli();
+            
+            if ((pfds[1].revents & POLLIN)) {
+                char buf[16];
+                while (read(o->m_wake_fds[0], buf, sizeof(buf)) > 0);
+            }
+            
+            if (!o->m_recv_paused && (pfds[0].revents & POLLIN)) {
+                do_recv(MakeInterruptContext(c));
+            }
+            
+            if ((pfds[0].revents & POLLOUT)) {
+                do_send(MakeInterruptContext(c));
+            }
+        }
+        
+        sei();
+        
+        return nullptr;
+    }
+    
+    static void recv_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        RecvHandler::call(c);
+    }
+    
+    static void send_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        bool report;
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            report = (o->m_send_event != SendSizeType::import(0) && send_avail(o->m_send_start, o->m_send_end) >= o->m_send_event);
+            if (report) {
+                o->m_send_event = SendSizeType::import(0);
+            }
+        }
+        if (report) {
+            SendHandler::call(c);
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxPtySerial, ParentObject, MakeTypeList<TheDebugObject>> {
+        RecvSizeType m_recv_start;
+        RecvSizeType m_recv_end;
+        bool m_recv_paused;
+        bool m_quit;
+        char m_recv_buffer[2 * ((size_t)RecvSizeType::maxIntValue() + 1)];
+        SendSizeType m_send_start;
+        SendSizeType m_send_end;
+        SendSizeType m_send_event;
+        char m_send_buffer[(size_t)SendSizeType::maxIntValue() + 1];
+        int m_master_fd;
+        int m_slave_fd;
+        int m_wake_fds[2];
+        pthread_t m_thread;
+    };
+};
+
+struct LinuxPtySerialService {
+    template <typename Context, typename ParentObject, int RecvBufferBits, int SendBufferBits, typename RecvHandler, typename SendHandler>
+    using Serial = LinuxPtySerial<Context, ParentObject, RecvBufferBits, SendBufferBits, RecvHandler, SendHandler, LinuxPtySerialService>;
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
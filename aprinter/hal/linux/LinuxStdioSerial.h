@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_STDIO_SERIAL_H
+#define AMBROLIB_LINUX_STDIO_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <aprinter/meta/BoundedInt.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+
+#include <aprinter/BeginNamespace.h>
+
+/**
+ * Serial port for the Linux host platform which reads commands from
+ * standard input and writes replies to standard output.
+ * 
+ * All I/O is done synchronously from the main loop: the receive buffer is
+ * refilled as soon as data is consumed, and sent data is written out
+ * immediately. This way the timing of the input does not depend on
+ * anything outside the program, which together with LinuxVirtualClock
+ * makes a run reproducible. When the end of input is reached and all
+ * received data has been consumed, the program exits. Since commands
+ * are consumed when they complete, ending the input with M400 makes
+ * the program exit only once all motion is done.
+ */
+template <typename Context, typename ParentObject, int RecvBufferBits, int SendBufferBits, typename RecvHandler, typename SendHandler, typename Params>
+class LinuxStdioSerial {
+private:
+    using RecvFastEvent = typename Context::EventLoop::template FastEventSpec<LinuxStdioSerial>;
+    using SendFastEvent = typename Context::EventLoop::template FastEventSpec<RecvFastEvent>;
+    
+public:
+    struct Object;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    using RecvSizeType = BoundedInt<RecvBufferBits, false>;
+    using SendSizeType = BoundedInt<SendBufferBits, false>;
+    
+    static void init (Context c, uint32_t baud)
+    {
+        auto *o = Object::self(c);
+        
+        Context::EventLoop::template initFastEvent<RecvFastEvent>(c, LinuxStdioSerial::recv_event_handler);
+        o->m_recv_start = RecvSizeType::import(0);
+        o->m_recv_end = RecvSizeType::import(0);
+        o->m_recv_eof = false;
+        o->m_recv_last_char = '\n';
+        
+        Context::EventLoop::template initFastEvent<SendFastEvent>(c, LinuxStdioSerial::send_event_handler);
+        o->m_send_end = SendSizeType::import(0);
+        o->m_send_event = SendSizeType::import(0);
+        
+        TheDebugObject::init(c);
+        
+        fill_recv(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+        
+        Context::EventLoop::template resetFastEvent<SendFastEvent>(c);
+        Context::EventLoop::template resetFastEvent<RecvFastEvent>(c);
+    }
+    
+    static RecvSizeType recvQuery (Context c, bool *out_overrun)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(out_overrun)
+        
+        *out_overrun = false;
+        return recv_avail(c);
+    }
+    
+    static char * recvGetChunkPtr (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (o->m_recv_buffer + o->m_recv_start.value());
+    }
+    
+    static void recvConsume (Context c, RecvSizeType amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(amount <= recv_avail(c))
+        
+        o->m_recv_start = BoundedModuloAdd(o->m_recv_start, amount);
+        
+        fill_recv(c);
+    }
+    
+    static void recvClearOverrun (Context c)
+    {
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(false)
+    }
+    
+    static void recvForceEvent (Context c)
+    {
+        TheDebugObject::access(c);
+        
+        Context::EventLoop::template triggerFastEvent<RecvFastEvent>(c);
+    }
+    
+    static SendSizeType sendQuery (Context c)
+    {
+        TheDebugObject::access(c);
+        
+        return SendSizeType::maxValue();
+    }
+    
+    static SendSizeType sendGetChunkLen (Context c, SendSizeType rem_length)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        if (o->m_send_end.value() > 0 && rem_length > BoundedModuloNegative(o->m_send_end)) {
+            rem_length = BoundedModuloNegative(o->m_send_end);
+        }
+        
+        return rem_length;
+    }
+    
+    static char * sendGetChunkPtr (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (o->m_send_buffer + o->m_send_end.value());
+    }
+    
+    static void sendProvide (Context c, SendSizeType amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        char const *data = o->m_send_buffer + o->m_send_end.value();
+        size_t length = amount.value();
+        while (length > 0) {
+            ssize_t res = write(1, data, length);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                break;
+            }
+            data += res;
+            length -= res;
+        }
+        
+        o->m_send_end = BoundedModuloAdd(o->m_send_end, amount);
+    }
+    
+    static void sendPoke (Context c)
+    {
+        TheDebugObject::access(c);
+    }
+    
+    static void sendRequestEvent (Context c, SendSizeType min_amount)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        o->m_send_event = min_amount;
+        if (min_amount != SendSizeType::import(0)) {
+            Context::EventLoop::template triggerFastEvent<SendFastEvent>(c);
+        }
+    }
+    
+    using EventLoopFastEvents = MakeTypeList<RecvFastEvent, SendFastEvent>;
+    
+private:
+    static RecvSizeType recv_avail (Context c)
+    {
+        auto *o = Object::self(c);
+        return BoundedModuloSubtract(o->m_recv_end, o->m_recv_start);
+    }
+    
+    static void fill_recv (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        size_t const buffer_size = (size_t)RecvSizeType::maxIntValue() + 1;
+        bool got_data = false;
+        
+        while (!o->m_recv_eof) {
+            RecvSizeType space = BoundedModuloDec(BoundedModuloSubtract(o->m_recv_start, o->m_recv_end));
+            if (space.value() == 0) {
+                break;
+            }
+            
+            size_t end = o->m_recv_end.value();
+            size_t amount = space.value();
+            if (amount > buffer_size - end) {
+                amount = buffer_size - end;
+            }
+            
+            ssize_t res = read(0, o->m_recv_buffer + end, amount);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                // Terminate an unterminated last line so that it gets executed.
+                o->m_recv_eof = true;
+                if (o->m_recv_last_char == '\n') {
+                    break;
+                }
+                o->m_recv_buffer[end] = '\n';
+                res = 1;
+            }
+            
+            // Mirror the data into the second half, so that all received
+            // data is always contiguous starting at m_recv_start.
+            memcpy(o->m_recv_buffer + buffer_size + end, o->m_recv_buffer + end, res);
+            o->m_recv_end = BoundedModuloAdd(o->m_recv_end, RecvSizeType::import(res));
+            o->m_recv_last_char = o->m_recv_buffer[end + res - 1];
+            got_data = true;
+        }
+        
+        if (got_data || o->m_recv_eof) {
+            Context::EventLoop::template triggerFastEvent<RecvFastEvent>(c);
+        }
+    }
+    
+    static void recv_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        if (o->m_recv_eof && recv_avail(c).value() == 0) {
+            exit(0);
+        }
+        
+        RecvHandler::call(c);
+    }
+    
+    static void send_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        if (o->m_send_event != SendSizeType::import(0)) {
+            o->m_send_event = SendSizeType::import(0);
+            SendHandler::call(c);
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxStdioSerial, ParentObject, MakeTypeList<TheDebugObject>> {
+        RecvSizeType m_recv_start;
+        RecvSizeType m_recv_end;
+        bool m_recv_eof;
+        char m_recv_last_char;
+        char m_recv_buffer[2 * ((size_t)RecvSizeType::maxIntValue() + 1)];
+        SendSizeType m_send_end;
+        SendSizeType m_send_event;
+        char m_send_buffer[(size_t)SendSizeType::maxIntValue() + 1];
+    };
+};
+
+struct LinuxStdioSerialService {
+    template <typename Context, typename ParentObject, int RecvBufferBits, int SendBufferBits, typename RecvHandler, typename SendHandler>
+    using Serial = LinuxStdioSerial<Context, ParentObject, RecvBufferBits, SendBufferBits, RecvHandler, SendHandler, LinuxStdioSerialService>;
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_LINUX_VIRTUAL_CLOCK_H
+#define AMBROLIB_LINUX_VIRTUAL_CLOCK_H
+
+#include <stdint.h>
+
+#include <aprinter/base/Object.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/system/InterruptLock.h>
+
+#ifndef AMBROLIB_VIRTUAL_TIME
+#error "LinuxVirtualClock requires AMBROLIB_VIRTUAL_TIME"
+#endif
+
+#include <aprinter/BeginNamespace.h>
+
+template <int TimerNumber>
+struct LinuxVirtualClockTc {};
+
+/**
+ * Discrete-event clock for the Linux host platform.
+ * 
+ * Time does not pass on its own. Whenever the event loop has nothing
+ * to do, it calls advanceTime(), which jumps straight to the earliest
+ * deadline among the interrupt timers and the event loop's own timed
+ * events, and dispatches that one timer if it was the earliest.
+ * Interrupt handlers run in the main thread, so as long as nothing
+ * else is asynchronous (see LinuxStdioSerial), a run is fully
+ * reproducible and is limited only by CPU speed. The CPU is modeled
+ * as infinitely fast: executing code takes no virtual time.
+ */
+template <typename Arg>
+class LinuxVirtualClock {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Params       = typename Arg::Params;
+    
+    static uint32_t const Prescale = Params::Prescale;
+    
+    template <typename> friend class LinuxVirtualClockInterruptTimer;
+    
+public:
+    struct Object;
+    using TimeType = uint32_t;
+    
+    static constexpr TimeType prescale_divide = (TimeType)Prescale + 1;
+    static constexpr double base_freq = 1e9;
+    
+    static constexpr double time_unit = (double)prescale_divide / base_freq;
+    static constexpr double time_freq = (double)base_freq / prescale_divide;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+    struct TimerEntry {
+        TimerEntry *next;
+        bool enabled;
+        TimeType time;
+        void (*dispatch) (Context c);
+        uint16_t trace_id;
+    };
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->m_time = 0;
+        o->m_timers = nullptr;
+        o->m_num_timers = 0;
+        
+        linux_trace_start(time_freq);
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename ThisContext>
+    static TimeType getTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (TimeType)o->m_time;
+    }
+    
+    // Total virtual time elapsed since init, in clock ticks. Unlike
+    // getTime() this does not wrap around.
+    template <typename ThisContext>
+    static uint64_t getTime64 (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return o->m_time;
+    }
+    
+    // Time only advances when the event loop is idle, so busy-waiting (e.g. for
+    // step pulse delays) advances it by one tick per iteration, see ClockUtils.
+    struct BusyWait {
+        template <typename ThisContext>
+        static void spin (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            o->m_time++;
+        }
+    };
+    
+    // Called by the event loop when there is nothing to do. If
+    // have_deadline is true, loop_deadline is the time of the earliest
+    // timed event. Returns false if nothing at all is scheduled, in which
+    // case time cannot advance and only external input can make progress.
+    static bool advanceTime (Context c, bool have_deadline, TimeType loop_deadline)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        TimeType now = (TimeType)o->m_time;
+        TimerEntry *first = nullptr;
+        int32_t first_rel = 0;
+        
+        // On ties, the first registered timer wins, and timers win over
+        // the event loop, like an interrupt would preempt the main loop.
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            for (TimerEntry *e = o->m_timers; e; e = e->next) {
+                if (e->enabled) {
+                    int32_t rel = (int32_t)(TimeType)(e->time - now);
+                    if (!first || rel < first_rel) {
+                        first = e;
+                        first_rel = rel;
+                    }
+                }
+            }
+        }
+        
+        if (have_deadline) {
+            int32_t loop_rel = (int32_t)(TimeType)(loop_deadline - now);
+            if (!first || loop_rel < first_rel) {
+                if (loop_rel > 0) {
+                    o->m_time += loop_rel;
+                }
+                return true;
+            }
+        }
+        
+        if (!first) {
+            return false;
+        }
+        
+        if (first_rel > 0) {
+            o->m_time += first_rel;
+        }
+        if (linux_trace_file) {
+            linux_trace_record(o->m_time, LINUX_TRACE_TIMER, 0, first->trace_id, (first_rel < 0) ? -first_rel : 0);
+        }
+        first->dispatch(c);
+        return true;
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxVirtualClock, ParentObject, MakeTypeList<TheDebugObject>> {
+        uint64_t m_time;
+        TimerEntry *m_timers;
+        uint16_t m_num_timers;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(LinuxVirtualClockService, (
+    APRINTER_AS_VALUE(uint32_t, Prescale)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Clock, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(TcsList)
+    ), (
+        using Params = LinuxVirtualClockService;
+        APRINTER_DEF_INSTANCE(Clock, LinuxVirtualClock)
+    ))
+))
+
+template <typename Arg>
+class LinuxVirtualClockInterruptTimer {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Handler      = typename Arg::Handler;
+    
+public:
+    struct Object;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    using HandlerContext = InterruptContext<Context>;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        auto *co = Clock::Object::self(c);
+        
+        o->m_entry.enabled = false;
+        o->m_entry.dispatch = LinuxVirtualClockInterruptTimer::dispatch;
+        o->m_entry.trace_id = co->m_num_timers++;
+        
+        // Append so that the order of dispatch on ties follows init order.
+        typename Clock::TimerEntry **link = &co->m_timers;
+        while (*link) {
+            link = &(*link)->next;
+        }
+        o->m_entry.next = nullptr;
+        *link = &o->m_entry;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        auto *co = Clock::Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        typename Clock::TimerEntry **link = &co->m_timers;
+        while (*link != &o->m_entry) {
+            link = &(*link)->next;
+        }
+        *link = o->m_entry.next;
+    }
+    
+    template <typename ThisContext>
+    static void setFirst (ThisContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_entry.enabled)
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_entry.time = time;
+            o->m_entry.enabled = true;
+        }
+    }
+    
+    static void setNext (HandlerContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_entry.enabled)
+        
+        o->m_entry.time = time;
+    }
+    
+    template <typename ThisContext>
+    static void unset (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_entry.enabled = false;
+        }
+    }
+    
+    template <typename ThisContext>
+    static TimeType getLastSetTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        
+        return o->m_entry.time;
+    }
+    
+private:
+    static void dispatch (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        cli();
+        if (!Handler::call(MakeInterruptContext(c))) {
+            o->m_entry.enabled = false;
+        }
+        sei();
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxVirtualClockInterruptTimer, ParentObject, MakeTypeList<TheDebugObject>> {
+        typename Clock::TimerEntry m_entry;
+    };
+};
+
+struct LinuxVirtualClockInterruptTimerService {
+    APRINTER_ALIAS_STRUCT_EXT(InterruptTimer, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(Handler)
+    ), (
+        APRINTER_DEF_INSTANCE(InterruptTimer, LinuxVirtualClockInterruptTimer)
+    ))
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
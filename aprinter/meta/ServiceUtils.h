@@ -27,9 +27,9 @@
 
 #include <aprinter/base/Preprocessor.h>
 
-#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
 #define APRINTER_AS_NUM_MACRO_ARGS_HELPER1(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER2(__VA_ARGS__)
-#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, N, ...) N
+#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, _33, _34, _35, _36, _37, _38, _39, _40, N, ...) N
 
 #define APRINTER_NUM_TUPLE_ARGS(tuple) APRINTER_AS_NUM_MACRO_ARGS tuple
 
@@ -55,6 +55,24 @@
 #define APRINTER_AS_GET_20(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, ...) p20
 #define APRINTER_AS_GET_21(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, ...) p21
 #define APRINTER_AS_GET_22(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, ...) p22
+#define APRINTER_AS_GET_23(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, ...) p23
+#define APRINTER_AS_GET_24(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, ...) p24
+#define APRINTER_AS_GET_25(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, ...) p25
+#define APRINTER_AS_GET_26(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, ...) p26
+#define APRINTER_AS_GET_27(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, ...) p27
+#define APRINTER_AS_GET_28(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, ...) p28
+#define APRINTER_AS_GET_29(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, ...) p29
+#define APRINTER_AS_GET_30(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, ...) p30
+#define APRINTER_AS_GET_31(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, ...) p31
+#define APRINTER_AS_GET_32(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, ...) p32
+#define APRINTER_AS_GET_33(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, ...) p33
+#define APRINTER_AS_GET_34(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, ...) p34
+#define APRINTER_AS_GET_35(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, ...) p35
+#define APRINTER_AS_GET_36(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, p36, ...) p36
+#define APRINTER_AS_GET_37(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, p36, p37, ...) p37
+#define APRINTER_AS_GET_38(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, p36, p37, p38, ...) p38
+#define APRINTER_AS_GET_39(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, p36, p37, p38, p39, ...) p39
+#define APRINTER_AS_GET_40(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, p33, p34, p35, p36, p37, p38, p39, p40, ...) p40
 
 #define  APRINTER_AS_MAP_1(f, del, pars)                                             f( APRINTER_AS_GET_1 pars)
 #define  APRINTER_AS_MAP_2(f, del, pars)  APRINTER_AS_MAP_1(f, del, pars) del(dummy) f( APRINTER_AS_GET_2 pars)
@@ -78,6 +96,24 @@
 #define APRINTER_AS_MAP_20(f, del, pars) APRINTER_AS_MAP_19(f, del, pars) del(dummy) f(APRINTER_AS_GET_20 pars)
 #define APRINTER_AS_MAP_21(f, del, pars) APRINTER_AS_MAP_20(f, del, pars) del(dummy) f(APRINTER_AS_GET_21 pars)
 #define APRINTER_AS_MAP_22(f, del, pars) APRINTER_AS_MAP_21(f, del, pars) del(dummy) f(APRINTER_AS_GET_22 pars)
+#define APRINTER_AS_MAP_23(f, del, pars) APRINTER_AS_MAP_22(f, del, pars) del(dummy) f(APRINTER_AS_GET_23 pars)
+#define APRINTER_AS_MAP_24(f, del, pars) APRINTER_AS_MAP_23(f, del, pars) del(dummy) f(APRINTER_AS_GET_24 pars)
+#define APRINTER_AS_MAP_25(f, del, pars) APRINTER_AS_MAP_24(f, del, pars) del(dummy) f(APRINTER_AS_GET_25 pars)
+#define APRINTER_AS_MAP_26(f, del, pars) APRINTER_AS_MAP_25(f, del, pars) del(dummy) f(APRINTER_AS_GET_26 pars)
+#define APRINTER_AS_MAP_27(f, del, pars) APRINTER_AS_MAP_26(f, del, pars) del(dummy) f(APRINTER_AS_GET_27 pars)
+#define APRINTER_AS_MAP_28(f, del, pars) APRINTER_AS_MAP_27(f, del, pars) del(dummy) f(APRINTER_AS_GET_28 pars)
+#define APRINTER_AS_MAP_29(f, del, pars) APRINTER_AS_MAP_28(f, del, pars) del(dummy) f(APRINTER_AS_GET_29 pars)
+#define APRINTER_AS_MAP_30(f, del, pars) APRINTER_AS_MAP_29(f, del, pars) del(dummy) f(APRINTER_AS_GET_30 pars)
+#define APRINTER_AS_MAP_31(f, del, pars) APRINTER_AS_MAP_30(f, del, pars) del(dummy) f(APRINTER_AS_GET_31 pars)
+#define APRINTER_AS_MAP_32(f, del, pars) APRINTER_AS_MAP_31(f, del, pars) del(dummy) f(APRINTER_AS_GET_32 pars)
+#define APRINTER_AS_MAP_33(f, del, pars) APRINTER_AS_MAP_32(f, del, pars) del(dummy) f(APRINTER_AS_GET_33 pars)
+#define APRINTER_AS_MAP_34(f, del, pars) APRINTER_AS_MAP_33(f, del, pars) del(dummy) f(APRINTER_AS_GET_34 pars)
+#define APRINTER_AS_MAP_35(f, del, pars) APRINTER_AS_MAP_34(f, del, pars) del(dummy) f(APRINTER_AS_GET_35 pars)
+#define APRINTER_AS_MAP_36(f, del, pars) APRINTER_AS_MAP_35(f, del, pars) del(dummy) f(APRINTER_AS_GET_36 pars)
+#define APRINTER_AS_MAP_37(f, del, pars) APRINTER_AS_MAP_36(f, del, pars) del(dummy) f(APRINTER_AS_GET_37 pars)
+#define APRINTER_AS_MAP_38(f, del, pars) APRINTER_AS_MAP_37(f, del, pars) del(dummy) f(APRINTER_AS_GET_38 pars)
+#define APRINTER_AS_MAP_39(f, del, pars) APRINTER_AS_MAP_38(f, del, pars) del(dummy) f(APRINTER_AS_GET_39 pars)
+#define APRINTER_AS_MAP_40(f, del, pars) APRINTER_AS_MAP_39(f, del, pars) del(dummy) f(APRINTER_AS_GET_40 pars)
 
 #define APRINTER_AS_MAP(f, del, pars) APRINTER_JOIN(APRINTER_AS_MAP_, APRINTER_NUM_TUPLE_ARGS(pars))(f, del, pars)
 
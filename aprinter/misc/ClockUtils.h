@@ -36,6 +36,12 @@
 namespace ClockUtilsPrivate {
     APRINTER_DEFINE_MEMBER_TYPE(MemberType_Clock, Clock)
     APRINTER_DEFINE_MEMBER_TYPE(MemberType_FastClock, FastClock)
+    APRINTER_DEFINE_MEMBER_TYPE(MemberType_BusyWait, BusyWait)
+    
+    struct NoBusyWait {
+        template <typename ThisContext>
+        static void spin (ThisContext c) {}
+    };
 }
 
 template <typename TClock>
@@ -46,6 +52,17 @@ public:
 private:
     static_assert(TypesAreEqual<typename Clock::TimeType, uint32_t>::Value, "");
     
+    // A clock which does not advance by itself while busy-waiting (virtual time)
+    // provides BusyWait::spin(), called in each iteration of the waiting loops.
+    using BusyWait = FuncCall<
+        IfFunc<
+            ClockUtilsPrivate::MemberType_BusyWait::Has,
+            ClockUtilsPrivate::MemberType_BusyWait::Get,
+            ConstantFunc<ClockUtilsPrivate::NoBusyWait>
+        >,
+        Clock
+    >;
+    
 public:
     using TimeType = typename Clock::TimeType;
     static constexpr double time_unit = Clock::time_unit;
@@ -78,7 +95,9 @@ public:
     inline static void delay (ThisContext c, TimeType ticks)
     {
         TimeType target_time = getTimeAfter(c, ticks);
-        while (!timeGreaterOrEqual(Clock::getTime(c), target_time));
+        while (!timeGreaterOrEqual(Clock::getTime(c), target_time)) {
+            BusyWait::spin(c);
+        }
     }
     
     class PollTimer {
@@ -115,6 +134,7 @@ public:
                     m_set_time = time;
                     return;
                 }
+                BusyWait::spin(c);
             }
         }
         
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "linux_support.h"
+
+pthread_mutex_t linux_interrupt_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void platform_init (void)
+{
+    // A pty peer going away must not kill the process.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+FILE *linux_trace_file;
+
+struct LinuxTraceRecord {
+    uint64_t time;
+    uint8_t type;
+    uint8_t value;
+    uint16_t id;
+    int32_t aux;
+};
+
+static_assert(sizeof(LinuxTraceRecord) == 16, "");
+
+static void linux_trace_signal_set (sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+}
+
+static void * linux_trace_signal_thread (void *arg)
+{
+    sigset_t set;
+    linux_trace_signal_set(&set);
+    
+    int sig;
+    while (sigwait(&set, &sig) != 0);
+    
+    // Make sure buffered records get written out when interrupted. This is
+    // not a signal handler, so it is safe to wait for the stdio locks here.
+    // Then die from the signal itself so the exit status still reports it.
+    fflush(NULL);
+    signal(sig, SIG_DFL);
+    sigset_t sig_set;
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, sig);
+    pthread_sigmask(SIG_UNBLOCK, &sig_set, NULL);
+    raise(sig);
+    _exit(128 + sig);
+}
+
+void linux_trace_start (double time_freq)
+{
+    char const *path = getenv("APRINTER_TRACE");
+    if (!path || linux_trace_file) {
+        return;
+    }
+    
+    linux_trace_file = fopen(path, "wb");
+    if (!linux_trace_file) {
+        fprintf(stderr, "Failed to open trace file %s\n", path);
+        return;
+    }
+    setvbuf(linux_trace_file, NULL, _IOFBF, 1 << 20);
+    
+    char header[16] = "APSTRC01";
+    memcpy(header + 8, &time_freq, sizeof(time_freq));
+    fwrite(header, sizeof(header), 1, linux_trace_file);
+    
+    // SIGINT and SIGTERM are handled by a thread waiting for them. They are
+    // blocked here, before the clock's users create other threads, so that
+    // those threads inherit this.
+    sigset_t set;
+    linux_trace_signal_set(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, linux_trace_signal_thread, NULL) != 0) {
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        fprintf(stderr, "Failed to create trace signal thread\n");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void linux_trace_record (uint64_t time, uint8_t type, uint8_t value, uint16_t id, int32_t aux)
+{
+    LinuxTraceRecord rec;
+    rec.time = time;
+    rec.type = type;
+    rec.value = value;
+    rec.id = id;
+    rec.aux = aux;
+    fwrite(&rec, sizeof(rec), 1, linux_trace_file);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_LINUX_SUPPORT_H
+#define APRINTER_LINUX_SUPPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+// There is no meaningful CPU frequency on the host. This is only used
+// to convert MaxStepsPerCycle into a time, so pick something that makes
+// the configured value mean "per nanosecond".
+#ifndef F_CPU
+#define F_CPU 1000000000.0
+#endif
+
+// Interrupts are emulated by threads (see LinuxClock), and disabling
+// interrupts is emulated by taking a global recursive mutex. Interrupt
+// handler threads hold this mutex while they run, which gives the same
+// guarantees as a single interrupt priority level on the real hardware.
+extern pthread_mutex_t linux_interrupt_mutex;
+
+inline static void cli (void)
+{
+    pthread_mutex_lock(&linux_interrupt_mutex);
+}
+
+inline static void sei (void)
+{
+    pthread_mutex_unlock(&linux_interrupt_mutex);
+}
+
+inline static void memory_barrier (void)
+{
+    asm volatile ("" : : : "memory");
+}
+
+inline static void memory_barrier_dma (void)
+{
+    __sync_synchronize();
+}
+
+void platform_init (void);
+
+// Real elapsed time, for benchmarking code even when running in virtual time.
+inline static uint64_t linux_monotonic_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+// Optional binary trace of pin changes and timer interrupts, written to
+// the file named by the APRINTER_TRACE environment variable. The clock
+// starts it on init; see host_stuff/step_trace_analyze.py for the format.
+#define LINUX_TRACE_PIN 1
+#define LINUX_TRACE_TIMER 2
+
+extern FILE *linux_trace_file;
+
+void linux_trace_start (double time_freq);
+void linux_trace_record (uint64_t time, uint8_t type, uint8_t value, uint16_t id, int32_t aux);
+
+#endif
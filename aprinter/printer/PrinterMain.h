@@ -65,6 +65,7 @@
 #include <aprinter/printer/utils/Blinker.h>
 #include <aprinter/printer/actuators/Steppers.h>
 #include <aprinter/printer/actuators/StepperGroup.h>
+#include <aprinter/printer/actuators/SharedStepTimer.h>
 #include <aprinter/structure/DoubleEndedList.h>
 #include <aprinter/printer/planning/MotionPlanner.h>
 #include <aprinter/printer/Configuration.h>
@@ -89,8 +90,20 @@ APRINTER_ALIAS_STRUCT(PrinterMainParams, (
     APRINTER_AS_VALUE(int, StepperSegmentBufferSize),
     APRINTER_AS_VALUE(int, LookaheadBufferSize),
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
+    APRINTER_AS_TYPE(LookaheadTimeParams),
+    APRINTER_AS_TYPE(PlanSliceParams),
+    APRINTER_AS_VALUE(int, SCurvePieces),
+    APRINTER_AS_TYPE(JunctionDeviationParams),
+    APRINTER_AS_TYPE(ArcParams),
+    APRINTER_AS_TYPE(CoalesceParams),
+    APRINTER_AS_TYPE(BlendParams),
+    APRINTER_AS_TYPE(PressureAdvanceParams),
+    APRINTER_AS_TYPE(InputShapingParams),
+    APRINTER_AS_VALUE(bool, RealtimeSpeedRatio),
+    APRINTER_AS_VALUE(bool, FeedHold),
     APRINTER_AS_TYPE(ForceTimeout),
     APRINTER_AS_TYPE(FpType),
+    APRINTER_AS_TYPE(SharedStepTimerParams),
     APRINTER_AS_TYPE(WatchdogService),
     APRINTER_AS_TYPE(ConfigManagerService),
     APRINTER_AS_TYPE(ConfigList),
@@ -133,6 +146,104 @@ APRINTER_ALIAS_STRUCT_EXT(PrinterMainHomingParams, (
     static bool const Enabled = true;
 ))
 
+struct PrinterMainNoLookaheadTimeParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainLookaheadTimeParams, (
+    APRINTER_AS_TYPE(TargetTime)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoPlanSliceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainPlanSliceParams, (
+    APRINTER_AS_TYPE(TimeSlice),
+    APRINTER_AS_TYPE(DeadlineMargin)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoSharedStepTimerParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainSharedStepTimerParams, (
+    APRINTER_AS_TYPE(TimerService)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoJunctionDeviationParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainJunctionDeviationParams, (
+    APRINTER_AS_TYPE(JunctionDeviation)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoArcParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainArcParams, (
+    APRINTER_AS_TYPE(ChordalTolerance)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoCoalesceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainCoalesceParams, (
+    APRINTER_AS_TYPE(MaxDeviation),
+    APRINTER_AS_TYPE(MaxDirectionChange),
+    APRINTER_AS_TYPE(SpeedTolerance),
+    APRINTER_AS_VALUE(int, MaxMergedMoves)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoBlendParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainBlendParams, (
+    APRINTER_AS_TYPE(DefaultTolerance),
+    APRINTER_AS_TYPE(MaxChordAngle)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoPressureAdvanceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainPressureAdvanceParams, (
+    APRINTER_AS_TYPE(AdvanceTime)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoInputShapingParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainInputShapingParams, (
+    APRINTER_AS_VALUE(int, ShaperType),
+    APRINTER_AS_TYPE(Frequency),
+    APRINTER_AS_TYPE(DampingRatio),
+    APRINTER_AS_TYPE(AxisNamesList)
+), (
+    static bool const Enabled = true;
+))
+
 struct PrinterMainNoTransformParams {
     static const bool Enabled = false;
 };
@@ -258,6 +369,97 @@ public:
 private:
     using MaxStepsPerCycle = decltype(Config::e(Params::MaxStepsPerCycle::i()));
     
+    AMBRO_STRUCT_IF(JunctionDeviationFeature, Params::JunctionDeviationParams::Enabled) {
+        using PlannerParams = MotionPlannerJunctionDeviationParams<decltype(Config::e(Params::JunctionDeviationParams::JunctionDeviation::i()))>;
+    }
+    AMBRO_STRUCT_ELSE(JunctionDeviationFeature) {
+        using PlannerParams = MotionPlannerNoJunctionDeviationParams;
+    };
+    
+    AMBRO_STRUCT_IF(LookaheadTimeFeature, Params::LookaheadTimeParams::Enabled) {
+        using PlannerParams = MotionPlannerLookaheadTimeParams<decltype(Config::e(Params::LookaheadTimeParams::TargetTime::i()))>;
+    }
+    AMBRO_STRUCT_ELSE(LookaheadTimeFeature) {
+        using PlannerParams = MotionPlannerNoLookaheadTimeParams;
+    };
+    
+    AMBRO_STRUCT_IF(PlanSliceFeature, Params::PlanSliceParams::Enabled) {
+        using PlannerParams = MotionPlannerPlanSliceParams<
+            decltype(Config::e(Params::PlanSliceParams::TimeSlice::i())),
+            decltype(Config::e(Params::PlanSliceParams::DeadlineMargin::i()))
+        >;
+    }
+    AMBRO_STRUCT_ELSE(PlanSliceFeature) {
+        using PlannerParams = MotionPlannerNoPlanSliceParams;
+    };
+    
+    AMBRO_STRUCT_IF(PressureAdvanceFeature, Params::PressureAdvanceParams::Enabled) {
+        using PlannerParams = MotionPlannerAdvanceParams<decltype(Config::e(Params::PressureAdvanceParams::AdvanceTime::i()))>;
+    }
+    AMBRO_STRUCT_ELSE(PressureAdvanceFeature) {
+        using PlannerParams = MotionPlannerNoAdvanceParams;
+    };
+    
+    AMBRO_STRUCT_IF(InputShapingFeature, Params::InputShapingParams::Enabled) {
+        template <typename WrappedAxisName>
+        using AxisPlannerParams = If<
+            TypeListFind<typename Params::InputShapingParams::AxisNamesList, WrappedAxisName>::Found,
+            MotionPlannerShaperParams<
+                Params::InputShapingParams::ShaperType,
+                decltype(Config::e(Params::InputShapingParams::Frequency::i())),
+                decltype(Config::e(Params::InputShapingParams::DampingRatio::i()))
+            >,
+            MotionPlannerNoShaperParams
+        >;
+    }
+    AMBRO_STRUCT_ELSE(InputShapingFeature) {
+        template <typename WrappedAxisName>
+        using AxisPlannerParams = MotionPlannerNoShaperParams;
+    };
+    
+    // With a shared step timer, the axis drivers get channels of it instead
+    // of the timers given in their AxisDriverService.
+    AMBRO_STRUCT_IF(SharedStepTimerFeature, Params::SharedStepTimerParams::Enabled) {
+        struct Object;
+        
+        template <typename ThePrinterMain=PrinterMain>
+        struct DelayedChannelsList {
+            template <typename TheAxis>
+            using AxisTimer = typename TheAxis::TheAxisDriver::GetTimer;
+            
+            using List = MapTypeList<typename ThePrinterMain::AxesList, TemplateFunc<AxisTimer>>;
+        };
+        
+        APRINTER_MAKE_INSTANCE(TheSharedStepTimer, (SharedStepTimerArg<Context, Object, typename Params::SharedStepTimerParams::TimerService, DelayedChannelsList<>>))
+        
+        template <typename AxisDriverService>
+        using AxisDriverServiceFor = typename AxisDriverService::template WithTimerService<typename TheSharedStepTimer::ChannelService>;
+        
+        using GetTimer = typename TheSharedStepTimer::GetTimer;
+        
+        static void init (Context c)
+        {
+            TheSharedStepTimer::init(c);
+        }
+        
+        static void deinit (Context c)
+        {
+            TheSharedStepTimer::deinit(c);
+        }
+        
+        struct Object : public ObjBase<SharedStepTimerFeature, typename PrinterMain::Object, MakeTypeList<
+            TheSharedStepTimer
+        >> {};
+    }
+    AMBRO_STRUCT_ELSE(SharedStepTimerFeature) {
+        template <typename AxisDriverService>
+        using AxisDriverServiceFor = AxisDriverService;
+        
+        static void init (Context c) {}
+        static void deinit (Context c) {}
+        struct Object {};
+    };
+    
     using CInactiveTimeTicks = decltype(ExprCast<TimeType>(Config::e(Params::InactiveTime::i()) * TimeConversion()));
     using CForceTimeoutTicks = decltype(ExprCast<TimeType>(Config::e(Params::ForceTimeout::i()) * TimeConversion()));
     
@@ -583,15 +785,18 @@ public:
                 return true;
             }
             mo->planner_state = PLANNER_STOPPING;
-            if (mo->m_planning_pull_pending) {
+            if (mo->m_planning_pull_pending && !flush_held_move(c)) {
                 ThePlanner::waitFinished(c);
                 mo->force_timer.unset(c);
             }
             return false;
         }
         
+        // Moves (which go through move_end) set for_move. For other commands, a move
+        // held by the CoalesceFeature or the BlendFeature is submitted first, to keep
+        // the ordering.
         APRINTER_NO_INLINE
-        bool tryPlannedCommand (Context c)
+        bool tryPlannedCommand (Context c, bool for_move=false)
         {
             auto *mo = Object::self(c);
             
@@ -606,7 +811,9 @@ public:
                 now_active(c);
             }
             if (mo->m_planning_pull_pending) {
-                return true;
+                if (for_move || !flush_held_move(c)) {
+                    return true;
+                }
             }
             mo->planner_state = PLANNER_WAITING;
             return false;
@@ -1044,7 +1251,8 @@ private:
         APRINTER_MAKE_INSTANCE(TheStepperGroup, (StepperGroupArg<Context, LazySteppersList>))
         
         template <typename ThePrinterMain=PrinterMain> struct DelayedAxisDriverConsumersList;
-        APRINTER_MAKE_INSTANCE(TheAxisDriver, (AxisSpec::TheAxisDriverService::template Driver<Context, Object, TheStepperGroup, DelayedAxisDriverConsumersList<>>))
+        using TheAxisDriverService = typename SharedStepTimerFeature::template AxisDriverServiceFor<typename AxisSpec::TheAxisDriverService>;
+        APRINTER_MAKE_INSTANCE(TheAxisDriver, (TheAxisDriverService::template Driver<Context, Object, TheStepperGroup, DelayedAxisDriverConsumersList<>>))
         
         using StepFixedType = FixedPoint<AxisSpec::StepBits, false, 0>;
         using AbsStepFixedType = FixedPoint<AxisSpec::StepBits - 1, true, 0>;
@@ -1073,7 +1281,9 @@ private:
             decltype(Config::e(AxisSpec::DefaultCorneringDistance::i())),
             PlannerMaxSpeedRec,
             PlannerMaxAccelRec,
-            PlannerPrestepCallback
+            PlannerPrestepCallback,
+            If<IsExtruder, typename PressureAdvanceFeature::PlannerParams, MotionPlannerNoAdvanceParams>,
+            typename InputShapingFeature::template AxisPlannerParams<WrappedAxisName>
         > {};
         
         AMBRO_STRUCT_IF(HomingFeature, HomingSpec::Enabled) {
@@ -2097,115 +2307,1054 @@ public:
     using GetPhysVirtAxisByName = PhysVirtAxisHelper<FindPhysVirtAxis<AxisName>::Value>;
     
 private:
-    using MotionPlannerChannelsDict = ListCollect<ModuleClassesList, MemberType_MotionPlannerChannels>;
-    
-    using MotionPlannerChannels = TypeDictValues<MotionPlannerChannelsDict>;
-    using MotionPlannerAxes = MapTypeList<AxesList, GetMemberType_PlannerAxisSpec>;
-    using MotionPlannerLasers = MapTypeList<LasersList, GetMemberType_PlannerLaserSpec>;
-    
-public:
-    APRINTER_MAKE_INSTANCE(ThePlanner, (MotionPlannerArg<
-        Context, typename PlannerUnionPlanner::Object, Config, MotionPlannerAxes, Params::StepperSegmentBufferSize,
-        Params::LookaheadBufferSize, Params::LookaheadCommitCount, FpType, MaxStepsPerCycle,
-        PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback,
-        MotionPlannerChannels, MotionPlannerLasers
-    >))
-    using PlannerSplitBuffer = typename ThePlanner::SplitBuffer;
-    
-    template <typename PlannerChannelSpec>
-    using GetPlannerChannelIndex = TypeListIndex<MotionPlannerChannels, PlannerChannelSpec>;
-    
-private:
-    struct DummyCorrectionService {
-        static bool const CorrectionEnabled = false;
-        template <typename Src, typename Dst, bool Reverse> static void do_correction (Context c, Src src, Dst dst, WrapBool<Reverse>) {}
-    };
-    using TheCorrectionService = GetServiceFromModuleOrDefault<DummyCorrectionService, typename ServiceList::CorrectionService, MemberType_CorrectionFeature>;
-    
-private:
-    AMBRO_STRUCT_IF(LoadConfigFeature, TheConfigManager::HasStore) {
-        static void start_loading (Context c)
+    AMBRO_STRUCT_IF(ArcFeature, Params::ArcParams::Enabled) {
+        friend PrinterMain;
+        
+    public:
+        struct Object;
+        
+    private:
+        static int const AxisIndexX = FindPhysVirtAxis<'X'>::Value;
+        static int const AxisIndexY = FindPhysVirtAxis<'Y'>::Value;
+        static uint16_t const MaxChords = UINT16_MAX;
+        
+        using CChordalTolerance = decltype(ExprCast<FpType>(Config::e(Params::ArcParams::ChordalTolerance::i())));
+        
+    public:
+        using ConfigExprs = MakeTypeList<CChordalTolerance>;
+        
+    private:
+        static void init (Context c)
         {
-            lock(c);
-            TheConfigManager::startOperation(c, TheConfigManager::OperationType::LOAD);
+            auto *o = Object::self(c);
+            o->num_chords = 0;
         }
-    } AMBRO_STRUCT_ELSE(LoadConfigFeature) {
-        static void start_loading (Context c) {}
-    };
-    
-private:
-    static void virtual_homing_hook_completed (Context c, bool error)
-    {
-        auto *ob = PrinterMain::Object::self(c);
-        AMBRO_ASSERT(!ob->homing_error)
         
-        ob->homing_error = error;
-        if (ob->homing_error || !ob->homing_default) {
-            return homing_finished(c);
+        static void handle_arc_command (Context c, TheCommand *cmd, bool ccw)
+        {
+            auto *o = Object::self(c);
+            
+            // While an arc is in progress, we get here again each time the
+            // planner asks for another command, and continue with the next chord.
+            if (!cmd->tryPlannedCommand(c, true)) {
+                return;
+            }
+            if (o->num_chords == 0) {
+                AMBRO_PGM_P errstr = start_arc(c, cmd, ccw);
+                if (errstr) {
+                    cmd->reportError(c, errstr);
+                    return cmd->finishCommand(c);
+                }
+            }
+            return issue_chord(c, cmd);
         }
-        return TheHookExecutor::template startHook<ServiceList::AfterDefaultHomingHookService>(c);
-    }
-    
-    static void after_default_homing_hook_completed (Context c, bool error)
-    {
-        auto *ob = PrinterMain::Object::self(c);
-        AMBRO_ASSERT(!ob->homing_error)
-        AMBRO_ASSERT(ob->homing_default)
-        
-        ob->homing_error = error;
-        return homing_finished(c);
-    }
-    
-public:
-    struct GenericHookDispatcher {
-        template <typename HookType>
-        using GetHookProviders = GetServiceProviders<HookType>;
         
-        template <typename HookType, typename TheServiceProvider>
-        static bool dispatchHookToProvider (Context c)
+        static AMBRO_PGM_P start_arc (Context c, TheCommand *cmd, bool ccw)
         {
-            using TheModule = GetModule<TheServiceProvider::Key::Value>;
-            return TheModule::startHook(c, typename TheServiceProvider::Value::UserId(), get_locked(c));
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            
+            ListFor<ArcAxisList>([&] APRINTER_TL(axis, axis::init_pos(c)));
+            o->axes = 0;
+            o->time_freq_by_max_speed = ob->time_freq_by_max_speed;
+            
+            bool seen_center = false;
+            bool seen_radius = false;
+            FpType offset_x = 0.0f;
+            FpType offset_y = 0.0f;
+            FpType radius = 0.0f;
+            
+            for (auto i : LoopRangeAuto(cmd->getNumParts(c))) {
+                CommandPartRef part = cmd->getPart(c, i);
+                
+                if (!ListForBreak<ArcAxisList>([&] APRINTER_TL(axis, return axis::collect_end_pos(c, cmd, part, ob->axis_relative)))) {
+                    continue;
+                }
+                
+                char code = cmd->getPartCode(c, part);
+                
+                if (code == 'I') {
+                    offset_x = cmd->getPartFpValue(c, part);
+                    seen_center = true;
+                }
+                else if (code == 'J') {
+                    offset_y = cmd->getPartFpValue(c, part);
+                    seen_center = true;
+                }
+                else if (code == 'R') {
+                    radius = cmd->getPartFpValue(c, part);
+                    seen_radius = true;
+                }
+                else if (code == 'F') {
+                    o->time_freq_by_max_speed = (FpType)(TimeConversion::value() / Params::SpeedLimitMultiply::value()) / FloatMakePosOrPosZero(cmd->getPartFpValue(c, part));
+                    ob->time_freq_by_max_speed = o->time_freq_by_max_speed;
+                }
+            }
+            
+            FpType start_x = o->start_pos[AxisIndexX];
+            FpType start_y = o->start_pos[AxisIndexY];
+            FpType end_x = o->end_pos[AxisIndexX];
+            FpType end_y = o->end_pos[AxisIndexY];
+            
+            if (!seen_center) {
+                if (!seen_radius) {
+                    return AMBRO_PSTR("ArcCenterMissing");
+                }
+                // The center lies on the perpendicular bisector of the chord from
+                // the start to the end. A positive R selects the shorter arc.
+                FpType dx = end_x - start_x;
+                FpType dy = end_y - start_y;
+                FpType dist = FloatSqrt(dx * dx + dy * dy);
+                FpType abs_radius = FloatAbs(radius);
+                if (!(dist > 0.0f) || 2.0f * abs_radius < 0.999f * dist) {
+                    return AMBRO_PSTR("ArcRadiusTooSmall");
+                }
+                FpType h = FloatSqrt(FloatMakePosOrPosZero(abs_radius * abs_radius - 0.25f * dist * dist)) / dist;
+                if (ccw != (radius > 0.0f)) {
+                    h = -h;
+                }
+                offset_x = 0.5f * dx - h * dy;
+                offset_y = 0.5f * dy + h * dx;
+            }
+            
+            o->center_x = start_x + offset_x;
+            o->center_y = start_y + offset_y;
+            o->radius = FloatSqrt(offset_x * offset_x + offset_y * offset_y);
+            
+            FpType end_rx = end_x - o->center_x;
+            FpType end_ry = end_y - o->center_y;
+            FpType end_radius = FloatSqrt(end_rx * end_rx + end_ry * end_ry);
+            if (!(o->radius > 0.0f) || FloatAbs(end_radius - o->radius) > FloatMax((FpType)0.005f, 0.001f * o->radius)) {
+                return AMBRO_PSTR("ArcEndNotOnCircle");
+            }
+            
+            // Angle swept in the direction of travel, with coinciding start
+            // and end meaning a full circle.
+            FpType two_pi = 6.283185307f;
+            FpType cross = -offset_x * end_ry + offset_y * end_rx;
+            FpType dot = -offset_x * end_rx - offset_y * end_ry;
+            FpType sweep = FloatAtan2(ccw ? cross : -cross, dot);
+            if (sweep < 1e-6f) {
+                sweep += two_pi;
+            }
+            
+            // Each chord deviates from the arc by at most the chordal tolerance,
+            // and no chord spans more than a quarter turn.
+            FpType tolerance = APRINTER_CFG(Config, CChordalTolerance, c);
+            FpType chord_angle = FloatMin(0.25f * two_pi, 2.0f * FloatAcos(FloatMax((FpType)0.0f, 1.0f - tolerance / o->radius)));
+            FpType num_chords = FloatMax((FpType)1.0f, FloatCeil(sweep / chord_angle));
+            
+            o->start_angle = FloatAtan2(-offset_y, -offset_x);
+            o->sweep = ccw ? sweep : -sweep;
+            o->num_chords = (uint16_t)FloatMin((FpType)MaxChords, num_chords);
+            o->chord_index = 0;
+            o->axes |= PhysVirtAxisHelper<AxisIndexX>::AxisMask | PhysVirtAxisHelper<AxisIndexY>::AxisMask;
+            
+            return nullptr;
         }
-    };
-    
-private:
-    using MyHooks = MakeTypeList<
-        HookDefinition<ServiceList::VirtualHomingHookService,      GenericHookDispatcher, AMBRO_WFUNC_T(&PrinterMain::virtual_homing_hook_completed)>,
-        HookDefinition<ServiceList::AfterDefaultHomingHookService, GenericHookDispatcher, AMBRO_WFUNC_T(&PrinterMain::after_default_homing_hook_completed)>
-    >;
-    
-    using ModulesHooks = TypeDictValues<ListCollect<ModuleClassesList, MemberType_HookDefinitionList>>;
-    
-    APRINTER_MAKE_INSTANCE(TheHookExecutor, (HookExecutorArg<Context, typename PrinterMain::Object, JoinTypeLists<MyHooks, ModulesHooks>>))
-    
-public:
-    template <typename HookType>
-    static void startHookByInitiator (Context c)
-    {
-        static_assert(TypeListFindMapped<ModulesHooks, GetMemberType_HookType, HookType>::Found, "This hook is not defined by any module");
-        return TheHookExecutor::template startHook<HookType>(c);
-    }
-    
-public:
-    template <typename HookType>
-    static void hookCompletedByProvider (Context c, bool error)
-    {
-        return TheHookExecutor::template hookCompletedByProvider<HookType>(c, error);
-    }
-    
-    template <typename HookType>
-    static bool hookIsRunning (Context c)
-    {
-        return TheHookExecutor::template hookIsRunning<HookType>(c);
-    }
-    
-    static void getHomingRequest (Context c, PhysVirtAxisMaskType *req_axes, bool *default_homing)
-    {
-        AMBRO_ASSERT(hookIsRunning<ServiceList::VirtualHomingHookService>(c) || hookIsRunning<ServiceList::AfterDefaultHomingHookService>(c))
-        auto *ob = PrinterMain::Object::self(c);
         
-        *req_axes = ob->homing_req_axes;
+        static void issue_chord (Context c, TheCommand *cmd)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->num_chords > 0)
+            AMBRO_ASSERT(o->chord_index < o->num_chords)
+            
+            o->chord_index++;
+            bool last = (o->chord_index == o->num_chords);
+            FpType frac = (FpType)o->chord_index / o->num_chords;
+            
+            move_begin(c);
+            ListFor<ArcAxisList>([&] APRINTER_TL(axis, axis::add_chord_pos(c, frac, last)));
+            if (!last) {
+                FpType angle = o->start_angle + frac * o->sweep;
+                move_add_axis<AxisIndexX>(c, o->center_x + o->radius * FloatCos(angle));
+                move_add_axis<AxisIndexY>(c, o->center_y + o->radius * FloatSin(angle));
+            }
+            move_set_max_speed_opt(c, o->time_freq_by_max_speed);
+            // The chords already follow the arc within the chordal tolerance, so
+            // they are not coalesced.
+            return move_end(c, cmd, ArcFeature::chord_end_callback, false, false);
+        }
+        
+        static void chord_end_callback (Context c, bool error)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->num_chords > 0)
+            
+            TheCommand *cmd = get_locked(c);
+            if (error || o->chord_index == o->num_chords) {
+                o->num_chords = 0;
+                if (error) {
+                    cmd->reportError(c, nullptr);
+                }
+                return cmd->finishCommand(c);
+            }
+            if (!cmd->tryPlannedCommand(c, true)) {
+                return;
+            }
+            return issue_chord(c, cmd);
+        }
+        
+        template <int PhysVirtAxisIndex>
+        struct ArcAxis {
+            using TheHelper = PhysVirtAxisHelper<PhysVirtAxisIndex>;
+            static bool const IsPlaneAxis = (PhysVirtAxisIndex == AxisIndexX || PhysVirtAxisIndex == AxisIndexY);
+            
+            static void init_pos (Context c)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                o->start_pos[PhysVirtAxisIndex] = TheHelper::get_position(c);
+                o->end_pos[PhysVirtAxisIndex] = o->start_pos[PhysVirtAxisIndex];
+            }
+            
+            static bool collect_end_pos (Context c, TheCommand *cmd, CommandPartRef part, PhysVirtAxisMaskType axis_relative)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                
+                if (AMBRO_UNLIKELY(cmd->getPartCode(c, part) == TheHelper::AxisName)) {
+                    FpType req = cmd->getPartFpValue(c, part);
+                    if ((axis_relative & TheHelper::AxisMask)) {
+                        req += o->start_pos[PhysVirtAxisIndex];
+                    }
+                    o->end_pos[PhysVirtAxisIndex] = req;
+                    o->axes |= TheHelper::AxisMask;
+                    return false;
+                }
+                return true;
+            }
+            
+            static void add_chord_pos (Context c, FpType frac, bool last)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                
+                // Axes other than X and Y move linearly along the arc.
+                if ((o->axes & TheHelper::AxisMask) && (last || !IsPlaneAxis)) {
+                    FpType start = o->start_pos[PhysVirtAxisIndex];
+                    FpType end = o->end_pos[PhysVirtAxisIndex];
+                    move_add_axis<PhysVirtAxisIndex>(c, last ? end : (start + frac * (end - start)));
+                }
+            }
+        };
+        using ArcAxisList = IndexElemListCount<NumPhysVirtAxes, ArcAxis>;
+        
+    public:
+        struct Object : public ObjBase<ArcFeature, typename PrinterMain::Object, EmptyTypeList> {
+            FpType start_pos[NumPhysVirtAxes];
+            FpType end_pos[NumPhysVirtAxes];
+            FpType time_freq_by_max_speed;
+            FpType center_x;
+            FpType center_y;
+            FpType radius;
+            FpType start_angle;
+            FpType sweep;
+            PhysVirtAxisMaskType axes;
+            uint16_t num_chords;
+            uint16_t chord_index;
+        };
+    } AMBRO_STRUCT_ELSE(ArcFeature) {
+        static void init (Context c) {}
+        static void handle_arc_command (Context c, TheCommand *cmd, bool ccw) {}
+        struct Object {};
+    };
+    
+    AMBRO_STRUCT_IF(CoalesceFeature, Params::CoalesceParams::Enabled) {
+        friend PrinterMain;
+        
+        static_assert(!TransformParams::Enabled, "Move coalescing is not supported with a coordinate transformation.");
+        static_assert(TypeListLength<LasersList>::Value == 0, "Move coalescing is not supported with lasers.");
+        static_assert(Params::CoalesceParams::MaxMergedMoves >= 1 && Params::CoalesceParams::MaxMergedMoves <= 255, "");
+        
+    public:
+        struct Object;
+        
+    private:
+        using DegreesToRadians = APRINTER_FP_CONST_EXPR(0.017453292519943295);
+        
+        using CMaxDeviation = decltype(ExprCast<FpType>(Config::e(Params::CoalesceParams::MaxDeviation::i())));
+        using CMinDirectionCos = decltype(ExprCast<FpType>(ExprCos(Config::e(Params::CoalesceParams::MaxDirectionChange::i()) * DegreesToRadians())));
+        using CSpeedTolerance = decltype(ExprCast<FpType>(Config::e(Params::CoalesceParams::SpeedTolerance::i())));
+        
+    public:
+        using ConfigExprs = MakeTypeList<CMaxDeviation, CMinDirectionCos, CSpeedTolerance>;
+        
+    private:
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->held = false;
+        }
+        
+        // Called from move_end for moves of the normal planner. The move is not
+        // submitted right away but held, so that the following moves can be merged
+        // into it. If a move is already held and the new one cannot be merged,
+        // the held move is submitted and the new move is held instead.
+        // Moves which are not mergeable (arc chords) are not merged into the held
+        // move, and no moves are merged into them. They are still held, so each one
+        // waits for the planner like other moves, after the move held before it.
+        static bool hold_move (Context c, bool mergeable)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
+            
+            if (o->held) {
+                if (mergeable && try_merge(c, cmd->axes.rel_max_v_rec)) {
+                    set_force_timer(c);
+                    return true;
+                }
+                
+                // The held move ends at the start of the new move (m_old_pos).
+                FpType new_time_freq_by_max_speed = ob->move_time_freq_by_max_speed;
+                bool new_seen_cartesian = ob->move_seen_cartesian;
+                FpType new_nominal_time = cmd->axes.rel_max_v_rec;
+                ListFor<CoalesceAxisList>([&] APRINTER_TL(axis, axis::swap_req_old_pos(c)));
+                submit_held(c);
+                ListFor<CoalesceAxisList>([&] APRINTER_TL(axis, axis::swap_req_old_pos(c)));
+                start_held(c, new_time_freq_by_max_speed, new_seen_cartesian, new_nominal_time, mergeable);
+                return true;
+            }
+            
+            start_held(c, ob->move_time_freq_by_max_speed, ob->move_seen_cartesian, cmd->axes.rel_max_v_rec, mergeable);
+            set_force_timer(c);
+            return true;
+        }
+        
+        // Submits the held move, if any. The planner must be waiting for a command.
+        static bool flush (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (!o->held) {
+                return false;
+            }
+            submit_held(c);
+            return true;
+        }
+        
+        static void start_held (Context c, FpType time_freq_by_max_speed, bool seen_cartesian, FpType nominal_time, bool mergeable)
+        {
+            auto *o = Object::self(c);
+            
+            ListFor<CoalesceAxisList>([&] APRINTER_TL(axis, axis::set_start_pos(c)));
+            o->time_freq_by_max_speed = time_freq_by_max_speed;
+            o->nominal_time = nominal_time;
+            o->deviation = 0.0f;
+            // A move which is not mergeable counts as full, so try_merge refuses it.
+            o->num_merged = mergeable ? 1 : Params::CoalesceParams::MaxMergedMoves;
+            o->seen_cartesian = seen_cartesian;
+            o->held = true;
+        }
+        
+        static void scale_nominal_time (Context c, FpType time_factor)
+        {
+            auto *o = Object::self(c);
+            o->time_freq_by_max_speed *= time_factor;
+            o->nominal_time *= time_factor;
+        }
+        
+        static void submit_held (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            AMBRO_ASSERT(o->held)
+            
+            ob->move_time_freq_by_max_speed = o->time_freq_by_max_speed;
+            ob->move_seen_cartesian = o->seen_cartesian;
+            PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
+            cmd->axes.rel_max_v_rec = o->nominal_time;
+            o->held = false;
+            submit_move(c, false);
+        }
+        
+        static bool try_merge (Context c, FpType new_nominal_time)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            
+            if (o->nominal_time != 0.0f || new_nominal_time != 0.0f || o->num_merged >= Params::CoalesceParams::MaxMergedMoves) {
+                return false;
+            }
+            
+            FpType new_time_freq_by_max_speed = ob->move_time_freq_by_max_speed;
+            FpType max_time_freq_by_max_speed = FloatMax(o->time_freq_by_max_speed, new_time_freq_by_max_speed);
+            if (FloatAbs(new_time_freq_by_max_speed - o->time_freq_by_max_speed) > APRINTER_CFG(Config, CSpeedTolerance, c) * max_time_freq_by_max_speed) {
+                return false;
+            }
+            
+            // Vectors over all axes: held (start to end of the held move), added
+            // (the new move) and merged (start to end of the new move).
+            FpType held_sq = 0.0f;
+            FpType added_sq = 0.0f;
+            FpType held_dot_added = 0.0f;
+            FpType held_dot_merged = 0.0f;
+            FpType merged_sq = 0.0f;
+            ListFor<CoalesceAxisList>([&] APRINTER_TL(axis, axis::add_products(c, &held_sq, &added_sq, &held_dot_added, &held_dot_merged, &merged_sq)));
+            
+            FpType deviation = o->deviation;
+            if (held_sq > 0.0f && added_sq > 0.0f) {
+                if (held_dot_added < APRINTER_CFG(Config, CMinDirectionCos, c) * FloatSqrt(held_sq * added_sq) || !(merged_sq > 0.0f)) {
+                    return false;
+                }
+                // Distance of the end of the held move from the merged move. Added to
+                // the previous bound, this bounds the distance of all the merged points.
+                deviation += FloatSqrt(FloatMakePosOrPosZero(held_sq - (held_dot_merged * held_dot_merged) / merged_sq));
+                if (deviation > APRINTER_CFG(Config, CMaxDeviation, c)) {
+                    return false;
+                }
+            }
+            
+            o->time_freq_by_max_speed = max_time_freq_by_max_speed;
+            o->deviation = deviation;
+            o->num_merged++;
+            o->seen_cartesian |= ob->move_seen_cartesian;
+            return true;
+        }
+        
+        template <int AxisIndex>
+        struct CoalesceAxis {
+            using TheAxis = Axis<AxisIndex>;
+            
+            static void set_start_pos (Context c)
+            {
+                auto *o = CoalesceFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                o->start_pos[AxisIndex] = axis->m_old_pos;
+            }
+            
+            static void swap_req_old_pos (Context c)
+            {
+                auto *axis = TheAxis::Object::self(c);
+                FpType req_pos = axis->m_req_pos;
+                axis->m_req_pos = axis->m_old_pos;
+                axis->m_old_pos = req_pos;
+            }
+            
+            static void add_products (Context c, FpType *held_sq, FpType *added_sq, FpType *held_dot_added, FpType *held_dot_merged, FpType *merged_sq)
+            {
+                auto *o = CoalesceFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                FpType held = axis->m_old_pos - o->start_pos[AxisIndex];
+                FpType added = axis->m_req_pos - axis->m_old_pos;
+                FpType merged = axis->m_req_pos - o->start_pos[AxisIndex];
+                *held_sq += held * held;
+                *added_sq += added * added;
+                *held_dot_added += held * added;
+                *held_dot_merged += held * merged;
+                *merged_sq += merged * merged;
+            }
+        };
+        using CoalesceAxisList = IndexElemListCount<NumAxes, CoalesceAxis>;
+        
+    public:
+        struct Object : public ObjBase<CoalesceFeature, typename PrinterMain::Object, EmptyTypeList> {
+            FpType start_pos[NumAxes];
+            FpType time_freq_by_max_speed;
+            FpType nominal_time;
+            FpType deviation;
+            uint8_t num_merged;
+            bool held;
+            bool seen_cartesian;
+        };
+    } AMBRO_STRUCT_ELSE(CoalesceFeature) {
+        static void init (Context c) {}
+        static bool hold_move (Context c, bool mergeable) { return false; }
+        static bool flush (Context c) { return false; }
+        static void scale_nominal_time (Context c, FpType time_factor) {}
+        struct Object {};
+    };
+    
+    // Path blending (G64 P<tolerance>). Like the CoalesceFeature, move_end holds each
+    // move of the normal planner until the next move shows the corner at its end.
+    // A corner which turns by more than MaxChordAngle is then replaced by an arc
+    // tangent to both moves, which is executed as chords turning by at most
+    // MaxChordAngle each. The arc is chosen such that the path (including the
+    // chords) stays within the tolerance of the corner, but it uses at most half
+    // of the remaining length of either move. The chords are issued one per planner
+    // pull, before anything else.
+    AMBRO_STRUCT_IF(BlendFeature, Params::BlendParams::Enabled) {
+        friend PrinterMain;
+        
+        static_assert(!TransformParams::Enabled, "Path blending is not supported with a coordinate transformation.");
+        static_assert(!Params::CoalesceParams::Enabled, "Path blending is not supported together with move coalescing.");
+        
+    public:
+        struct Object;
+        
+    private:
+        static uint16_t const MaxChords = UINT16_MAX;
+        
+        using DegreesToRadians = APRINTER_FP_CONST_EXPR(0.017453292519943295);
+        using MaxChordAngle = decltype(Config::e(Params::BlendParams::MaxChordAngle::i()) * DegreesToRadians());
+        
+        using CDefaultTolerance = decltype(ExprCast<FpType>(Config::e(Params::BlendParams::DefaultTolerance::i())));
+        using CMaxChordAngleRec = decltype(ExprCast<FpType>(ExprRec(MaxChordAngle())));
+        using CMinBlendCos = decltype(ExprCast<FpType>(ExprCos(MaxChordAngle())));
+        
+    public:
+        using ConfigExprs = MakeTypeList<CDefaultTolerance, CMaxChordAngleRec, CMinBlendCos>;
+        
+    private:
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->tolerance = 0.0f;
+            o->num_chords = 0;
+            o->chord_index = 0;
+            o->held = false;
+            o->release = false;
+        }
+        
+        static void set_mode (Context c, TheCommand *cmd, bool continuous)
+        {
+            auto *o = Object::self(c);
+            
+            FpType tolerance = 0.0f;
+            if (continuous) {
+                tolerance = cmd->get_command_param_fp(c, 'P', APRINTER_CFG(Config, CDefaultTolerance, c));
+            }
+            o->tolerance = FloatMakePosOrPosZero(tolerance);
+        }
+        
+        // Called from move_end for moves of the normal planner, see the CoalesceFeature.
+        static bool hold_move (Context c, bool is_rapid_move)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
+            AMBRO_ASSERT(!is_blending(c))
+            
+            if (!o->held && o->tolerance == 0.0f) {
+                return false;
+            }
+            
+            save_new_energy(c, is_rapid_move);
+            
+            if (!o->held) {
+                start_held(c, ob->move_time_freq_by_max_speed, ob->move_seen_cartesian, cmd->axes.rel_max_v_rec);
+                set_force_timer(c);
+                return true;
+            }
+            
+            FpType new_time_freq_by_max_speed = ob->move_time_freq_by_max_speed;
+            bool new_seen_cartesian = ob->move_seen_cartesian;
+            FpType new_nominal_time = cmd->axes.rel_max_v_rec;
+            
+            if (plan_blend(c, new_nominal_time)) {
+                // Submit the held move up to the start of the arc. The new move is
+                // held from the end of the arc, and the chords follow on the next pulls.
+                o->chord_time_freq_by_max_speed = FloatMax(o->time_freq_by_max_speed, new_time_freq_by_max_speed);
+                ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::set_req_pos_at_blend_start(c)));
+                ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::load_energy(c)));
+                submit_blend_move(c, o->time_freq_by_max_speed);
+                start_held(c, new_time_freq_by_max_speed, new_seen_cartesian, new_nominal_time);
+                ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::set_start_pos_at_blend_end(c)));
+                return true;
+            }
+            
+            // The held move ends at the start of the new move (m_old_pos).
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::swap_req_old_pos(c)));
+            submit_held(c);
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::swap_req_old_pos(c)));
+            start_held(c, new_time_freq_by_max_speed, new_seen_cartesian, new_nominal_time);
+            
+            // In exact path mode (after G61), the new move does not wait for another one.
+            o->release = (o->tolerance == 0.0f);
+            return true;
+        }
+        
+        // Submits the held move, if any. The planner must be waiting for a command.
+        static bool flush (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(!is_blending(c))
+            
+            if (!o->held) {
+                return false;
+            }
+            submit_held(c);
+            return true;
+        }
+        
+        // Whether there are chords (or a released move) to be submitted on the next pull.
+        static bool is_blending (Context c)
+        {
+            auto *o = Object::self(c);
+            return o->chord_index != o->num_chords || o->release;
+        }
+        
+        static void do_blend (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(is_blending(c))
+            
+            if (o->chord_index == o->num_chords) {
+                AMBRO_ASSERT(o->held)
+                return submit_held(c);
+            }
+            
+            o->chord_index++;
+            bool last = (o->chord_index == o->num_chords);
+            FpType frac = (FpType)o->chord_index / o->num_chords;
+            FpType angle = frac * o->angle;
+            FpType arc_a_factor = FloatCos(angle) - 1.0f;
+            FpType arc_b_factor = FloatSin(angle);
+            bool second_half = (2 * o->chord_index > o->num_chords);
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::set_req_pos_at_chord(c, arc_a_factor, arc_b_factor, last)));
+            ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::load_chord_energy(c, second_half)));
+            submit_blend_move(c, o->chord_time_freq_by_max_speed);
+        }
+        
+        static void scale_nominal_time (Context c, FpType time_factor)
+        {
+            auto *o = Object::self(c);
+            o->time_freq_by_max_speed *= time_factor;
+            o->nominal_time *= time_factor;
+            o->chord_time_freq_by_max_speed *= time_factor;
+        }
+        
+        static void start_held (Context c, FpType time_freq_by_max_speed, bool seen_cartesian, FpType nominal_time)
+        {
+            auto *o = Object::self(c);
+            
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::set_start_pos(c)));
+            ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::start_held(c)));
+            o->time_freq_by_max_speed = time_freq_by_max_speed;
+            o->nominal_time = nominal_time;
+            o->seen_cartesian = seen_cartesian;
+            o->held = true;
+        }
+        
+        static void submit_held (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            AMBRO_ASSERT(o->held)
+            
+            ob->move_time_freq_by_max_speed = o->time_freq_by_max_speed;
+            ob->move_seen_cartesian = o->seen_cartesian;
+            PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
+            cmd->axes.rel_max_v_rec = o->nominal_time;
+            ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::load_energy(c)));
+            o->held = false;
+            o->release = false;
+            submit_move(c, false);
+        }
+        
+        // Computes the laser energies of the new move the way submit_move would.
+        // A held move keeps these energies, since the laser density may change
+        // before it is submitted and blending shortens it.
+        static void save_new_energy (Context c, bool is_rapid_move)
+        {
+            auto *ob = PrinterMain::Object::self(c);
+            
+            if (TypeListLength<LasersList>::Value > 0 && ob->move_seen_cartesian) {
+                FpType distance_squared = 0.0f;
+                ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::add_move_squared(c, &distance_squared)));
+                FpType distance = FloatSqrt(distance_squared);
+                ListFor<LasersList>([&] APRINTER_TL(laser, laser::handle_automatic_energy(c, distance, is_rapid_move)));
+            }
+            ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::save_new_energy(c)));
+        }
+        
+        // Submits a move to the requested positions set up by the BlendAxis,
+        // then restores the requested positions (saved in m_old_pos).
+        static void submit_blend_move (Context c, FpType time_freq_by_max_speed)
+        {
+            auto *ob = PrinterMain::Object::self(c);
+            
+            ob->move_time_freq_by_max_speed = time_freq_by_max_speed;
+            ob->move_seen_cartesian = true;
+            PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
+            cmd->axes.rel_max_v_rec = 0.0f;
+            submit_move(c, false);
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::restore_req_pos(c)));
+        }
+        
+        // Computes the arc replacing the corner between the held move and the new
+        // move, returning false if the corner is not to be blended.
+        static bool plan_blend (Context c, FpType new_nominal_time)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->tolerance == 0.0f || o->nominal_time != 0.0f || new_nominal_time != 0.0f) {
+                return false;
+            }
+            
+            // The arc is shorter than the path it replaces, so an extruder moving
+            // along it would extrude too much per length.
+            if (!ListForBreak<BlendAxisList>([&] APRINTER_TL(axis, return axis::allows_blend(c)))) {
+                return false;
+            }
+            
+            // Vectors over the cartesian axes: held (start to end of the held move)
+            // and added (the new move).
+            FpType held_sq = 0.0f;
+            FpType added_sq = 0.0f;
+            FpType held_dot_added = 0.0f;
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::add_products(c, &held_sq, &added_sq, &held_dot_added)));
+            if (!(held_sq > 0.0f) || !(added_sq > 0.0f)) {
+                return false;
+            }
+            
+            FpType held_len = FloatSqrt(held_sq);
+            FpType added_len = FloatSqrt(added_sq);
+            FpType cos_angle = held_dot_added / (held_len * added_len);
+            
+            // Gentle corners are left to the cornering speed limit, and near
+            // reversals the plane of the arc is not well defined.
+            if (cos_angle >= APRINTER_CFG(Config, CMinBlendCos, c) || cos_angle <= -0.999f) {
+                return false;
+            }
+            
+            FpType angle = FloatAcos(cos_angle);
+            FpType num_chords = FloatMin((FpType)MaxChords, FloatMax((FpType)1.0f, FloatCeil(angle * APRINTER_CFG(Config, CMaxChordAngleRec, c))));
+            FpType sin_angle = FloatSqrt(FloatMakePosOrPosZero(1.0f - cos_angle * cos_angle));
+            FpType tan_half = sin_angle / (1.0f + cos_angle);
+            
+            // Distance from the corner to the middle of the middle chord, per radius.
+            FpType half_angle = 0.5f * angle;
+            FpType dev_per_radius = 1.0f / FloatCos(half_angle) - FloatCos(half_angle / num_chords);
+            FpType dist = FloatMin(tan_half * (o->tolerance / dev_per_radius), 0.5f * FloatMin(held_len, added_len));
+            FpType radius = dist / tan_half;
+            
+            // Points on the arc are blend_start + (cos(t) - 1) * arc_a + sin(t) * arc_b,
+            // where arc_a points away from the center and arc_b along the held move.
+            FpType held_scale = dist / held_len;
+            FpType added_scale = dist / added_len;
+            FpType a_scale = radius / (sin_angle * added_len);
+            FpType a_held_scale = radius * cos_angle / (sin_angle * held_len);
+            FpType b_scale = radius / held_len;
+            ListFor<BlendAxisList>([&] APRINTER_TL(axis, axis::set_blend(c, held_scale, added_scale, a_scale, a_held_scale, b_scale)));
+            
+            FpType chord_len = 2.0f * radius * FloatSin(half_angle / num_chords);
+            ListFor<BlendLaserList>([&] APRINTER_TL(laser, laser::set_blend(c, held_scale, added_scale, chord_len / held_len, chord_len / added_len)));
+            
+            o->angle = angle;
+            o->num_chords = (uint16_t)num_chords;
+            o->chord_index = 0;
+            return true;
+        }
+        
+        template <int AxisIndex>
+        struct BlendAxis {
+            using TheAxis = Axis<AxisIndex>;
+            static bool const IsCartesian = TheAxis::AxisSpec::IsCartesian;
+            
+            static void set_start_pos (Context c)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                o->start_pos[AxisIndex] = axis->m_old_pos;
+            }
+            
+            static void set_start_pos_at_blend_end (Context c)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                o->start_pos[AxisIndex] = o->blend_end[AxisIndex];
+            }
+            
+            static void swap_req_old_pos (Context c)
+            {
+                auto *axis = TheAxis::Object::self(c);
+                FpType req_pos = axis->m_req_pos;
+                axis->m_req_pos = axis->m_old_pos;
+                axis->m_old_pos = req_pos;
+            }
+            
+            static void restore_req_pos (Context c)
+            {
+                auto *axis = TheAxis::Object::self(c);
+                axis->m_req_pos = axis->m_old_pos;
+            }
+            
+            static bool allows_blend (Context c)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                return IsCartesian || (axis->m_old_pos == o->start_pos[AxisIndex] && axis->m_req_pos == axis->m_old_pos);
+            }
+            
+            static void add_move_squared (Context c, FpType *distance_squared)
+            {
+                auto *axis = TheAxis::Object::self(c);
+                if (IsCartesian) {
+                    FpType delta = axis->m_req_pos - axis->m_old_pos;
+                    *distance_squared += delta * delta;
+                }
+            }
+            
+            static void add_products (Context c, FpType *held_sq, FpType *added_sq, FpType *held_dot_added)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                if (IsCartesian) {
+                    FpType held = axis->m_old_pos - o->start_pos[AxisIndex];
+                    FpType added = axis->m_req_pos - axis->m_old_pos;
+                    *held_sq += held * held;
+                    *added_sq += added * added;
+                    *held_dot_added += held * added;
+                }
+            }
+            
+            // Axes which are not cartesian do not move (see allows_blend), so
+            // they stay at the same position over the arc.
+            static void set_blend (Context c, FpType held_scale, FpType added_scale, FpType a_scale, FpType a_held_scale, FpType b_scale)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                FpType held = axis->m_old_pos - o->start_pos[AxisIndex];
+                FpType added = axis->m_req_pos - axis->m_old_pos;
+                o->blend_start[AxisIndex] = axis->m_old_pos - held_scale * held;
+                o->blend_end[AxisIndex] = axis->m_old_pos + added_scale * added;
+                if (IsCartesian) {
+                    o->arc_a[AxisIndex] = a_held_scale * held - a_scale * added;
+                    o->arc_b[AxisIndex] = b_scale * held;
+                }
+            }
+            
+            static void set_req_pos_at_blend_start (Context c)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                axis->m_old_pos = axis->m_req_pos;
+                axis->m_req_pos = o->blend_start[AxisIndex];
+            }
+            
+            static void set_req_pos_at_chord (Context c, FpType arc_a_factor, FpType arc_b_factor, bool last)
+            {
+                auto *o = BlendFeature::Object::self(c);
+                auto *axis = TheAxis::Object::self(c);
+                FpType start = o->blend_start[AxisIndex];
+                FpType end = o->blend_end[AxisIndex];
+                FpType pos;
+                if (last) {
+                    pos = end;
+                } else if (IsCartesian) {
+                    pos = start + arc_a_factor * o->arc_a[AxisIndex] + arc_b_factor * o->arc_b[AxisIndex];
+                } else {
+                    pos = start;
+                }
+                axis->m_old_pos = axis->m_req_pos;
+                axis->m_req_pos = pos;
+            }
+        };
+        using BlendAxisList = IndexElemListCount<NumAxes, BlendAxis>;
+        
+        // Laser energies of the held move and of the new move, and of the chords
+        // of the arc. The chords in each half of the arc get the energy per length
+        // of the adjacent move.
+        template <int LaserIndex>
+        struct BlendLaser {
+            static void save_new_energy (Context c)
+            {
+                auto *o = Object::self(c);
+                auto *laser = Laser<LaserIndex>::Object::self(c);
+                o->new_energy = laser->move_energy;
+            }
+            
+            static void start_held (Context c)
+            {
+                auto *o = Object::self(c);
+                o->energy = o->new_energy;
+            }
+            
+            static void set_blend (Context c, FpType held_scale, FpType added_scale, FpType held_chord_frac, FpType added_chord_frac)
+            {
+                auto *o = Object::self(c);
+                o->chord_energy[0] = held_chord_frac * o->energy;
+                o->chord_energy[1] = added_chord_frac * o->new_energy;
+                o->energy *= 1.0f - held_scale;
+                o->new_energy *= 1.0f - added_scale;
+            }
+            
+            static void load_energy (Context c)
+            {
+                auto *o = Object::self(c);
+                move_add_laser<LaserIndex>(c, o->energy);
+            }
+            
+            static void load_chord_energy (Context c, bool second_half)
+            {
+                auto *o = Object::self(c);
+                move_add_laser<LaserIndex>(c, o->chord_energy[second_half]);
+            }
+            
+            struct Object : public ObjBase<BlendLaser, typename BlendFeature::Object, EmptyTypeList> {
+                FpType energy;
+                FpType new_energy;
+                FpType chord_energy[2];
+            };
+        };
+        using BlendLaserList = IndexElemList<ParamsLasersList, BlendLaser>;
+        
+    public:
+        struct Object : public ObjBase<BlendFeature, typename PrinterMain::Object, BlendLaserList> {
+            FpType start_pos[NumAxes];
+            FpType blend_start[NumAxes];
+            FpType blend_end[NumAxes];
+            FpType arc_a[NumAxes];
+            FpType arc_b[NumAxes];
+            FpType tolerance;
+            FpType time_freq_by_max_speed;
+            FpType nominal_time;
+            FpType chord_time_freq_by_max_speed;
+            FpType angle;
+            uint16_t num_chords;
+            uint16_t chord_index;
+            bool held;
+            bool release;
+            bool seen_cartesian;
+        };
+    } AMBRO_STRUCT_ELSE(BlendFeature) {
+        static void init (Context c) {}
+        static void set_mode (Context c, TheCommand *cmd, bool continuous) {}
+        static bool hold_move (Context c, bool is_rapid_move) { return false; }
+        static bool flush (Context c) { return false; }
+        static bool is_blending (Context c) { return false; }
+        static void do_blend (Context c) {}
+        static void scale_nominal_time (Context c, FpType time_factor) {}
+        struct Object {};
+    };
+    
+    // Submits a move held back by the CoalesceFeature or the BlendFeature, if any.
+    static bool flush_held_move (Context c)
+    {
+        return CoalesceFeature::flush(c) || BlendFeature::flush(c);
+    }
+    
+private:
+    using MotionPlannerChannelsDict = ListCollect<ModuleClassesList, MemberType_MotionPlannerChannels>;
+    
+    using MotionPlannerChannels = TypeDictValues<MotionPlannerChannelsDict>;
+    using MotionPlannerAxes = MapTypeList<AxesList, GetMemberType_PlannerAxisSpec>;
+    using MotionPlannerLasers = MapTypeList<LasersList, GetMemberType_PlannerLaserSpec>;
+    
+    AMBRO_STRUCT_IF(PlannerTelemetryFeature, HasServiceProvider<ServiceList::PlannerTelemetryService>::Value) {
+        using TelemetryModule = GetServiceProviderModule<ServiceList::PlannerTelemetryService>;
+        
+        static void plan_callback (Context c, MotionPlannerPlanInfo<TimeType> const *info)
+        {
+            TelemetryModule::planner_plan_done(c, info);
+        }
+        struct PlanCallback : public AMBRO_WFUNC_TD(&PlannerTelemetryFeature::plan_callback) {};
+        
+        static void underrun_end_callback (Context c, TimeType duration)
+        {
+            TelemetryModule::planner_underrun_end(c, duration);
+        }
+        struct UnderrunEndCallback : public AMBRO_WFUNC_TD(&PlannerTelemetryFeature::underrun_end_callback) {};
+        
+        using PlannerParams = MotionPlannerTelemetryParams<PlanCallback, UnderrunEndCallback>;
+    }
+    AMBRO_STRUCT_ELSE(PlannerTelemetryFeature) {
+        using PlannerParams = MotionPlannerNoTelemetryParams;
+    };
+    
+public:
+    APRINTER_MAKE_INSTANCE(ThePlanner, (MotionPlannerArg<
+        Context, typename PlannerUnionPlanner::Object, Config, MotionPlannerAxes, Params::StepperSegmentBufferSize,
+        Params::LookaheadBufferSize, Params::LookaheadCommitCount, typename LookaheadTimeFeature::PlannerParams,
+        typename PlanSliceFeature::PlannerParams, Params::SCurvePieces,
+        typename JunctionDeviationFeature::PlannerParams, FpType, MaxStepsPerCycle,
+        PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback,
+        typename PlannerTelemetryFeature::PlannerParams, Params::RealtimeSpeedRatio, Params::FeedHold, MotionPlannerChannels, MotionPlannerLasers
+    >))
+    using PlannerSplitBuffer = typename ThePlanner::SplitBuffer;
+    
+    template <typename PlannerChannelSpec>
+    using GetPlannerChannelIndex = TypeListIndex<MotionPlannerChannels, PlannerChannelSpec>;
+    
+private:
+    struct DummyCorrectionService {
+        static bool const CorrectionEnabled = false;
+        template <typename Src, typename Dst, bool Reverse> static void do_correction (Context c, Src src, Dst dst, WrapBool<Reverse>) {}
+    };
+    using TheCorrectionService = GetServiceFromModuleOrDefault<DummyCorrectionService, typename ServiceList::CorrectionService, MemberType_CorrectionFeature>;
+    
+private:
+    AMBRO_STRUCT_IF(LoadConfigFeature, TheConfigManager::HasStore) {
+        static void start_loading (Context c)
+        {
+            lock(c);
+            TheConfigManager::startOperation(c, TheConfigManager::OperationType::LOAD);
+        }
+    } AMBRO_STRUCT_ELSE(LoadConfigFeature) {
+        static void start_loading (Context c) {}
+    };
+    
+private:
+    static void virtual_homing_hook_completed (Context c, bool error)
+    {
+        auto *ob = PrinterMain::Object::self(c);
+        AMBRO_ASSERT(!ob->homing_error)
+        
+        ob->homing_error = error;
+        if (ob->homing_error || !ob->homing_default) {
+            return homing_finished(c);
+        }
+        return TheHookExecutor::template startHook<ServiceList::AfterDefaultHomingHookService>(c);
+    }
+    
+    static void after_default_homing_hook_completed (Context c, bool error)
+    {
+        auto *ob = PrinterMain::Object::self(c);
+        AMBRO_ASSERT(!ob->homing_error)
+        AMBRO_ASSERT(ob->homing_default)
+        
+        ob->homing_error = error;
+        return homing_finished(c);
+    }
+    
+public:
+    struct GenericHookDispatcher {
+        template <typename HookType>
+        using GetHookProviders = GetServiceProviders<HookType>;
+        
+        template <typename HookType, typename TheServiceProvider>
+        static bool dispatchHookToProvider (Context c)
+        {
+            using TheModule = GetModule<TheServiceProvider::Key::Value>;
+            return TheModule::startHook(c, typename TheServiceProvider::Value::UserId(), get_locked(c));
+        }
+    };
+    
+private:
+    using MyHooks = MakeTypeList<
+        HookDefinition<ServiceList::VirtualHomingHookService,      GenericHookDispatcher, AMBRO_WFUNC_T(&PrinterMain::virtual_homing_hook_completed)>,
+        HookDefinition<ServiceList::AfterDefaultHomingHookService, GenericHookDispatcher, AMBRO_WFUNC_T(&PrinterMain::after_default_homing_hook_completed)>
+    >;
+    
+    using ModulesHooks = TypeDictValues<ListCollect<ModuleClassesList, MemberType_HookDefinitionList>>;
+    
+    APRINTER_MAKE_INSTANCE(TheHookExecutor, (HookExecutorArg<Context, typename PrinterMain::Object, JoinTypeLists<MyHooks, ModulesHooks>>))
+    
+public:
+    template <typename HookType>
+    static void startHookByInitiator (Context c)
+    {
+        static_assert(TypeListFindMapped<ModulesHooks, GetMemberType_HookType, HookType>::Found, "This hook is not defined by any module");
+        return TheHookExecutor::template startHook<HookType>(c);
+    }
+    
+public:
+    template <typename HookType>
+    static void hookCompletedByProvider (Context c, bool error)
+    {
+        return TheHookExecutor::template hookCompletedByProvider<HookType>(c, error);
+    }
+    
+    template <typename HookType>
+    static bool hookIsRunning (Context c)
+    {
+        return TheHookExecutor::template hookIsRunning<HookType>(c);
+    }
+    
+    static void getHomingRequest (Context c, PhysVirtAxisMaskType *req_axes, bool *default_homing)
+    {
+        AMBRO_ASSERT(hookIsRunning<ServiceList::VirtualHomingHookService>(c) || hookIsRunning<ServiceList::AfterDefaultHomingHookService>(c))
+        auto *ob = PrinterMain::Object::self(c);
+        
+        *req_axes = ob->homing_req_axes;
         *default_homing = ob->homing_default;
     }
     
@@ -2227,9 +3376,13 @@ public:
         TheSteppers::init(c);
         ob->axis_homing = 0;
         ob->axis_relative = 0;
+        SharedStepTimerFeature::init(c);
         ListFor<AxesList>([&] APRINTER_TL(axis, axis::init(c)));
         ListFor<LasersList>([&] APRINTER_TL(laser, laser::init(c)));
         TransformFeature::init(c);
+        ArcFeature::init(c);
+        CoalesceFeature::init(c);
+        BlendFeature::init(c);
         ob->time_freq_by_max_speed = 0.0f;
         ob->speed_ratio_rec = 1.0f;
         ob->locked = false;
@@ -2257,6 +3410,7 @@ public:
         TheHookExecutor::deinit(c);
         ListForReverse<LasersList>([&] APRINTER_TL(laser, laser::deinit(c)));
         ListForReverse<AxesList>([&] APRINTER_TL(axis, axis::deinit(c)));
+        SharedStepTimerFeature::deinit(c);
         TheSteppers::deinit(c);
         TheBlinker::deinit(c);
         AMBRO_ASSERT(ob->command_stream_list.isEmpty())
@@ -2275,6 +3429,9 @@ public:
     template <int AxisIndex>
     using GetAxisTimer = typename Axis<AxisIndex>::TheAxisDriver::GetTimer;
     
+    template <typename TheSharedStepTimerFeature=SharedStepTimerFeature>
+    using GetSharedStepTimer = typename TheSharedStepTimerFeature::GetTimer;
+    
     template <int LaserIndex>
     using GetLaserDriver = typename ThePlanner::template Laser<LaserIndex>::TheLaserDriver;
     
@@ -2399,6 +3556,17 @@ private:
                     if (cmd->find_command_param(c, 'S', &part)) {
                         FpType ratio_rec = FloatMakePosOrPosZero(100.0f / cmd->getPartFpValue(c, part));
                         ratio_rec = FloatMin((FpType)(1.0f/SpeedRatioMin()), FloatMax((FpType)(1.0f/SpeedRatioMax()), ratio_rec));
+                        if (Params::RealtimeSpeedRatio) {
+                            // Apply the new ratio also to moves already buffered.
+                            FpType time_factor = ratio_rec / ob->speed_ratio_rec;
+                            CoalesceFeature::scale_nominal_time(c, time_factor);
+                            BlendFeature::scale_nominal_time(c, time_factor);
+                            // Moves of custom planner clients (e.g. probing) keep the
+                            // speed they were submitted with.
+                            if (ob->planner_state == PLANNER_RUNNING || ob->planner_state == PLANNER_STOPPING || ob->planner_state == PLANNER_WAITING) {
+                                ThePlanner::scaleNominalTime(c, time_factor);
+                            }
+                        }
                         ob->speed_ratio_rec = ratio_rec;
                     } else {
                         cmd->reply_append_pstr(c, AMBRO_PSTR("Speed factor override: "));
@@ -2408,6 +3576,24 @@ private:
                     return cmd->finishCommand(c);
                 } break;
                 
+                case 928:   // feed hold
+                case 929: { // resume after feed hold
+                    if (!Params::FeedHold) {
+                        goto unknown_command;
+                    }
+                    // These act without waiting for the planner, but only once they
+                    // are reached in their stream, so they are fast only when sent
+                    // over a channel which is not busy with moves.
+                    if (ob->planner_state != PLANNER_NONE) {
+                        if (cmd_number == 928) {
+                            ThePlanner::feedHold(c);
+                        } else {
+                            ThePlanner::feedResume(c);
+                        }
+                    }
+                    return cmd->finishCommand(c);
+                } break;
+                
                 case 400: {
                     if (!cmd->tryUnplannedCommand(c)) {
                         return;
@@ -2437,7 +3623,7 @@ private:
                     bool is_rapid_move = (cmd_number == 0);
                     bool is_dwell      = (cmd_number == 4);
                     
-                    if (!cmd->tryPlannedCommand(c)) {
+                    if (!cmd->tryPlannedCommand(c, true)) {
                         return;
                     }
                     
@@ -2513,6 +3699,14 @@ private:
                     return move_end(c, get_locked(c), PrinterMain::normal_move_end_callback, is_rapid_move);
                 } break;
                 
+                case 2:   // clockwise arc
+                case 3: { // counterclockwise arc
+                    if (!Params::ArcParams::Enabled) {
+                        goto unknown_command;
+                    }
+                    return ArcFeature::handle_arc_command(c, cmd, cmd_number == 3);
+                } break;
+                
                 case 28: { // home axes
                     if (!cmd->tryUnplannedCommand(c)) {
                         return;
@@ -2537,6 +3731,15 @@ private:
                     }
                 } break;
                 
+                case 61:   // exact path mode
+                case 64: { // continuous path mode with blending
+                    if (!Params::BlendParams::Enabled) {
+                        goto unknown_command;
+                    }
+                    BlendFeature::set_mode(c, cmd, cmd_number == 64);
+                    return cmd->finishCommand(c);
+                } break;
+                
                 case 90:   // absolute positioning
                 case 91: { // relative positioning
                     bool relative = (cmd_number == 91);
@@ -2684,6 +3887,9 @@ private:
         AMBRO_ASSERT(ob->planner_state == PLANNER_RUNNING)
         AMBRO_ASSERT(ob->m_planning_pull_pending)
         
+        if (flush_held_move(c)) {
+            return;
+        }
         ThePlanner::waitFinished(c);
     }
     
@@ -2698,8 +3904,13 @@ private:
         if (TransformFeature::is_splitting(c)) {
             return TransformFeature::do_split(c);
         }
+        if (BlendFeature::is_blending(c)) {
+            return BlendFeature::do_blend(c);
+        }
         if (ob->planner_state == PLANNER_STOPPING) {
-            ThePlanner::waitFinished(c);
+            if (!flush_held_move(c)) {
+                ThePlanner::waitFinished(c);
+            }
         } else if (ob->planner_state == PLANNER_WAITING) {
             AMBRO_ASSERT(ob->locked)
             ob->planner_state = PLANNER_RUNNING;
@@ -2826,7 +4037,7 @@ public:
         o->move_time_freq_by_max_speed = time_freq_by_max_speed * o->speed_ratio_rec;
     }
     
-    static void move_end (Context c, TheCommand *err_output, MoveEndCallback callback, bool is_rapid_move=true)
+    static void move_end (Context c, TheCommand *err_output, MoveEndCallback callback, bool is_rapid_move=true, bool mergeable=true)
     {
         auto *ob = Object::self(c);
         AMBRO_ASSERT(ob->planner_state == PLANNER_RUNNING || ob->planner_state == PLANNER_CUSTOM)
@@ -2846,6 +4057,19 @@ public:
             return TransformFeature::handle_virt_move(c, ob->move_time_freq_by_max_speed, err_output, callback, is_rapid_move);
         }
         
+        if (ob->planner_state == PLANNER_RUNNING && (CoalesceFeature::hold_move(c, mergeable) || BlendFeature::hold_move(c, is_rapid_move))) {
+            return callback(c, false);
+        }
+        
+        submit_move(c, is_rapid_move);
+        return callback(c, false);
+    }
+    
+private:
+    static void submit_move (Context c, bool is_rapid_move)
+    {
+        auto *ob = Object::self(c);
+        
         PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
         FpType distance_squared = 0.0f;
         ListFor<AxesList>([&] APRINTER_TL(axis, axis::do_move(c, true, &distance_squared, cmd)));
@@ -2860,9 +4084,9 @@ public:
         ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_planner_cmd(c, LaserExtraSrc{c}, cmd)));
         ThePlanner::axesCommandDone(c);
         submitted_planner_command(c);
-        return callback(c, false);
     }
     
+public:
     static void set_position_begin (Context c)
     {
         auto *o = Object::self(c);
@@ -3053,6 +4277,9 @@ private:
                     MakeTypeList<
                         TheSteppers,
                         TransformFeature,
+                        ArcFeature,
+                        CoalesceFeature,
+                        BlendFeature,
                         PlannerUnion
                     >
                 >,
@@ -3073,7 +4300,11 @@ public:
             TheConfigCache,
             TheBlinker,
             TheSteppers,
+            SharedStepTimerFeature,
             TransformFeature,
+            ArcFeature,
+            CoalesceFeature,
+            BlendFeature,
             PlannerUnion,
             TheHookExecutor
         >
@@ -36,6 +36,7 @@ namespace ServiceList {
     struct AfterDefaultHomingHookService {};
     struct AfterBedProbingHookService {};
     struct WebApiHandlerService {};
+    struct PlannerTelemetryService {};
 }
 
 struct DummyServiceUserId {};
@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 
+#include <aprinter/meta/BasicMetaUtils.h>
 #include <aprinter/meta/FixedPoint.h>
 #include <aprinter/meta/WrapFunction.h>
 #include <aprinter/meta/Options.h>
@@ -34,12 +35,16 @@
 #include <aprinter/meta/ListForEach.h>
 #include <aprinter/meta/StructIf.h>
 #include <aprinter/meta/ConstexprMath.h>
+#include <aprinter/meta/ChooseInt.h>
 #include <aprinter/meta/ServiceUtils.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/math/StoredNumber.h>
+#include <aprinter/math/IntDivide.h>
 #include <aprinter/base/DebugObject.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Hints.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/system/InterruptLock.h>
 #include <aprinter/misc/ClockUtils.h>
 #include <aprinter/printer/actuators/AxisDriverConsumer.h>
 
@@ -94,7 +99,7 @@ public:
     using TimeType = typename Clock::TimeType;
     APRINTER_MAKE_INSTANCE(TimerInstance, (Params::TimerService::template InterruptTimer<Context, Object, TimerHandler>))
     using StepFixedType = FixedPoint<step_bits, false, 0>;
-    using DirStepFixedType = FixedPoint<step_bits + 2, false, 0>;
+    using DirStepFixedType = FixedPoint<step_bits + (Params::MicroStepSwitchParams::Enabled ? 3 : 2), false, 0>;
     using DirStepIntType = typename DirStepFixedType::IntType;
     using AccelFixedType = FixedPoint<step_bits, true, 0>;
     using TimeFixedType = FixedPoint<time_bits, false, 0>;
@@ -106,6 +111,10 @@ public:
     using AMulType = decltype(AXIS_STEPPER_AMUL_EXPR_HELPER(AXIS_STEPPER_DUMMY_VARS));
     using ADiscShiftedType = decltype(AccelFixedType().template shiftBits<(-discriminant_prec)>());
     using DelayParams = typename Params::DelayParams;
+    using PrecomputeParams = typename Params::PrecomputeParams;
+    using RecurrenceParams = typename Params::RecurrenceParams;
+    using MultiStepParams = typename Params::MultiStepParams;
+    using MicroStepSwitchParams = typename Params::MicroStepSwitchParams;
     using StepContext = typename TimerInstance::HandlerContext;
     
 private:
@@ -169,9 +178,16 @@ private:
     
 public:
     static constexpr double AsyncMinStepTime() { return DelayFeature::AsyncMinStepTime(); }
-    static constexpr double SyncMinStepTime() { return DelayFeature::SyncMinStepTime(); }
+    static constexpr double SyncMinStepTime() { return DelayFeature::SyncMinStepTime() + MultiStepFeature::SyncMinStepTime(); }
+    static constexpr int MaxStepsPerInterrupt() { return MultiStepFeature::MaxStepsPerInterrupt * MicroStepSwitchFeature::MaxStepsPerInterrupt; }
+    static constexpr double SharedInterruptRate() { return MultiStepFeature::SharedInterruptRate() + MicroStepSwitchFeature::SharedInterruptRate(); }
     
-    struct Command {
+    struct RecurrenceCommandMembers {
+        int32_t standstill_steps;
+    };
+    struct NoCommandMembers {};
+    
+    struct Command : public If<RecurrenceParams::Enabled, RecurrenceCommandMembers, NoCommandMembers> {
         DirStepFixedType dir_x;
         typename AccelShiftMode::CommandAccelType accel;
         TMulStored t_mul_stored;
@@ -187,9 +203,11 @@ public:
         cmd->dir_x = DirStepFixedType::importBits(
             x.bitsValue() |
             ((DirStepIntType)dir << step_bits) |
-            ((DirStepIntType)(a.bitsValue() >= 0) << (step_bits + 1))
+            ((DirStepIntType)(a.bitsValue() >= 0) << (step_bits + 1)) |
+            MicroStepSwitchFeature::make_coarse_bit(x, t, a)
         );
         cmd->accel = AccelShiftMode::make_command_accel(a);
+        RecurrenceFeature::generate_command(x, t, a, cmd);
     }
     
     static void init (Context c)
@@ -197,6 +215,8 @@ public:
         auto *o = Object::self(c);
         
         TimerInstance::init(c);
+        PrecomputeFeature::init(c);
+        MicroStepSwitchFeature::init(c);
 #ifdef AMBROLIB_ASSERTIONS
         o->m_running = false;
 #endif
@@ -213,6 +233,7 @@ public:
         TheDebugObject::deinit(c);
         AMBRO_ASSERT(!o->m_running)
         
+        PrecomputeFeature::deinit(c);
         TimerInstance::deinit(c);
     }
     
@@ -241,6 +262,8 @@ public:
 #endif
         o->m_consumer_id = TypeListIndex<typename ConsumersList::List, TheConsumer>::Value;
         o->m_time = start_time;
+        PrecomputeFeature::start(c);
+        MultiStepFeature::start(c);
         
         bool command_completed = load_command(c, first_command);
         TimeType timer_t = (!PreloadCommands && command_completed) ? o->m_time : start_time;
@@ -255,6 +278,7 @@ public:
         TheDebugObject::access(c);
         
         TimerInstance::unset(c);
+        PrecomputeFeature::stop(c);
 #ifdef AMBROLIB_ASSERTIONS
         o->m_running = false;
 #endif
@@ -267,15 +291,15 @@ public:
         AMBRO_ASSERT(!o->m_running)
         
         *dir = (o->m_current_command->dir_x.bitsValue() & ((DirStepIntType)1 << step_bits));
-        if (!o->m_notend) {
-            return StepFixedType::importBits(0);
-        } else {
+        typename StepFixedType::IntType steps = PrecomputeFeature::buffered_steps(c);
+        if (o->m_notend) {
             if (o->m_notdecel) {
-                return StepFixedType::importBits(o->m_pos.bitsValue() + 1);
+                steps += o->m_pos.bitsValue() + 1;
             } else {
-                return StepFixedType::importBits((o->m_x.bitsValue() - o->m_pos.bitsValue()) + 1);
+                steps += (o->m_x.bitsValue() - o->m_pos.bitsValue()) + 1;
             }
         }
+        return StepFixedType::importBits(steps);
     }
     
     static StepFixedType getPendingCmdSteps (Context c, Command const *cmd, bool *dir)
@@ -339,6 +363,7 @@ private:
         auto *o = Object::self(c);
         
         Stepper::setDir(c, command->dir_x.bitsValue()  & ((DirStepIntType)1 << step_bits));
+        MicroStepSwitchFeature::command_loaded(c, command->dir_x.bitsValue());
         DelayFeature::set_dir_timer_for_step(c);
         
         // Below we do some volatile memory accesses, to guarantee that at least some
@@ -348,9 +373,11 @@ private:
         DirStepFixedType dir_x = DirStepFixedType::importBits(volatile_read(command->dir_x.m_bits.m_int));
         
         o->m_current_command = command;
+        PrecomputeFeature::command_loaded(c);
         o->m_notdecel = (dir_x.bitsValue() & ((DirStepIntType)1 << (step_bits + 1)));
         StepFixedType x = StepFixedType::importBits(dir_x.bitsValue() & (((DirStepIntType)1 << step_bits) - 1));
         o->m_notend = (x.bitsValue() != 0);
+        RecurrenceFeature::command_loaded(c, command, x);
         
         if (AMBRO_UNLIKELY(!o->m_notend)) {
             o->m_time += TimeMulFixedType::importBits(TMulStored::retrieve(command->t_mul_stored)).template bitsTo<time_bits>().bitsValue();
@@ -381,6 +408,7 @@ private:
         
         bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_command_callback(c, command)));
         if (AMBRO_UNLIKELY(!res)) {
+            PrecomputeFeature::stop(c);
 #ifdef AMBROLIB_ASSERTIONS
             o->m_running = false;
 #endif
@@ -390,6 +418,60 @@ private:
         return true;
     }
     
+    // Whether the current command has steps left, including any whose
+    // times are already in the precompute ring.
+    template <typename ThisContext>
+    AMBRO_ALWAYS_INLINE
+    static bool steps_pending (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        
+        return o->m_notend || PrecomputeFeature::has_times(c);
+    }
+    
+    // Computes the time of the event following the step at s->m_pos and advances
+    // the step state. This is used on the AxisDriver object itself from the timer
+    // handler, and on a copy of its state by PrecomputeFeature. The after_calc
+    // function is called after the expensive calculations.
+    template <typename ThisContext, typename State, typename AfterCalc>
+    AMBRO_ALWAYS_INLINE
+    static TimeType compute_next_time (ThisContext c, State *s, AMulType a_mul, TimeMulFixedType t_mul, AfterCalc after_calc)
+    {
+        // Prevent the compiler from moving any significant part of the calculation
+        // above the point of the call, by a volatile read of the discriminant.
+        
+        auto discriminant_bits = volatile_read(s->m_discriminant.m_bits.m_int);
+        s->m_discriminant.m_bits.m_int = discriminant_bits + a_mul.m_bits.m_int;
+        AMBRO_ASSERT(s->m_discriminant.bitsValue() >= 0)
+        
+        auto q = (s->m_v0 + FixedSquareRoot<true>(s->m_discriminant, OptionForceInline())).template shift<-1>();
+        
+        auto t_frac = FixedFracDivide<rel_t_extra_prec>(s->m_pos, q, OptionForceInline());
+        
+        TimeFixedType t = FixedResMultiply(t_mul, t_frac);
+        
+        after_calc(t);
+        
+        TimeType next_time;
+        if (AMBRO_LIKELY(!s->m_notdecel)) {
+            if (AMBRO_LIKELY(s->m_pos == s->m_x)) {
+                s->m_time += t_mul.template bitsTo<time_bits>().bitsValue();
+                s->m_notend = false;
+                next_time = s->m_time;
+            } else {
+                s->m_pos.m_bits.m_int++;
+                next_time = (s->m_time + t.bitsValue());
+            }
+        } else {
+            if (s->m_pos.bitsValue() == 0) {
+                s->m_notend = false;
+            }
+            s->m_pos.m_bits.m_int--;
+            next_time = (s->m_time - t.bitsValue());
+        }
+        return next_time;
+    }
+    
     static bool timer_handler (StepContext c)
     {
         auto *o = Object::self(c);
@@ -403,7 +485,7 @@ private:
         
         Command *current_command = o->m_current_command;
         
-        if (!PreloadCommands && AMBRO_LIKELY(!o->m_notend)) {
+        if (!PreloadCommands && AMBRO_LIKELY(!steps_pending(c))) {
             if (!try_pull_command(c, &current_command)) {
                 return false;
             }
@@ -426,7 +508,7 @@ private:
         
         TimeType next_time;
         
-        if (!PreloadCommands || AMBRO_LIKELY(o->m_notend)) {
+        if (!PreloadCommands || AMBRO_LIKELY(steps_pending(c))) {
             if (AMBRO_UNLIKELY(o->m_prestep_callback_enabled)) {
                 bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_prestep_callback(c)));
                 if (AMBRO_UNLIKELY(res)) {
@@ -440,53 +522,48 @@ private:
             DelayFeature::wait_for_dir(c);
             
             DelayFeature::wait_for_step_low(c);
-            Stepper::stepOn(c);
+            if (MicroStepSwitchFeature::begin_step(c)) {
+                Stepper::stepOn(c);
+            }
             DelayFeature::set_step_timer_for_high(c);
             
-            // We need to ensure that the step signal is sufficiently long for the stepper driver
-            // to register. To this end, we do the timely calculations in between stepOn and stepOff().
-            // But to prevent the compiler from moving upwards any significant part of the calculation,
-            // we do a volatile read of the discriminant (an input to the calculation).
-            
-            auto discriminant_bits = volatile_read(o->m_discriminant.m_bits.m_int);
-            o->m_discriminant.m_bits.m_int = discriminant_bits + AccelShiftMode::get_a_mul_for_step(c, current_command).m_bits.m_int;
-            AMBRO_ASSERT(o->m_discriminant.bitsValue() >= 0)
-            
-            auto q = (o->m_v0 + FixedSquareRoot<true>(o->m_discriminant, OptionForceInline())).template shift<-1>();
-            
-            auto t_frac = FixedFracDivide<rel_t_extra_prec>(o->m_pos, q, OptionForceInline());
-            
-            auto t_mul = TimeMulFixedType::importBits(TMulStored::retrieve(current_command->t_mul_stored));
-            TimeFixedType t = FixedResMultiply(t_mul, t_frac);
-            
-            // Now make sure the calculations above happen before stepOff().
-            volatile_write(o->m_dummy, (uint8_t)t.bitsValue());
-            
-            DelayFeature::wait_for_step_high(c);
-            Stepper::stepOff(c);
-            DelayFeature::set_step_timer_for_low(c);
-            
-            if (AMBRO_LIKELY(!o->m_notdecel)) {
-                if (AMBRO_LIKELY(o->m_pos == o->m_x)) {
-                    o->m_time += t_mul.template bitsTo<time_bits>().bitsValue();
-                    o->m_notend = false;
-                    next_time = o->m_time;
-                } else {
-                    o->m_pos.m_bits.m_int++;
-                    next_time = (o->m_time + t.bitsValue());
-                }
+            if (PrecomputeFeature::pop_time(c, &next_time) || RecurrenceFeature::next_time(c, current_command, &next_time)) {
+                // Without the calculations, the step signal is kept high only by the delays,
+                // which these features therefore require.
+                DelayFeature::wait_for_step_high(c);
+                Stepper::stepOff(c);
+                DelayFeature::set_step_timer_for_low(c);
             } else {
-                if (o->m_pos.bitsValue() == 0) {
-                    o->m_notend = false;
-                }
-                o->m_pos.m_bits.m_int--;
-                next_time = (o->m_time - t.bitsValue());
+                // We need to ensure that the step signal is sufficiently long for the stepper driver
+                // to register. To this end, we do the timely calculations in between stepOn and stepOff().
+                
+                auto a_mul = AccelShiftMode::get_a_mul_for_step(c, current_command);
+                auto t_mul = TimeMulFixedType::importBits(TMulStored::retrieve(current_command->t_mul_stored));
+                
+                MultiStepFeature::skip_steps(c, a_mul);
+                MicroStepSwitchFeature::skip_steps(c, a_mul);
+                
+                next_time = compute_next_time(c, o, a_mul, t_mul, [&](TimeFixedType t) {
+                    // Now make sure the calculations above happen before stepOff().
+                    volatile_write(o->m_dummy, (uint8_t)t.bitsValue());
+                    
+                    DelayFeature::wait_for_step_high(c);
+                    Stepper::stepOff(c);
+                    DelayFeature::set_step_timer_for_low(c);
+                    
+                    MultiStepFeature::extra_steps(c);
+                });
+                
+                MultiStepFeature::update(c, next_time);
+                MicroStepSwitchFeature::update(c);
+                RecurrenceFeature::exact_time(c, a_mul, t_mul, next_time);
+                PrecomputeFeature::state_changed(c);
             }
         } else {
             DelayFeature::wait_for_step_low(c);
         }
         
-        if (PreloadCommands && AMBRO_LIKELY(!o->m_notend)) {
+        if (PreloadCommands && AMBRO_LIKELY(!steps_pending(c))) {
             if (!try_pull_command(c, &current_command)) {
                 return false;
             }
@@ -534,6 +611,11 @@ private:
             );
         }
         
+        static constexpr double StepLowMinStepTime ()
+        {
+            return MinStepTimeFactor * 1e-6 * DelayParams::StepLowTime::value();
+        }
+        
         template <typename ThisContext>
         static void wait_for_dir (ThisContext c)
         {
@@ -591,6 +673,7 @@ private:
     AMBRO_STRUCT_ELSE(DelayFeature) {
         static constexpr double AsyncMinStepTime () { return 0.0; }
         static constexpr double SyncMinStepTime () { return 0.0; }
+        static constexpr double StepLowMinStepTime () { return 0.0; }
         template <typename ThisContext> static void wait_for_dir (ThisContext c) {}
         template <typename ThisContext> static void wait_for_step_high (ThisContext c) {}
         template <typename ThisContext> static void wait_for_step_low (ThisContext c) {}
@@ -601,11 +684,705 @@ private:
         struct Object {};
     };
     
+    // Computes step times of the current command ahead, from a fast event in the
+    // main loop, into a ring buffer which the timer handler consumes. The step state
+    // (m_pos, m_discriminant, m_time, m_notend) is advanced by whoever computes the
+    // next step time: normally the fast event, working on a copy of the state, but
+    // the timer handler itself when the ring is empty, for example at the first step
+    // of a command. The fast event only stores its result if the timer handler has
+    // not changed the state in the mean time, which is tracked with m_state_gen.
+    AMBRO_STRUCT_IF(PrecomputeFeature, PrecomputeParams::Enabled) {
+        struct Object;
+        using FastEvent = typename Context::EventLoop::template FastEventSpec<PrecomputeFeature>;
+        static int const RingSize = PrecomputeParams::RingSize;
+        static_assert(RingSize >= 2 && RingSize <= 128 && (RingSize & (RingSize - 1)) == 0, "RingSize must be a power of two between 2 and 128");
+        static_assert(DelayParams::Enabled, "Precomputed step times need step signal delays for the step pulse width");
+        
+        struct FillState {
+            bool m_notend;
+            bool m_notdecel;
+            StepFixedType m_x;
+            StepFixedType m_pos;
+            V0Type m_v0;
+            DiscriminantType m_discriminant;
+            TimeType m_time;
+        };
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_active = false;
+            o->m_start = 0;
+            o->m_end = 0;
+            o->m_state_gen = 0;
+            Context::EventLoop::template initFastEvent<FastEvent>(c, PrecomputeFeature::event_handler);
+        }
+        
+        static void deinit (Context c)
+        {
+            Context::EventLoop::template resetFastEvent<FastEvent>(c);
+        }
+        
+        static void start (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_active = true;
+            o->m_start = o->m_end;
+        }
+        
+        template <typename ThisContext>
+        static void stop (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_active = false;
+        }
+        
+        template <typename ThisContext>
+        static void command_loaded (ThisContext c)
+        {
+            state_changed(c);
+            Context::EventLoop::template triggerFastEvent<FastEvent>(c);
+        }
+        
+        template <typename ThisContext>
+        static void state_changed (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_state_gen++;
+        }
+        
+        template <typename ThisContext>
+        static bool has_times (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            
+            return o->m_start != o->m_end;
+        }
+        
+        static uint8_t buffered_steps (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            return (uint8_t)(o->m_end - o->m_start);
+        }
+        
+        static bool pop_time (StepContext c, TimeType *time)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->m_start == o->m_end) {
+                return false;
+            }
+            *time = o->m_times[o->m_start % RingSize];
+            o->m_start++;
+            if ((uint8_t)(o->m_end - o->m_start) == RingSize / 2) {
+                Context::EventLoop::template triggerFastEvent<FastEvent>(c);
+            }
+            return true;
+        }
+        
+        static void event_handler (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            while (true) {
+                FillState s;
+                AMulType a_mul;
+                TimeMulFixedType t_mul;
+                uint8_t state_gen;
+                bool fill;
+                
+                AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+                    fill = o->m_active && ao->m_notend && (uint8_t)(o->m_end - o->m_start) < RingSize;
+                    if (fill) {
+                        s.m_notend = ao->m_notend;
+                        s.m_notdecel = ao->m_notdecel;
+                        s.m_x = ao->m_x;
+                        s.m_pos = ao->m_pos;
+                        s.m_v0 = ao->m_v0;
+                        s.m_discriminant = ao->m_discriminant;
+                        s.m_time = ao->m_time;
+                        a_mul = AccelShiftMode::get_a_mul_for_step(c, ao->m_current_command);
+                        t_mul = TimeMulFixedType::importBits(TMulStored::retrieve(ao->m_current_command->t_mul_stored));
+                        state_gen = o->m_state_gen;
+                    }
+                }
+                
+                if (!fill) {
+                    break;
+                }
+                
+                TimeType next_time = compute_next_time(c, &s, a_mul, t_mul, [](TimeFixedType t) {});
+                
+                AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+                    if (o->m_state_gen == state_gen) {
+                        o->m_times[o->m_end % RingSize] = next_time;
+                        o->m_end++;
+                        ao->m_notend = s.m_notend;
+                        ao->m_pos = s.m_pos;
+                        ao->m_discriminant = s.m_discriminant;
+                        ao->m_time = s.m_time;
+                    }
+                }
+            }
+        }
+        
+        using EventLoopFastEvents = MakeTypeList<FastEvent>;
+        
+        struct Object : public ObjBase<PrecomputeFeature, typename AxisDriver::Object, EmptyTypeList> {
+            bool m_active;
+            uint8_t m_start;
+            uint8_t m_end;
+            uint8_t m_state_gen;
+            TimeType m_times[RingSize];
+        };
+    }
+    AMBRO_STRUCT_ELSE(PrecomputeFeature) {
+        static void init (Context c) {}
+        static void deinit (Context c) {}
+        static void start (Context c) {}
+        template <typename ThisContext> static void stop (ThisContext c) {}
+        template <typename ThisContext> static void command_loaded (ThisContext c) {}
+        template <typename ThisContext> static void state_changed (ThisContext c) {}
+        template <typename ThisContext> static bool has_times (ThisContext c) { return false; }
+        static uint8_t buffered_steps (Context c) { return 0; }
+        static bool pop_time (StepContext c, TimeType *time) { return false; }
+        struct Object {};
+    };
+    
+    // Computes step times with an AVR446 style recurrence for the step interval, instead
+    // of the square root and division, except at every ResyncInterval-th position, where
+    // the exact time is computed and the interval is corrected by the accumulated error.
+    // Between the exact steps, the interval changes by a constant difference, computed at
+    // the exact step from the ratio of consecutive intervals, 1 - 2/(4n + 1), where
+    // n = D/A is the distance from standstill in steps (D is the discriminant and A its
+    // change per step), taken half way to the next exact step. To keep divisions by
+    // variables out of the interrupt, D/A at the start of each command is computed when
+    // the command is generated, and n follows from it and the position; the interval
+    // change itself is computed with the 11-by-16-bit division of the step times (which
+    // is in assembly on AVR), on operands normalized to those sizes. The recurrence is only
+    // used when n is at least MinStandstillSteps, where the ratio changes little between
+    // exact steps; closer to standstill, for slow steps, and for the first steps and
+    // the last step of each command, the exact times are used.
+    // The exact times themselves are off by up to a few percent of the interval (due to
+    // the precision of q and t_frac), so the recurrence is started from the average
+    // interval since an exact step AnchorSteps steps before, and is only used while the
+    // interval is at least MinIntervalQuanta times the precision of t_frac relative to
+    // the command duration.
+    // The interval is kept in ticks with FracBits fraction bits.
+    AMBRO_STRUCT_IF(RecurrenceFeature, RecurrenceParams::Enabled) {
+        struct Object;
+        static int const ResyncInterval = RecurrenceParams::ResyncInterval;
+        static_assert(ResyncInterval >= 2 && ResyncInterval <= 128 && (ResyncInterval & (ResyncInterval - 1)) == 0, "ResyncInterval must be a power of two between 2 and 128");
+        static_assert(!PrecomputeParams::Enabled, "Precomputed step times cannot be combined with the recurrence");
+        static_assert(DelayParams::Enabled, "The step time recurrence needs step signal delays for the step pulse width");
+        static_assert(sizeof(TimeType) == 4, "");
+        
+        using QType = decltype((V0Type() + FixedSquareRoot<true>(DiscriminantType())).template shift<-1>());
+        using TFracType = decltype(FixedFracDivide<rel_t_extra_prec>(StepFixedType(), QType()));
+        static_assert(TFracType::exp < 0, "");
+        
+        static int const FracBits = 16;
+        static int32_t const MaxInterval = (int32_t)1 << (13 + FracBits);
+        static int32_t const MaxError = (int32_t)1 << 12;
+        static TimeType const MinIntervalQuanta = 8;
+        static uint8_t const AnchorSteps = ResyncInterval < 16 ? 8 : ResyncInterval / 2;
+        static int32_t const MinStandstillSteps = ResyncInterval < 16 ? 256 : (int32_t)ResyncInterval * ResyncInterval;
+        static int32_t const MaxStandstillSteps = (int32_t)1 << 20;
+        
+        static_assert((AnchorSteps & (AnchorSteps - 1)) == 0, "");
+        
+        using ChangeDivide = IntDivide<11, false, 16, false, 15, 13, false>;
+        
+        enum : uint8_t {STATE_NONE, STATE_ANCHORED, STATE_RUNNING};
+        
+        AMBRO_ALWAYS_INLINE
+        static void generate_command (StepFixedType x, TimeFixedType t, AccelFixedType a, Command *cmd)
+        {
+            int32_t a_mul = AXIS_STEPPER_AMUL_EXPR(x, t, a).bitsValue();
+            cmd->standstill_steps = (a_mul == 0) ? 0 : (int32_t)AXIS_STEPPER_DISCRIMINANT_EXPR(x, t, a).bitsValue() / a_mul;
+        }
+        
+        // The discriminant changes by A with each step, which moves the position
+        // up from 1 or down from x-1, so n is m_n_base plus or minus the position.
+        template <typename ThisContext>
+        static void command_loaded (ThisContext c, Command *command, StepFixedType x)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            o->m_state = STATE_NONE;
+            o->m_n_base = command->standstill_steps + (AMBRO_LIKELY(!ao->m_notdecel) ? -1 : ((int32_t)x.bitsValue() - 1));
+        }
+        
+        // Returns 2 * interval / d, to within about 0.1%.
+        static int32_t interval_change_magnitude (int32_t interval, uint32_t d)
+        {
+            uint32_t i = interval;
+            int8_t exp = 1 - 15;
+            while (i >= ((uint32_t)1 << 11)) {
+                i >>= 1;
+                exp++;
+            }
+            while (i < ((uint32_t)1 << 10)) {
+                i <<= 1;
+                exp--;
+            }
+            while (d >= ((uint32_t)1 << 16)) {
+                d >>= 1;
+                exp--;
+            }
+            while (d < ((uint32_t)1 << 15)) {
+                d <<= 1;
+                exp++;
+            }
+            uint32_t res = ChangeDivide::call(i, d);
+            return (exp >= 0) ? (int32_t)(res << exp) : (int32_t)(res >> -exp);
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static bool next_time (StepContext c, Command *current_command, TimeType *time)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            if (AMBRO_UNLIKELY(o->m_state != STATE_RUNNING) || (ao->m_pos.bitsValue() & (ResyncInterval - 1)) == 0) {
+                return false;
+            }
+            if (AMBRO_LIKELY(!ao->m_notdecel)) {
+                if (AMBRO_UNLIKELY(ao->m_pos == ao->m_x)) {
+                    return false;
+                }
+                ao->m_pos.m_bits.m_int++;
+            } else {
+                if (AMBRO_UNLIKELY(ao->m_pos.bitsValue() == 0)) {
+                    return false;
+                }
+                ao->m_pos.m_bits.m_int--;
+            }
+            ao->m_discriminant.m_bits.m_int += AccelShiftMode::get_a_mul_for_step(c, current_command).m_bits.m_int;
+            
+            uint32_t sum = (uint32_t)o->m_frac + (uint32_t)o->m_interval;
+            o->m_last_time += (TimeType)(sum >> FracBits);
+            o->m_frac = (uint16_t)sum;
+            o->m_interval += o->m_interval_change;
+            
+            *time = o->m_last_time;
+            return true;
+        }
+        
+        static void exact_time (StepContext c, AMulType a_mul, TimeMulFixedType t_mul, TimeType time)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            if (AMBRO_UNLIKELY(!ao->m_notend)) {
+                return;
+            }
+            
+            TimeType quantum = t_mul.template bitsTo<time_bits>().bitsValue() >> (-TFracType::exp);
+            
+            int32_t interval;
+            uint8_t anchor_steps = 0;
+            if (o->m_state == STATE_RUNNING) {
+                uint32_t sum = (uint32_t)o->m_frac + (uint32_t)o->m_interval;
+                int32_t error = (int32_t)(time - (o->m_last_time + (TimeType)(sum >> FracBits)));
+                if (error >= MaxError || error <= -MaxError) {
+                    goto anchor;
+                }
+                interval = o->m_interval - o->m_interval_change + (error * ((int32_t)1 << FracBits) - (int32_t)(uint16_t)sum) / ResyncInterval;
+            } else {
+                if (o->m_state == STATE_NONE) {
+                    goto anchor;
+                }
+                anchor_steps = o->m_anchor_steps + 1;
+                if (anchor_steps < AnchorSteps) {
+                    o->m_anchor_steps = anchor_steps;
+                    return;
+                }
+                TimeType span = time - o->m_anchor_time;
+                TimeType ticks = span / AnchorSteps;
+                if (ticks >= ((TimeType)MaxInterval >> FracBits)) {
+                    goto anchor;
+                }
+                interval = ((int32_t)ticks << FracBits) + (int32_t)((span % AnchorSteps) << FracBits) / AnchorSteps;
+            }
+            if (interval <= 0 || interval >= MaxInterval || (TimeType)(interval >> FracBits) < MinIntervalQuanta * quantum) {
+                goto anchor;
+            }
+            
+            {
+                int32_t interval_change = 0;
+                if (a_mul.bitsValue() != 0) {
+                    int32_t n = AMBRO_LIKELY(!ao->m_notdecel) ? (o->m_n_base + (int32_t)ao->m_pos.bitsValue()) : (o->m_n_base - (int32_t)ao->m_pos.bitsValue());
+                    if (n > -MinStandstillSteps && n < MinStandstillSteps) {
+                        goto anchor;
+                    }
+                    if (n > 0 && n < MaxStandstillSteps) {
+                        interval_change = -interval_change_magnitude(interval, 4 * n + 2 * ResyncInterval + 1);
+                    } else if (n < 0 && n > -MaxStandstillSteps) {
+                        interval_change = interval_change_magnitude(interval, -4 * n - 2 * ResyncInterval - 1);
+                    }
+                }
+                
+                // An average over the anchor steps is the interval half way through them.
+                if (anchor_steps > 1) {
+                    interval += interval_change * (AnchorSteps - 1) / 2;
+                }
+                
+                o->m_state = STATE_RUNNING;
+                o->m_frac = 0;
+                o->m_last_time = time;
+                o->m_interval = interval + interval_change;
+                o->m_interval_change = interval_change;
+                return;
+            }
+            
+        anchor:
+            o->m_state = STATE_ANCHORED;
+            o->m_anchor_steps = 0;
+            o->m_anchor_time = time;
+        }
+        
+        struct Object : public ObjBase<RecurrenceFeature, typename AxisDriver::Object, EmptyTypeList> {
+            uint8_t m_state;
+            uint8_t m_anchor_steps;
+            uint16_t m_frac;
+            int32_t m_n_base;
+            TimeType m_anchor_time;
+            TimeType m_last_time;
+            int32_t m_interval;
+            int32_t m_interval_change;
+        };
+    }
+    AMBRO_STRUCT_ELSE(RecurrenceFeature) {
+        static void generate_command (StepFixedType x, TimeFixedType t, AccelFixedType a, Command *cmd) {}
+        template <typename ThisContext> static void command_loaded (ThisContext c, Command *command, StepFixedType x) {}
+        static bool next_time (StepContext c, Command *current_command, TimeType *time) { return false; }
+        static void exact_time (StepContext c, AMulType a_mul, TimeMulFixedType t_mul, TimeType time) {}
+        struct Object {};
+    };
+    
+    // Emits up to four steps per interrupt when the steps are too fast for one
+    // interrupt each. After each exactly computed step, the step interval is compared
+    // to the configured rates, and for the next interrupt the position is advanced by
+    // the additional steps before the time calculation, and the additional steps are
+    // emitted right after the first one. The steps of one interrupt are thus bunched
+    // together, which is the cost of this. Not used while the prestep callback is
+    // enabled, so that it is still checked before every step.
+    AMBRO_STRUCT_IF(MultiStepFeature, MultiStepParams::Enabled) {
+        struct Object;
+        static_assert(!PrecomputeParams::Enabled && !RecurrenceParams::Enabled, "Multiple steps per interrupt need exact step times computed in the interrupt");
+        static_assert(DelayParams::Enabled, "Multiple steps per interrupt need step signal delays for the step pulse width and low time");
+        static_assert(MultiStepParams::DoubleStepRate::value() > 0.0, "DoubleStepRate must be positive");
+        static_assert(MultiStepParams::QuadStepRate::value() >= MultiStepParams::DoubleStepRate::value(), "QuadStepRate must not be below DoubleStepRate");
+        
+        static int const MaxStepsPerInterrupt = 4;
+        static TimeType const DoubleStepTicks = Clock::time_freq / MultiStepParams::DoubleStepRate::value();
+        static TimeType const QuadStepTicks = Clock::time_freq / MultiStepParams::QuadStepRate::value();
+        
+        // Additional steps in an interrupt also wait for the step low time.
+        static constexpr double SyncMinStepTime () { return DelayFeature::StepLowMinStepTime(); }
+        
+        // Below DoubleStepRate each step has its own interrupt, and below QuadStepRate
+        // every two steps, so there are at most this many interrupts per second plus
+        // the step rate divided by MaxStepsPerInterrupt.
+        static constexpr double SharedInterruptRate () { return ConstexprFmax(0.75 * MultiStepParams::DoubleStepRate::value(), 0.25 * MultiStepParams::QuadStepRate::value()); }
+        
+        template <typename ThisContext>
+        static void start (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_shift = 0;
+            o->m_extra = 0;
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static void skip_steps (StepContext c, AMulType a_mul)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            uint8_t extra = ((uint8_t)1 << o->m_shift) - 1;
+            if (AMBRO_LIKELY(extra == 0)) {
+                o->m_extra = 0;
+                return;
+            }
+            
+            auto remaining = AMBRO_LIKELY(!ao->m_notdecel) ? (ao->m_x.bitsValue() - ao->m_pos.bitsValue()) : ao->m_pos.bitsValue();
+            if (remaining < extra) {
+                extra = remaining;
+            }
+            o->m_extra = extra;
+            
+            if (AMBRO_LIKELY(!ao->m_notdecel)) {
+                ao->m_pos.m_bits.m_int += extra;
+            } else {
+                ao->m_pos.m_bits.m_int -= extra;
+            }
+            ao->m_discriminant.m_bits.m_int += extra * a_mul.m_bits.m_int;
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static void extra_steps (StepContext c)
+        {
+            auto *o = Object::self(c);
+            
+            for (uint8_t i = 0; i < o->m_extra; i++) {
+                DelayFeature::wait_for_step_low(c);
+                Stepper::stepOn(c);
+                DelayFeature::set_step_timer_for_high(c);
+                DelayFeature::wait_for_step_high(c);
+                Stepper::stepOff(c);
+                DelayFeature::set_step_timer_for_low(c);
+            }
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static void update (StepContext c, TimeType next_time)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            // Keep the current setting if fewer steps were emitted at the end of a command.
+            if (AMBRO_UNLIKELY(o->m_extra != ((uint8_t)1 << o->m_shift) - 1)) {
+                return;
+            }
+            
+            TimeType step_ticks = (TimeType)(next_time - TimerInstance::getLastSetTime(c)) >> o->m_shift;
+            if (AMBRO_UNLIKELY(ao->m_prestep_callback_enabled) || step_ticks >= DoubleStepTicks) {
+                o->m_shift = 0;
+            } else if (step_ticks >= QuadStepTicks) {
+                o->m_shift = 1;
+            } else {
+                o->m_shift = 2;
+            }
+        }
+        
+        struct Object : public ObjBase<MultiStepFeature, typename AxisDriver::Object, EmptyTypeList> {
+            uint8_t m_shift;
+            uint8_t m_extra;
+        };
+    }
+    AMBRO_STRUCT_ELSE(MultiStepFeature) {
+        static int const MaxStepsPerInterrupt = 1;
+        static constexpr double SyncMinStepTime () { return 0.0; }
+        static constexpr double SharedInterruptRate () { return 0.0; }
+        template <typename ThisContext> static void start (ThisContext c) {}
+        static void skip_steps (StepContext c, AMulType a_mul) {}
+        static void extra_steps (StepContext c) {}
+        static void update (StepContext c, TimeType next_time) {}
+        struct Object {};
+    };
+    
+    // Switches the stepper drivers to Factor times fewer microsteps for commands
+    // whose peak step rate is above SwitchRate, which is decided when the planner
+    // generates the command and stored in it. The commands remain in the configured
+    // microsteps; while the drivers are switched, each step moves the motor by Factor
+    // microsteps, and the microsteps in between are skipped in the time calculation,
+    // like the additional steps of MultiStepFeature.
+    // The motor may then be up to Factor-1 microsteps ahead of the commanded position
+    // in the direction of motion (m_lead), which the following microsteps catch up
+    // with, or which a step in the opposite direction turns around. To not lose any
+    // position, the drivers are switched to coarse microsteps only at a multiple of
+    // Factor microsteps from the position at init (m_phase), and back only when the
+    // motor is at the commanded position. The pins are set after a step or together
+    // with the direction, so they have at least the direction setup time before the
+    // next step. This assumes that the drivers start at init at a full step. Not
+    // used while the prestep callback is enabled, so that it is checked for every
+    // microstep.
+    AMBRO_STRUCT_IF(MicroStepSwitchFeature, MicroStepSwitchParams::Enabled) {
+        struct Object;
+        static int const Factor = MicroStepSwitchParams::Factor;
+        static_assert(Factor >= 2 && Factor <= 16 && (Factor & (Factor - 1)) == 0, "Factor must be a power of two between 2 and 16");
+        static_assert(!PrecomputeParams::Enabled && !RecurrenceParams::Enabled && !MultiStepParams::Enabled, "Microstep switching needs exact step times computed in the interrupt, one step per interrupt");
+        static_assert(MicroStepSwitchParams::SwitchRate::value() > 0.0, "SwitchRate must be positive");
+        
+        static int const MaxStepsPerInterrupt = Factor;
+        static TimeType const SwitchTicks = Clock::time_freq / MicroStepSwitchParams::SwitchRate::value();
+        
+        // Commands with step rates up to SwitchRate have an interrupt for each
+        // microstep, so there are at most this many interrupts per second plus the
+        // step rate divided by Factor. The fewer than Factor microsteps of a faster
+        // command before the drivers are switched at a full step add a bounded number
+        // of interrupts, not a rate.
+        static constexpr double SharedInterruptRate () { return MicroStepSwitchParams::SwitchRate::value() * (Factor - 1) / Factor; }
+        static_assert(SwitchTicks > 0, "SwitchRate is too high");
+        using RateProductType = ChooseIntForMax<((uintmax_t)2 << step_bits) * SwitchTicks, false>;
+        
+        template <int DriverIndex>
+        struct Driver {
+            struct Object;
+            using TheSpec = TypeListGet<typename MicroStepSwitchParams::MicroStepDriversList, DriverIndex>;
+            APRINTER_MAKE_INSTANCE(TheMicroStep, (TheSpec::MicroStepService::template MicroStep<Context, Object>))
+            static_assert(TheSpec::MicroSteps % Factor == 0, "MicroSteps must be a multiple of Factor");
+            
+            static void init (Context c)
+            {
+                TheMicroStep::init(c, TheSpec::MicroSteps);
+            }
+            
+            template <typename ThisContext>
+            static void set_coarse (ThisContext c, bool coarse)
+            {
+                TheMicroStep::set_microsteps(c, coarse ? TheSpec::MicroSteps / Factor : TheSpec::MicroSteps);
+            }
+            
+            struct Object : public ObjBase<Driver, typename MicroStepSwitchFeature::Object, MakeTypeList<
+                TheMicroStep
+            >> {};
+        };
+        using DriversList = IndexElemList<typename MicroStepSwitchParams::MicroStepDriversList, Driver>;
+        
+        AMBRO_ALWAYS_INLINE
+        static DirStepIntType make_coarse_bit (StepFixedType x, TimeFixedType t, AccelFixedType a)
+        {
+            // The speed changes linearly through the command, so it peaks at (x + |a|) / t.
+            RateProductType peak_steps = x.bitsValue() + (a.bitsValue() >= 0 ? a.bitsValue() : -a.bitsValue());
+            bool coarse = peak_steps * SwitchTicks > t.bitsValue();
+            return (DirStepIntType)coarse << (step_bits + 2);
+        }
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            ListFor<DriversList>([&] APRINTER_TL(driver, driver::init(c)));
+            o->m_coarse = false;
+            o->m_want_coarse = false;
+            o->m_dir = false;
+            o->m_lead = 0;
+            o->m_phase = 0;
+        }
+        
+        template <typename ThisContext>
+        AMBRO_ALWAYS_INLINE
+        static void command_loaded (ThisContext c, DirStepIntType dir_x)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            // Commands without steps keep the current setting.
+            if (AMBRO_UNLIKELY((dir_x & (((DirStepIntType)1 << step_bits) - 1)) == 0)) {
+                return;
+            }
+            
+            bool dir = (dir_x & ((DirStepIntType)1 << step_bits));
+            if (dir != o->m_dir) {
+                o->m_dir = dir;
+                o->m_lead = -o->m_lead;
+            }
+            o->m_want_coarse = (dir_x & ((DirStepIntType)1 << (step_bits + 2))) && !ao->m_prestep_callback_enabled;
+            update(c);
+        }
+        
+        // Accounts for the microstep of this interrupt, and returns whether the motor
+        // needs to be stepped for it.
+        AMBRO_ALWAYS_INLINE
+        static bool begin_step (StepContext c)
+        {
+            auto *o = Object::self(c);
+            
+            int8_t lead = o->m_lead - 1;
+            bool step = (lead < 0);
+            if (step) {
+                if (o->m_coarse) {
+                    lead += Factor;
+                } else {
+                    lead = 0;
+                    o->m_phase += o->m_dir ? 1 : -1;
+                }
+            }
+            o->m_lead = lead;
+            return step;
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static void skip_steps (StepContext c, AMulType a_mul)
+        {
+            auto *o = Object::self(c);
+            auto *ao = AxisDriver::Object::self(c);
+            
+            uint8_t skip = o->m_lead;
+            if (skip == 0) {
+                return;
+            }
+            
+            auto remaining = AMBRO_LIKELY(!ao->m_notdecel) ? (ao->m_x.bitsValue() - ao->m_pos.bitsValue()) : ao->m_pos.bitsValue();
+            if (remaining < skip) {
+                skip = remaining;
+            }
+            o->m_lead -= skip;
+            
+            if (AMBRO_LIKELY(!ao->m_notdecel)) {
+                ao->m_pos.m_bits.m_int += skip;
+            } else {
+                ao->m_pos.m_bits.m_int -= skip;
+            }
+            ao->m_discriminant.m_bits.m_int += skip * a_mul.m_bits.m_int;
+        }
+        
+        template <typename ThisContext>
+        AMBRO_ALWAYS_INLINE
+        static void update (ThisContext c)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->m_coarse) {
+                if (AMBRO_UNLIKELY(!o->m_want_coarse && o->m_lead == 0)) {
+                    set_coarse(c, false);
+                }
+            } else {
+                if (AMBRO_UNLIKELY(o->m_want_coarse && (o->m_phase & (Factor - 1)) == 0)) {
+                    set_coarse(c, true);
+                }
+            }
+        }
+        
+        template <typename ThisContext>
+        static void set_coarse (ThisContext c, bool coarse)
+        {
+            auto *o = Object::self(c);
+            
+            o->m_coarse = coarse;
+            ListFor<DriversList>([&] APRINTER_TL(driver, driver::set_coarse(c, coarse)));
+        }
+        
+        struct Object : public ObjBase<MicroStepSwitchFeature, typename AxisDriver::Object, DriversList> {
+            bool m_coarse;
+            bool m_want_coarse;
+            bool m_dir;
+            int8_t m_lead;
+            uint8_t m_phase;
+        };
+    }
+    AMBRO_STRUCT_ELSE(MicroStepSwitchFeature) {
+        static int const MaxStepsPerInterrupt = 1;
+        static constexpr double SharedInterruptRate () { return 0.0; }
+        static DirStepIntType make_coarse_bit (StepFixedType x, TimeFixedType t, AccelFixedType a) { return 0; }
+        static void init (Context c) {}
+        template <typename ThisContext> static void command_loaded (ThisContext c, DirStepIntType dir_x) {}
+        static bool begin_step (StepContext c) { return true; }
+        static void skip_steps (StepContext c, AMulType a_mul) {}
+        static void update (StepContext c) {}
+        struct Object {};
+    };
+    
 public:
     struct Object : public ObjBase<AxisDriver, ParentObject, MakeTypeList<
         TheDebugObject,
         TimerInstance,
-        DelayFeature
+        DelayFeature,
+        PrecomputeFeature,
+        RecurrenceFeature,
+        MultiStepFeature,
+        MicroStepSwitchFeature
     >>, public AccelShiftMode::ExtraMembers
     {
 #ifdef AMBROLIB_ASSERTIONS
@@ -640,11 +1417,58 @@ APRINTER_ALIAS_STRUCT_EXT(AxisDriverDelayParams, (
     static bool const Enabled = true;
 ))
 
+struct AxisDriverNoPrecomputeParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverPrecomputeParams, (
+    APRINTER_AS_VALUE(int, RingSize)
+), (
+    static bool const Enabled = true;
+))
+
+struct AxisDriverNoRecurrenceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverRecurrenceParams, (
+    APRINTER_AS_VALUE(int, ResyncInterval)
+), (
+    static bool const Enabled = true;
+))
+
+struct AxisDriverNoMultiStepParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverMultiStepParams, (
+    APRINTER_AS_TYPE(DoubleStepRate),
+    APRINTER_AS_TYPE(QuadStepRate)
+), (
+    static bool const Enabled = true;
+))
+
+struct AxisDriverNoMicroStepSwitchParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverMicroStepSwitchParams, (
+    APRINTER_AS_VALUE(int, Factor),
+    APRINTER_AS_TYPE(SwitchRate),
+    APRINTER_AS_TYPE(MicroStepDriversList)
+), (
+    static bool const Enabled = true;
+))
+
 APRINTER_ALIAS_STRUCT_EXT(AxisDriverService, (
     APRINTER_AS_TYPE(TimerService),
     APRINTER_AS_TYPE(PrecisionParams),
     APRINTER_AS_VALUE(bool, PreloadCommands),
-    APRINTER_AS_TYPE(DelayParams)
+    APRINTER_AS_TYPE(DelayParams),
+    APRINTER_AS_TYPE(PrecomputeParams),
+    APRINTER_AS_TYPE(RecurrenceParams),
+    APRINTER_AS_TYPE(MultiStepParams),
+    APRINTER_AS_TYPE(MicroStepSwitchParams)
 ), (
     APRINTER_ALIAS_STRUCT_EXT(Driver, (
         APRINTER_AS_TYPE(Context),
@@ -655,6 +1479,9 @@ APRINTER_ALIAS_STRUCT_EXT(AxisDriverService, (
         using Params = AxisDriverService;
         APRINTER_DEF_INSTANCE(Driver, AxisDriver)
     ))
+    
+    template <typename NewTimerService>
+    using WithTimerService = AxisDriverService<NewTimerService, PrecisionParams, PreloadCommands, DelayParams, PrecomputeParams, RecurrenceParams, MultiStepParams, MicroStepSwitchParams>;
 ))
 
 #include <aprinter/EndNamespace.h>
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_SHARED_STEP_TIMER_H
+#define APRINTER_SHARED_STEP_TIMER_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ListForEach.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Hints.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/system/InterruptLock.h>
+#include <aprinter/misc/ClockUtils.h>
+
+#include <aprinter/BeginNamespace.h>
+
+template <typename Arg>
+class SharedStepTimerChannel;
+
+/**
+ * Runs the interrupt timers of several axis drivers on a single hardware
+ * interrupt timer.
+ * 
+ * Each channel (see ChannelService) behaves like an InterruptTimer, but only
+ * stores its time. The hardware timer is set to the earliest time of the
+ * enabled channels, and its interrupt handler calls the handlers of all the
+ * channels which are due, earliest first, before setting the timer again.
+ * Channels are found with a linear scan, which the compiler unrolls since
+ * the channels are known at compile time.
+ */
+template <typename Arg>
+class SharedStepTimer {
+    using Context          = typename Arg::Context;
+    using ParentObject     = typename Arg::ParentObject;
+    using TimerService     = typename Arg::TimerService;
+    using LazyChannelsList = typename Arg::LazyChannelsList;
+    
+    template <typename> friend class SharedStepTimerChannel;
+    
+    struct TimerHandler;
+    
+public:
+    struct Object;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    APRINTER_MAKE_INSTANCE(TimerInstance, (TimerService::template InterruptTimer<Context, Object, TimerHandler>))
+    using HandlerContext = typename TimerInstance::HandlerContext;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    using TheClockUtils = ClockUtils<Context>;
+    
+    template <typename TheLazyChannelsList=LazyChannelsList>
+    using ChannelsList = typename TheLazyChannelsList::List;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TimerInstance::init(c);
+        o->m_running = false;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+        
+        TimerInstance::deinit(c);
+    }
+    
+    struct ChannelService {
+        APRINTER_ALIAS_STRUCT_EXT(InterruptTimer, (
+            APRINTER_AS_TYPE(Context),
+            APRINTER_AS_TYPE(ParentObject),
+            APRINTER_AS_TYPE(Handler)
+        ), (
+            using TheSharedStepTimer = SharedStepTimer;
+            APRINTER_DEF_INSTANCE(InterruptTimer, SharedStepTimerChannel)
+        ))
+    };
+    
+    using GetTimer = TimerInstance;
+    
+private:
+    template <typename Channel, typename ThisContext>
+    static void set_first (ThisContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        auto *co = Channel::Object::self(c);
+        TheDebugObject::access(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            co->m_time = time;
+            co->m_enabled = true;
+            
+            if (!o->m_running) {
+                o->m_running = true;
+                o->m_time = time;
+                TimerInstance::setFirst(lock_c, time);
+            } else if (!TheClockUtils::timeGreaterOrEqual(time, o->m_time)) {
+                o->m_time = time;
+                TimerInstance::unset(lock_c);
+                TimerInstance::setFirst(lock_c, time);
+            }
+        }
+    }
+    
+    static bool timer_handler (HandlerContext c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_running)
+        
+        TimeType first_time;
+        
+        while (true) {
+            TimeType now = Clock::getTime(c);
+            
+            uint8_t first_index = 0;
+            uint8_t index = 0;
+            bool found = false;
+            ListFor<ChannelsList<>>([&] APRINTER_TL(channel, {
+                auto *co = channel::Object::self(c);
+                if (co->m_enabled && (!found || !TheClockUtils::timeGreaterOrEqual(co->m_time, first_time))) {
+                    first_time = co->m_time;
+                    first_index = index;
+                    found = true;
+                }
+                index++;
+            }));
+            
+            if (AMBRO_UNLIKELY(!found)) {
+                o->m_running = false;
+                return false;
+            }
+            
+            if (!TheClockUtils::timeGreaterOrEqual(now, first_time)) {
+                break;
+            }
+            
+            ListForOne<ChannelsList<>, 0>(first_index, [&] APRINTER_TL(channel, channel::dispatch(c)));
+        }
+        
+        o->m_time = first_time;
+        TimerInstance::setNext(c, first_time);
+        return true;
+    }
+    struct TimerHandler : public AMBRO_WFUNC_TD(&SharedStepTimer::timer_handler) {};
+    
+public:
+    struct Object : public ObjBase<SharedStepTimer, ParentObject, MakeTypeList<
+        TheDebugObject,
+        TimerInstance
+    >> {
+        bool m_running;
+        TimeType m_time;
+    };
+};
+
+template <typename Arg>
+class SharedStepTimerChannel {
+    using Context            = typename Arg::Context;
+    using ParentObject       = typename Arg::ParentObject;
+    using Handler            = typename Arg::Handler;
+    using TheSharedStepTimer = typename Arg::TheSharedStepTimer;
+    
+    template <typename> friend class SharedStepTimer;
+    
+public:
+    struct Object;
+    using TimeType = typename TheSharedStepTimer::TimeType;
+    using HandlerContext = typename TheSharedStepTimer::HandlerContext;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->m_enabled = false;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+        
+        unset(c);
+    }
+    
+    template <typename ThisContext>
+    static void setFirst (ThisContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_enabled)
+        
+        TheSharedStepTimer::template set_first<SharedStepTimerChannel>(c, time);
+    }
+    
+    static void setNext (HandlerContext c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_enabled)
+        
+        o->m_time = time;
+    }
+    
+    // The hardware timer is left running; it is stopped by its
+    // interrupt handler if no channel is enabled by then.
+    template <typename ThisContext>
+    static void unset (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        
+        AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            o->m_enabled = false;
+        }
+    }
+    
+    template <typename ThisContext>
+    static TimeType getLastSetTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        
+        return o->m_time;
+    }
+    
+private:
+    AMBRO_ALWAYS_INLINE
+    static void dispatch (HandlerContext c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_enabled)
+        
+        if (!Handler::call(c)) {
+            o->m_enabled = false;
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<SharedStepTimerChannel, ParentObject, MakeTypeList<TheDebugObject>> {
+        bool m_enabled;
+        TimeType m_time;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SharedStepTimerArg, (
+    APRINTER_AS_TYPE(Context),
+    APRINTER_AS_TYPE(ParentObject),
+    APRINTER_AS_TYPE(TimerService),
+    APRINTER_AS_TYPE(LazyChannelsList)
+), (
+    APRINTER_DEF_INSTANCE(SharedStepTimerArg, SharedStepTimer)
+))
+
+#include <aprinter/EndNamespace.h>
+
+#endif
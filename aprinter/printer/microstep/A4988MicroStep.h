@@ -46,7 +46,8 @@ public:
         Context::Pins::template setOutput<typename Params::Ms3Pin>(c);
     }
     
-    static void set_microsteps (Context c, uint8_t microsteps)
+    template <typename ThisContext>
+    static void set_microsteps (ThisContext c, uint8_t microsteps)
     {
         bool ms1;
         bool ms2;
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_PLANNER_TELEMETRY_MODULE_H
+#define APRINTER_PLANNER_TELEMETRY_MODULE_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/printer/planning/MotionPlanner.h>
+#include <aprinter/printer/utils/JsonBuilder.h>
+#include <aprinter/printer/utils/ModuleUtils.h>
+#include <aprinter/printer/ServiceList.h>
+
+#include <aprinter/BeginNamespace.h>
+
+/**
+ * Collects statistics of the motion planner, for sizing the lookahead and
+ * finding the causes of underruns. They are reported by M927 (M927 R also
+ * resets them) and in the "planner" object of the JSON status.
+ * 
+ * The occupancy histogram divides the lookahead buffer into eight equal
+ * parts and counts plans by the number of segments in the buffer. The
+ * buffered time histogram counts plans done while stepping by the time
+ * of committed motion left, in buckets below 1, 2, 4, ..., 256 ms and
+ * the last one for 256 ms or more.
+ */
+template <typename ModuleArg>
+class PlannerTelemetryModule {
+    APRINTER_UNPACK_MODULE_ARG(ModuleArg)
+    
+public:
+    struct Object;
+    
+private:
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    using FpType = typename ThePrinterMain::FpType;
+    using PlanInfo = MotionPlannerPlanInfo<TimeType>;
+    
+    static int const NumOccupancyBuckets = 8;
+    static int const NumBufferedBuckets = 10;
+    static TimeType const MillisecondTicks = 0.001 * Clock::time_freq;
+    
+public:
+    using PlannerTelemetry = PlannerTelemetryModule;
+    
+    static void init (Context c)
+    {
+        reset(c);
+    }
+    
+    static bool check_command (Context c, typename ThePrinterMain::TheCommand *cmd)
+    {
+        auto *o = Object::self(c);
+        
+        if (cmd->getCmdNumber(c) == 927) {
+            if (cmd->find_command_param(c, 'R', nullptr)) {
+                reset(c);
+            } else {
+                cmd->reply_append_pstr(c, AMBRO_PSTR("Plans:"));
+                cmd->reply_append_uint32(c, o->plans);
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" Failed:"));
+                cmd->reply_append_uint32(c, o->failed_plans);
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" PlanTimeAvgUs:"));
+                cmd->reply_append_fp(c, plan_time_avg_us(c));
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" PlanTimeMaxUs:"));
+                cmd->reply_append_fp(c, ticks_to_us(o->plan_time_max));
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" PlanSliceMaxUs:"));
+                cmd->reply_append_fp(c, ticks_to_us(o->slice_time_max));
+                cmd->reply_append_pstr(c, AMBRO_PSTR("\nUnderruns:"));
+                cmd->reply_append_uint32(c, o->underruns);
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" UnderrunTimeMs:"));
+                cmd->reply_append_fp(c, o->underrun_time_ms);
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" UnderrunTimeMaxMs:"));
+                cmd->reply_append_fp(c, o->underrun_time_max_ms);
+                cmd->reply_append_pstr(c, AMBRO_PSTR("\nMinBufferedMs:"));
+                cmd->reply_append_fp(c, min_buffered_ms(c));
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" BackupAvg:"));
+                cmd->reply_append_fp(c, backup_avg(c));
+                cmd->reply_append_pstr(c, AMBRO_PSTR(" BackupMax:"));
+                cmd->reply_append_uint32(c, o->backup_max);
+                cmd->reply_append_ch(c, '/');
+                cmd->reply_append_uint32(c, o->backup_size);
+                cmd->reply_append_pstr(c, AMBRO_PSTR("\nOccupancy:"));
+                for (int i = 0; i < NumOccupancyBuckets; i++) {
+                    cmd->reply_append_ch(c, ' ');
+                    cmd->reply_append_uint32(c, o->occupancy_hist[i]);
+                }
+                cmd->reply_append_pstr(c, AMBRO_PSTR("\nBufferedMs:"));
+                for (int i = 0; i < NumBufferedBuckets; i++) {
+                    cmd->reply_append_ch(c, ' ');
+                    cmd->reply_append_uint32(c, o->buffered_hist[i]);
+                }
+                cmd->reply_append_ch(c, '\n');
+            }
+            cmd->finishCommand(c);
+            return false;
+        }
+        return true;
+    }
+    
+    static void planner_underrun (Context c)
+    {
+        auto *o = Object::self(c);
+        o->underruns++;
+    }
+    
+    template <typename TheJsonBuilder>
+    static void get_json_status (Context c, TheJsonBuilder *json)
+    {
+        auto *o = Object::self(c);
+        
+        json->addKeyObject(JsonSafeString{"planner"});
+        json->addSafeKeyVal("plans", JsonUint32{o->plans});
+        json->addSafeKeyVal("failedPlans", JsonUint32{o->failed_plans});
+        json->addSafeKeyVal("planTimeAvgUs", JsonDouble{plan_time_avg_us(c)});
+        json->addSafeKeyVal("planTimeMaxUs", JsonDouble{ticks_to_us(o->plan_time_max)});
+        json->addSafeKeyVal("planSliceMaxUs", JsonDouble{ticks_to_us(o->slice_time_max)});
+        json->addSafeKeyVal("underruns", JsonUint32{o->underruns});
+        json->addSafeKeyVal("underrunTimeMs", JsonDouble{o->underrun_time_ms});
+        json->addSafeKeyVal("underrunTimeMaxMs", JsonDouble{o->underrun_time_max_ms});
+        json->addSafeKeyVal("minBufferedMs", JsonDouble{min_buffered_ms(c)});
+        json->addSafeKeyVal("backupAvg", JsonDouble{backup_avg(c)});
+        json->addSafeKeyVal("backupMax", JsonUint32{o->backup_max});
+        json->addSafeKeyVal("backupSize", JsonUint32{o->backup_size});
+        json->addKeyArray(JsonSafeString{"occupancy"});
+        for (int i = 0; i < NumOccupancyBuckets; i++) {
+            json->add(JsonUint32{o->occupancy_hist[i]});
+        }
+        json->endArray();
+        json->addKeyArray(JsonSafeString{"bufferedMs"});
+        for (int i = 0; i < NumBufferedBuckets; i++) {
+            json->add(JsonUint32{o->buffered_hist[i]});
+        }
+        json->endArray();
+        json->endObject();
+    }
+    
+    static void planner_plan_done (Context c, PlanInfo const *info)
+    {
+        auto *o = Object::self(c);
+        
+        o->plans++;
+        if (info->committed == 0) {
+            o->failed_plans++;
+        }
+        o->plan_time_sum += info->plan_time;
+        o->plan_time_max = MaxValue(o->plan_time_max, info->plan_time);
+        o->slice_time_max = MaxValue(o->slice_time_max, info->slice_time);
+        
+        // Bucket i counts up to (i+1)/8 of the buffer, an empty buffer goes in the first.
+        int occupancy_bucket = (info->segments == 0) ? 0 : ((uint32_t)info->segments * NumOccupancyBuckets - 1) / info->buffer_size;
+        o->occupancy_hist[MinValue(occupancy_bucket, NumOccupancyBuckets - 1)]++;
+        
+        if (info->stepping) {
+            int buffered_bucket = 0;
+            TimeType threshold = MillisecondTicks;
+            while (buffered_bucket < NumBufferedBuckets - 1 && info->buffered_time >= threshold) {
+                buffered_bucket++;
+                threshold *= 2;
+            }
+            o->buffered_hist[buffered_bucket]++;
+            if (o->stepping_plans == 0 || info->buffered_time < o->min_buffered_time) {
+                o->min_buffered_time = info->buffered_time;
+            }
+            o->stepping_plans++;
+        }
+        
+        o->backup_sum += info->backup;
+        o->backup_max = MaxValue(o->backup_max, info->backup);
+        o->backup_size = info->backup_size;
+    }
+    
+    static void planner_underrun_end (Context c, TimeType duration)
+    {
+        auto *o = Object::self(c);
+        
+        FpType duration_ms = duration * (FpType)(1000.0 * Clock::time_unit);
+        o->underrun_time_ms += duration_ms;
+        o->underrun_time_max_ms = FloatMax(o->underrun_time_max_ms, duration_ms);
+    }
+    
+private:
+    static void reset (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->plans = 0;
+        o->failed_plans = 0;
+        o->stepping_plans = 0;
+        o->underruns = 0;
+        o->backup_max = 0;
+        o->backup_size = 0;
+        o->backup_sum = 0;
+        o->plan_time_sum = 0;
+        o->plan_time_max = 0;
+        o->slice_time_max = 0;
+        o->min_buffered_time = 0;
+        o->underrun_time_ms = 0.0f;
+        o->underrun_time_max_ms = 0.0f;
+        for (int i = 0; i < NumOccupancyBuckets; i++) {
+            o->occupancy_hist[i] = 0;
+        }
+        for (int i = 0; i < NumBufferedBuckets; i++) {
+            o->buffered_hist[i] = 0;
+        }
+    }
+    
+    static FpType ticks_to_us (TimeType ticks)
+    {
+        return ticks * (FpType)(1000000.0 * Clock::time_unit);
+    }
+    
+    static FpType plan_time_avg_us (Context c)
+    {
+        auto *o = Object::self(c);
+        return (o->plans == 0) ? 0.0f : (FpType)(o->plan_time_sum * (1000000.0 * Clock::time_unit) / o->plans);
+    }
+    
+    static FpType min_buffered_ms (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->min_buffered_time * (FpType)(1000.0 * Clock::time_unit);
+    }
+    
+    static FpType backup_avg (Context c)
+    {
+        auto *o = Object::self(c);
+        return (o->plans == 0) ? 0.0f : ((FpType)o->backup_sum / o->plans);
+    }
+    
+public:
+    struct Object : public ObjBase<PlannerTelemetryModule, ParentObject, EmptyTypeList> {
+        uint32_t plans;
+        uint32_t failed_plans;
+        uint32_t stepping_plans;
+        uint32_t underruns;
+        uint16_t backup_max;
+        uint16_t backup_size;
+        uint32_t backup_sum;
+        uint64_t plan_time_sum;
+        TimeType plan_time_max;
+        TimeType slice_time_max;
+        TimeType min_buffered_time;
+        FpType underrun_time_ms;
+        FpType underrun_time_max_ms;
+        uint32_t occupancy_hist[NumOccupancyBuckets];
+        uint32_t buffered_hist[NumBufferedBuckets];
+    };
+};
+
+struct PlannerTelemetryModuleService {
+    APRINTER_MODULE_TEMPLATE(PlannerTelemetryModuleService, PlannerTelemetryModule)
+    
+    using ProvidedServices = MakeTypeList<ServiceDefinition<ServiceList::PlannerTelemetryService>>;
+};
+
+#include <aprinter/EndNamespace.h>
+
+#endif
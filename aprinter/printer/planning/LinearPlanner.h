@@ -32,10 +32,15 @@
 
 template <typename FpType>
 struct LinearPlanner {
-    struct SegmentData {
+    // The data needed by push(), kept apart from the rest of the segment
+    // data so that the backward pass only has to go through this.
+    struct SegmentPushData {
         FpType a_x;
-        FpType max_v;
         FpType max_start_v;
+    };
+    
+    struct SegmentData {
+        FpType max_v;
         FpType a_x_rec;
     };
 
@@ -50,7 +55,7 @@ struct LinearPlanner {
         FpType const_v;
     };
     
-    static void initSegment (SegmentData *segment, FpType prev_max_v, FpType max_start_v, FpType max_v, FpType a_x)
+    static void initSegment (SegmentPushData *push_data, SegmentData *segment, FpType prev_max_v, FpType max_start_v, FpType max_v, FpType a_x)
     {
         AMBRO_ASSERT(FloatIsPosOrPosZero(prev_max_v))
         AMBRO_ASSERT(FloatIsPosOrPosZero(max_start_v))
@@ -58,34 +63,48 @@ struct LinearPlanner {
         AMBRO_ASSERT(FloatIsPosOrPosZero(a_x))
         
         segment->max_v = max_v;
-        segment->max_start_v = FloatMin(prev_max_v, FloatMin(max_start_v, max_v));
-        segment->a_x = a_x;
+        push_data->max_start_v = FloatMin(prev_max_v, FloatMin(max_start_v, max_v));
+        push_data->a_x = a_x;
         segment->a_x_rec = 1.0f / a_x;
     }
     
-    static FpType push (SegmentData *segment, SegmentState *s, FpType end_v)
+    // A segment without motion (e.g. a channel command), through which
+    // push() passes the speed unchanged. It has no SegmentData.
+    static void initPassSegment (SegmentPushData *push_data)
     {
-        AMBRO_ASSERT(FloatIsPosOrPosZero(segment->a_x))
-        AMBRO_ASSERT(FloatIsPosOrPosZero(segment->max_v))
-        AMBRO_ASSERT(FloatIsPosOrPosZero(segment->max_start_v))
-        AMBRO_ASSERT(segment->max_start_v <= segment->max_v)
+        push_data->max_start_v = INFINITY;
+        push_data->a_x = 0.0f;
+    }
+    
+    static FpType push (SegmentPushData const *push_data, SegmentState *s, FpType end_v)
+    {
+        AMBRO_ASSERT(FloatIsPosOrPosZero(push_data->a_x))
+        AMBRO_ASSERT(FloatIsPosOrPosZero(push_data->max_start_v))
         AMBRO_ASSERT(FloatIsPosOrPosZero(end_v))
-        AMBRO_ASSERT(end_v <= segment->max_v)
         
         s->end_v = end_v;
-        return FloatMin(segment->max_start_v, end_v + segment->a_x);
+        return FloatMin(push_data->max_start_v, end_v + push_data->a_x);
+    }
+
+    // Whether a start speed returned by push() is limited only by the segment
+    // itself. It then stays the same however the following segments change,
+    // and the segments before need not be planned again.
+    static bool startIsMax (SegmentPushData const *push_data, FpType start_v)
+    {
+        return start_v >= push_data->max_start_v;
     }
 
-    static FpType pull (SegmentData *segment, SegmentState *s, FpType start_v, SegmentResult *result)
+    static FpType pull (SegmentPushData const *push_data, SegmentData const *segment, SegmentState *s, FpType start_v, SegmentResult *result)
     {
+        AMBRO_ASSERT(push_data->max_start_v <= segment->max_v)
         AMBRO_ASSERT(s->end_v <= segment->max_v)
         AMBRO_ASSERT(FloatIsPosOrPosZero(start_v))
-        AMBRO_ASSERT(start_v <= segment->max_start_v)
-        AMBRO_ASSERT(start_v <= s->end_v + segment->a_x)
+        AMBRO_ASSERT(start_v <= push_data->max_start_v)
+        AMBRO_ASSERT(start_v <= s->end_v + push_data->a_x)
         
         FpType end_v = s->end_v;
         
-        FpType start_v_plus_a_x = start_v + segment->a_x;
+        FpType start_v_plus_a_x = start_v + push_data->a_x;
         if (end_v > start_v_plus_a_x) {
             end_v = start_v_plus_a_x;
             result->const_start = 1.0f;
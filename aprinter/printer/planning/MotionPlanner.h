@@ -29,6 +29,10 @@
 #include <stddef.h>
 #include <limits.h>
 #include <math.h>
+#ifdef MOTIONPLANNER_BENCHMARK
+#include <stdio.h>
+#include <stdlib.h>
+#endif
 
 #include <aprinter/meta/FixedPoint.h>
 #include <aprinter/meta/Tuple.h>
@@ -45,15 +49,22 @@
 #include <aprinter/meta/MemberType.h>
 #include <aprinter/meta/MinMax.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/StructIf.h>
+#include <aprinter/meta/BasicMetaUtils.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Hints.h>
 #include <aprinter/math/FloatTools.h>
 #include <aprinter/system/InterruptLock.h>
+#include <aprinter/misc/ClockUtils.h>
 #include <aprinter/printer/actuators/AxisDriverConsumer.h>
 #include <aprinter/printer/planning/LinearPlanner.h>
 #include <aprinter/printer/Configuration.h>
 
+#if defined(MOTIONPLANNER_BENCHMARK) && !defined(AMBROLIB_LINUX)
+#error "MOTIONPLANNER_BENCHMARK is only supported on the Linux host platform"
+#endif
+
 #include <aprinter/BeginNamespace.h>
 
 APRINTER_ALIAS_STRUCT(MotionPlannerAxisSpec, (
@@ -63,7 +74,33 @@ APRINTER_ALIAS_STRUCT(MotionPlannerAxisSpec, (
     APRINTER_AS_TYPE(CorneringDistance),
     APRINTER_AS_TYPE(MaxSpeedRec),
     APRINTER_AS_TYPE(MaxAccelRec),
-    APRINTER_AS_TYPE(PrestepCallback)
+    APRINTER_AS_TYPE(PrestepCallback),
+    APRINTER_AS_TYPE(AdvanceParams),
+    APRINTER_AS_TYPE(ShaperParams)
+))
+
+struct MotionPlannerNoAdvanceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerAdvanceParams, (
+    APRINTER_AS_TYPE(AdvanceTime)
+), (
+    static bool const Enabled = true;
+))
+
+enum {MotionPlannerShaperZV, MotionPlannerShaperMZV, MotionPlannerShaperEI};
+
+struct MotionPlannerNoShaperParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerShaperParams, (
+    APRINTER_AS_VALUE(int, ShaperType),
+    APRINTER_AS_TYPE(Frequency),
+    APRINTER_AS_TYPE(DampingRatio)
+), (
+    static bool const Enabled = true;
 ))
 
 APRINTER_ALIAS_STRUCT(MotionPlannerChannelSpec, (
@@ -79,6 +116,62 @@ APRINTER_ALIAS_STRUCT(MotionPlannerLaserSpec, (
     APRINTER_AS_TYPE(MaxSpeedRec)
 ))
 
+struct MotionPlannerNoJunctionDeviationParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerJunctionDeviationParams, (
+    APRINTER_AS_TYPE(JunctionDeviation)
+), (
+    static bool const Enabled = true;
+))
+
+struct MotionPlannerNoLookaheadTimeParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerLookaheadTimeParams, (
+    APRINTER_AS_TYPE(TargetTime)
+), (
+    static bool const Enabled = true;
+))
+
+struct MotionPlannerNoPlanSliceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerPlanSliceParams, (
+    APRINTER_AS_TYPE(TimeSlice),
+    APRINTER_AS_TYPE(DeadlineMargin)
+), (
+    static bool const Enabled = true;
+))
+
+struct MotionPlannerNoTelemetryParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerTelemetryParams, (
+    APRINTER_AS_TYPE(PlanCallback),
+    APRINTER_AS_TYPE(UnderrunEndCallback)
+), (
+    static bool const Enabled = true;
+))
+
+// Passed to the PlanCallback of the telemetry after every plan().
+template <typename TimeType>
+struct MotionPlannerPlanInfo {
+    uint16_t segments; // segments in the lookahead buffer
+    uint16_t buffer_size; // size of the lookahead buffer
+    uint16_t committed; // segments committed, zero if the plan failed due to loss of sync
+    uint16_t backup; // planned segments not committed, held in the backup buffers
+    uint16_t backup_size; // capacity of the backup buffers in segments
+    TimeType buffered_time; // time of committed motion not yet executed, when plan() started
+    TimeType plan_time; // time from the start to the end of plan(), including time yielded to other events
+    TimeType slice_time; // longest time which plan() ran without yielding
+    bool stepping; // whether plan() was done while stepping
+};
+
 template <typename Context>
 struct MotionPlannerConstants {
     // Allows dependant equal expressions to not be duplicated for different MotionPlanner instances.
@@ -95,12 +188,19 @@ class MotionPlanner {
     static int const StepperSegmentBufferSize = Arg::StepperSegmentBufferSize;
     static int const LookaheadBufferSize      = Arg::LookaheadBufferSize;
     static int const LookaheadCommitCount     = Arg::LookaheadCommitCount;
+    using LookaheadTimeParams                 = typename Arg::LookaheadTimeParams;
+    using PlanSliceParams                     = typename Arg::PlanSliceParams;
+    static int const SCurvePieces             = Arg::SCurvePieces;
+    using JunctionDeviationParams             = typename Arg::JunctionDeviationParams;
     using FpType                              = typename Arg::FpType;
     using MaxStepsPerCycle                    = typename Arg::MaxStepsPerCycle;
     using PullHandler                         = typename Arg::PullHandler;
     using FinishedHandler                     = typename Arg::FinishedHandler;
     using AbortedHandler                      = typename Arg::AbortedHandler;
     using UnderrunCallback                    = typename Arg::UnderrunCallback;
+    using TelemetryParams                     = typename Arg::TelemetryParams;
+    static bool const NominalSpeedScaling     = Arg::NominalSpeedScaling;
+    static bool const FeedHold                = Arg::FeedHold;
     using ParamsChannelsList                  = typename Arg::ParamsChannelsList;
     using ParamsLasersList                    = typename Arg::ParamsLasersList;
     
@@ -112,17 +212,26 @@ private:
     static_assert(LookaheadBufferSize >= 2, "");
     static_assert(LookaheadCommitCount >= 1, "");
     static_assert(LookaheadCommitCount < LookaheadBufferSize, "");
+    static_assert(SCurvePieces >= 0 && SCurvePieces <= 16, "");
     using Loop = typename Context::EventLoop;
     using Clock = typename Context::Clock;
     using TimeType = typename Clock::TimeType;
+    using TheClockUtils = ClockUtils<Context>;
     static const int NumAxes = TypeListLength<ParamsAxesList>::Value;
     static_assert(NumAxes > 0, "");
     static const int NumChannels = TypeListLength<ParamsChannelsList>::Value;
     using SegmentBufferSizeType = ChooseIntForMax<2 * LookaheadBufferSize, false>; // twice for segments_add()
-    static const size_t StepperCommitBufferSize = 3 * StepperSegmentBufferSize;
-    static const size_t StepperBackupBufferSize = 3 * (LookaheadBufferSize - LookaheadCommitCount);
-    using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
-    using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
+    static const int CommandsPerSegment = (SCurvePieces == 0) ? 3 : (2 * SCurvePieces + 1);
+    static const int MinCommitCount = LookaheadTimeParams::Enabled ? 1 : LookaheadCommitCount;
+    
+    // With an S-curve profile, the pieces in the middle of an acceleration phase accelerate
+    // faster than the average over the phase. Planning is done with the average acceleration,
+    // which is reduced by this factor so that no piece exceeds the configured limit.
+    static constexpr double scurve_smoothstep (double u) { return u * u * (3.0 - 2.0 * u); }
+    static constexpr double SCurvePeakAccelFactor =
+        (SCurvePieces == 0) ? 1.0 :
+        (SCurvePieces % 2 == 0) ? (SCurvePieces * (scurve_smoothstep(0.5) - scurve_smoothstep(0.5 - 1.0 / SCurvePieces))) :
+        (SCurvePieces * (scurve_smoothstep(0.5 + 0.5 / SCurvePieces) - scurve_smoothstep(0.5 - 0.5 / SCurvePieces)));
     using StepperFastEvent = typename Context::EventLoop::template FastEventSpec<MotionPlanner>;
     using CallbackFastEvent = typename Context::EventLoop::template FastEventSpec<StepperFastEvent>;
     static const int TypeBits = BitsInInt<NumChannels>::Value;
@@ -135,6 +244,17 @@ private:
     
     using CMinSegmentTime = decltype(ExprCast<FpType>(typename Constants::TimeConversion() * MinSecondsPerStep()));
     
+    // Number of impulses of the input shaper of an axis, one without shaping.
+    template <typename ShaperParams, bool Enabled = ShaperParams::Enabled>
+    struct ShaperNumImpulses {
+        static int const Value = 1;
+    };
+    
+    template <typename ShaperParams>
+    struct ShaperNumImpulses<ShaperParams, true> {
+        static int const Value = (ShaperParams::ShaperType == MotionPlannerShaperZV) ? 2 : 3;
+    };
+    
 public:
     using ConfigExprs = MakeTypeList<CMinSegmentTime>;
     
@@ -198,8 +318,16 @@ private:
         TimeType time;
     };
     
+    template <bool AdvanceEnabled, typename Dummy = void>
+    struct AxisSegmentAdvancePart {};
+    
+    template <typename Dummy>
+    struct AxisSegmentAdvancePart<true, Dummy> {
+        FpType adv_by_v; // advance steps per unit of speed
+    };
+    
     template <int AxisIndex>
-    struct AxisSegment {
+    struct AxisSegment : public AxisSegmentAdvancePart<TypeListGet<ParamsAxesList, AxisIndex>::AdvanceParams::Enabled> {
         using AxisSpec = TypeListGet<ParamsAxesList, AxisIndex>;
         using TheAxisDriver = typename AxisSpec::TheAxisDriver;
         using StepperStepFixedType = typename TheAxisDriver::StepFixedType;
@@ -230,7 +358,18 @@ private:
         SegmentLasersTuple * lasers () { return this; };
     };
     
-    struct SegmentAxesPart : public SegmentAxesHelper, public SegmentLasersHelper {
+    template <bool ScalingEnabled, typename Dummy = void>
+    struct SegmentScalingPart {};
+    
+    template <typename Dummy>
+    struct SegmentScalingPart<true, Dummy> {
+        FpType nominal_rel_max_speed_rec; // requested part of rel_max_speed_rec
+        FpType limit_rel_max_speed_rec; // part of rel_max_speed_rec due to the axes and lasers
+        FpType distance_squared;
+        FpType junction_max_start_v;
+    };
+    
+    struct SegmentAxesPart : public SegmentAxesHelper, public SegmentLasersHelper, public SegmentScalingPart<NominalSpeedScaling> {
         typename TheLinearPlanner::SegmentData lp_seg;
         FpType max_accel_rec;
         FpType rel_max_speed_rec;
@@ -253,6 +392,12 @@ private:
         using StepperCommand = typename TheStepper::Command;
         using StepperCommandCallbackContext = typename TheStepper::CommandCallbackContext;
         using ComputeState = typename TheAxis::ComputeState;
+        static const int StepperCommandsPerSegment = TheAxis::StepperCommandsPerSegment;
+        static const int StepperExtraCommands = TheAxis::StepperExtraCommands;
+        static const size_t StepperCommitBufferSize = StepperCommandsPerSegment * StepperSegmentBufferSize + StepperExtraCommands;
+        static const size_t StepperBackupBufferSize = StepperCommandsPerSegment * (LookaheadBufferSize - MinCommitCount) + 2 * StepperExtraCommands;
+        using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
+        using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
         
         static void init (Context c, bool prestep_callback_enabled)
         {
@@ -309,7 +454,7 @@ private:
         static bool have_commit_space (bool accum, Context c)
         {
             auto *o = Object::self(c);
-            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= 3 * LookaheadCommitCount);
+            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= StepperCommandsPerSegment * LookaheadCommitCount + StepperExtraCommands);
         }
         
         static void start_commands (Context c)
@@ -335,6 +480,9 @@ private:
                 o->m_new_backup_end++;
             }
             TheStepper::generate_command(args..., cmd);
+#ifdef MOTIONPLANNER_BENCHMARK
+            bench()->commands++;
+#endif
         }
         
         static void do_commit (Context c)
@@ -445,6 +593,25 @@ public:
         using StepperStepFixedType = typename TheAxisDriver::StepFixedType;
         using TheAxisSegment = AxisSegment<AxisIndex>;
         static const AxisMaskType TheAxisMask = (AxisMaskType)1 << (AxisIndex + TypeBits);
+        using AdvanceParams = typename AxisSpec::AdvanceParams;
+        using ShaperParams = typename AxisSpec::ShaperParams;
+        static_assert(!(AdvanceParams::Enabled && ShaperParams::Enabled), "Advance and input shaping cannot be used on the same axis.");
+        
+        // With advance or input shaping, a command may need to be split where the
+        // axis reverses. With input shaping, each command results in a shaped command
+        // for each impulse, plus those left over from the shaper history.
+        static int const ShaperImpulses = ShaperNumImpulses<ShaperParams>::Value;
+        static int const ShaperHistorySize = 16;
+        static int const StepperCommandsPerSegment = (AdvanceParams::Enabled || ShaperParams::Enabled) ? (2 * ShaperImpulses * CommandsPerSegment) : CommandsPerSegment;
+        static int const StepperExtraCommands = 2 * (ShaperImpulses - 1) * (ShaperHistorySize + 1);
+        
+        // With advance, segments are limited to half the steps of a stepper command,
+        // and the advance to a quarter, so that the steps of a command with the
+        // change of advance added still fit. With input shaping, segments are
+        // limited to half the steps, so that a shaped command, a weighted sum of
+        // (possibly merged) commands, still fits.
+        static int const SegmentStepsShift = (AdvanceParams::Enabled || ShaperParams::Enabled) ? 1 : 0;
+        using SignedStepsType = ChooseInt<StepperStepFixedType::num_bits + 1, true>;
         
         struct ComputeState {
             FpType x;
@@ -457,6 +624,8 @@ public:
             auto *o = Object::self(c);
             TheAxisDriver::setPrestepCallbackEnabled(c, prestep_callback_enabled);
             o->last_x_by_distance = 0.0f;
+            AdvanceFeature::init(c);
+            ShaperFeature::init(c);
         }
         
         static void deinit_impl (Context c)
@@ -479,14 +648,19 @@ public:
         static bool splitbuf_fits (bool accum, Context c)
         {
             TheAxisSplitBuffer *axis_split = get_axis_split(c);
-            return (accum && axis_split->x <= StepperStepFixedType::maxValue());
+            return (accum && axis_split->x <= max_segment_steps());
         }
         
         template <typename AccumType>
         static FpType compute_split_count (AccumType accum, Context c)
         {
             TheAxisSplitBuffer *axis_split = get_axis_split(c);
-            return FloatMax(accum, axis_split->x.template fpValue<FpType>() * (FpType)(1.0001 / StepperStepFixedType::maxValue().fpValueConstexpr()));
+            return FloatMax(accum, axis_split->x.template fpValue<FpType>() * (FpType)(1.0001 * (1 << SegmentStepsShift) / StepperStepFixedType::maxValue().fpValueConstexpr()));
+        }
+        
+        static StepperStepFixedType max_segment_steps ()
+        {
+            return StepperStepFixedType::importBits(StepperStepFixedType::maxValue().bitsValue() >> SegmentStepsShift);
         }
         
         static bool check_icmd_zero_impl (Context c)
@@ -567,8 +741,32 @@ public:
             return FloatMax(accum, dm * APRINTER_CFG(Config, CCorneringSpeedComputationFactor, c));
         }
         
+        template <typename TheComputeStateTuple>
+        static FpType junction_dir_norm_sq (FpType accum, Context c, TheComputeStateTuple const *cst)
+        {
+            ComputeState const *cs = TupleFindElem<ComputeState>(cst);
+            FpType w = cs->x * APRINTER_CFG(Config, CDistanceFactor, c);
+            return accum + w * w;
+        }
+        
+        template <typename TheComputeStateTuple>
+        static void junction_dir_update (Context c, Segment const *entry, FpType dir_norm_rec, TheComputeStateTuple const *cst, FpType *j_sq, FpType *j_accel_rec)
+        {
+            auto *o = Object::self(c);
+            ComputeState const *cs = TupleFindElem<ComputeState>(cst);
+            
+            FpType u = cs->x * APRINTER_CFG(Config, CDistanceFactor, c) * dir_norm_rec;
+            if (!(entry->dir_and_type & TheAxisMask)) {
+                u = -u;
+            }
+            FpType j = u - o->last_x_by_distance;
+            o->last_x_by_distance = u;
+            *j_sq += j * j;
+            *j_accel_rec = FloatMax(*j_accel_rec, FloatAbs(j) * APRINTER_CFG(Config, CJunctionAccelRec, c));
+        }
+        
         template <typename TheMinTimeType>
-        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared)
+        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared, FpType v_start, FpType v_const, FpType v_end)
         {
             TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
             
@@ -598,14 +796,140 @@ public:
             bool dir = entry->dir_and_type & TheAxisMask;
             FpType accel_conversion = entry->axes.lp_seg.a_x_rec * xfp;
             
+            // The advance is brought to that of the constant speed by the end of
+            // each command, except the last one of the segment, which brings it
+            // to that of the end speed.
+            FpType v_adv0 = (!skip1 || x2.bitsValue() != 0) ? v_const : v_end;
+            FpType v_adv1 = (x2.bitsValue() != 0) ? v_const : v_end;
+            
             if (x0.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)));
+                if (SCurvePieces == 0) {
+                    AdvanceFeature::gen_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)), AdvanceFeature::target(entry, v_adv0));
+                } else {
+                    gen_scurve_commands(c, entry, dir, x0, t0, v_start, v_const, v_adv0);
+                }
             }
             if (!skip1) {
-                TheCommon::gen_stepper_command(c, dir, x1, t1, StepperStepFixedType::importBits(0));
+                AdvanceFeature::gen_command(c, dir, x1, t1, StepperStepFixedType::importBits(0), AdvanceFeature::target(entry, v_adv1));
             }
             if (x2.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)));
+                if (SCurvePieces == 0) {
+                    AdvanceFeature::gen_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)), AdvanceFeature::target(entry, v_end));
+                } else {
+                    gen_scurve_commands(c, entry, dir, x2, t2, v_const, v_end, v_end);
+                }
+            }
+        }
+        
+        // Generates the commands for an acceleration or deceleration phase with an
+        // S-curve velocity profile, v(u) = v_from + (v_to - v_from) * (3u^2 - 2u^3),
+        // as SCurvePieces constant-acceleration commands of equal duration. Each command
+        // goes between the velocities of the curve at its ends; the distance of each is
+        // proportional to the sum of these velocities, since all have the same duration.
+        // The advance follows the velocity, and at the end reaches that of v_adv_end.
+        template <typename TheMinTimeType>
+        static void gen_scurve_commands (Context c, Segment *entry, bool dir, StepperStepFixedType x, TheMinTimeType t, FpType v_from, FpType v_to, FpType v_adv_end)
+        {
+            FpType v_sum = v_from + v_to;
+            FpType x_factor = AMBRO_LIKELY(v_sum > 0.0f) ? (x.template fpValue<FpType>() / (SCurvePieces * v_sum)) : 0.0f;
+            FpType v_diff = v_to - v_from;
+            auto piece_t = t.bitsValue() / SCurvePieces;
+            
+            FpType w0 = v_from;
+            FpType w_start = v_from;
+            FpType dist = 0.0f;
+            typename StepperStepFixedType::IntType prev_x = 0;
+            typename TheMinTimeType::IntType prev_t = 0;
+            SignedStepsType prev_adv = AdvanceFeature::target(entry, v_from);
+            
+            for (int k = 1; k <= SCurvePieces; k++) {
+                FpType u = (FpType)k / SCurvePieces;
+                FpType w1 = v_from + v_diff * (u * u * (3.0f - 2.0f * u));
+                dist += w0 + w1;
+                
+                auto end_x = x.bitsValue();
+                auto end_t = t.bitsValue();
+                SignedStepsType end_adv = AdvanceFeature::target(entry, v_adv_end);
+                if (k < SCurvePieces) {
+                    end_x = FixedMin(x, StepperStepFixedType::importFpSaturatedRound(dist * x_factor)).bitsValue();
+                    end_t = k * piece_t;
+                    end_adv = AdvanceFeature::target(entry, w1);
+                }
+                
+                // Pieces with no steps are merged into the next command.
+                if (end_x != prev_x || end_adv != prev_adv || (k == SCurvePieces && end_t != prev_t)) {
+                    StepperStepFixedType piece_x = StepperStepFixedType::importBits(end_x - prev_x);
+                    TheMinTimeType piece_t_fixed = TheMinTimeType::importBits(end_t - prev_t);
+                    FpType w_sum = w_start + w1;
+                    FpType accel_ratio = AMBRO_LIKELY(w_sum > 0.0f) ? ((w1 - w_start) / w_sum) : 0.0f;
+                    StepperStepFixedType piece_a = FixedMin(piece_x, StepperStepFixedType::importFpSaturatedRound(FloatAbs(accel_ratio) * piece_x.template fpValue<FpType>()));
+                    if (accel_ratio >= 0.0f) {
+                        AdvanceFeature::gen_command(c, dir, piece_x, piece_t_fixed, piece_a, end_adv);
+                    } else {
+                        AdvanceFeature::gen_command(c, dir, piece_x, piece_t_fixed, -piece_a, end_adv);
+                    }
+                    prev_x = end_x;
+                    prev_t = end_t;
+                    prev_adv = end_adv;
+                    w_start = w1;
+                }
+                
+                w0 = w1;
+            }
+        }
+        
+        // Generates a command for x steps in the direction dir (the opposite one if x
+        // is negative), during which the speed changes linearly from x - a to x + a
+        // (the position being (x - a) * u + a * u^2, for u in [0, 1]). Where the
+        // speed changes sign, the command is split in two at the point of zero speed.
+        template <typename TheMinTimeType>
+        static void gen_signed_command (Context c, bool dir, SignedStepsType x, TheMinTimeType t, FpType a)
+        {
+            if (x < 0) {
+                dir = !dir;
+                x = -x;
+                a = -a;
+            }
+            FpType v_from = (FpType)x - a;
+            FpType v_to = (FpType)x + a;
+            
+            if (v_from >= 0.0f && v_to >= 0.0f) {
+                StepperStepFixedType cmd_x = StepperStepFixedType::importBits(x);
+                StepperStepFixedType cmd_a = FixedMin(cmd_x, StepperStepFixedType::importFpSaturatedRound(FloatAbs(a)));
+                if (a >= 0.0f) {
+                    TheCommon::gen_stepper_command(c, dir, cmd_x, t, cmd_a);
+                } else {
+                    TheCommon::gen_stepper_command(c, dir, cmd_x, t, -cmd_a);
+                }
+            } else {
+                FpType u = v_from / (v_from - v_to);
+                SignedStepsType x_first = FloatIntRound<SignedStepsType>(0.5f * v_from * u);
+                SignedStepsType x_second = x - x_first;
+                if (x_first == 0) {
+                    gen_from_to_rest(c, dir, x_second, t, false);
+                } else if (x_second == 0) {
+                    gen_from_to_rest(c, dir, x_first, t, true);
+                } else {
+                    TheMinTimeType t_first = FixedMin(t, TheMinTimeType::importFpSaturatedRound(u * t.template fpValue<FpType>()));
+                    gen_from_to_rest(c, dir, x_first, t_first, true);
+                    gen_from_to_rest(c, dir, x_second, TheMinTimeType::importBits(t.bitsValue() - t_first.bitsValue()), false);
+                }
+            }
+        }
+        
+        // Generates a command which starts or (if to_rest) ends at zero speed.
+        template <typename TheMinTimeType>
+        static void gen_from_to_rest (Context c, bool dir, SignedStepsType x, TheMinTimeType t, bool to_rest)
+        {
+            if (x < 0) {
+                dir = !dir;
+                x = -x;
+            }
+            StepperStepFixedType cmd_x = StepperStepFixedType::importBits(x);
+            if (to_rest) {
+                TheCommon::gen_stepper_command(c, dir, cmd_x, t, -cmd_x);
+            } else {
+                TheCommon::gen_stepper_command(c, dir, cmd_x, t, cmd_x);
             }
         }
         
@@ -658,10 +982,10 @@ public:
                 StepperStepFixedType cmd_steps = TheAxisDriver::getAbortedCmdSteps(c, &dir);
                 add_steps(&steps, cmd_steps, dir);
             }
-            for (StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
+            for (typename TheCommon::StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
                 add_command_steps(c, &steps, &co->m_commit_buffer[i]);
             }
-            for (StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
+            for (typename TheCommon::StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
                 add_command_steps(c, &steps, &co->m_backup_buffer[i]);
             }
             for (SegmentBufferSizeType i = m->m_segments_staging_length; i < m->m_segments_length; i++) {
@@ -693,18 +1017,410 @@ public:
         using DriverSyncMinStepTime = APRINTER_FP_CONST_EXPR(TheAxisDriver::SyncMinStepTime());
         using DriverAsyncMinStepTime = APRINTER_FP_CONST_EXPR(TheAxisDriver::AsyncMinStepTime());
         
-        using SyncMinStepTime = decltype(typename Constants::TimeConversion() * (MinSecondsPerStep() + DriverSyncMinStepTime()));
+        // With multiple steps per interrupt or switched microsteps, the interrupt time is
+        // shared by that many steps, but only above some step rate, see SharedInterruptsFeature.
+        using InterruptStepTimeFactor = APRINTER_FP_CONST_EXPR(1.0 / TheAxisDriver::MaxStepsPerInterrupt());
+        
+        using SyncMinStepTime = decltype(typename Constants::TimeConversion() * (MinSecondsPerStep() * InterruptStepTimeFactor() + DriverSyncMinStepTime()));
         
         using CDistanceFactor = decltype(ExprCast<FpType>(AxisSpec::DistanceFactor::e()));
         using CCorneringSpeedComputationFactor = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e() / (AxisSpec::CorneringDistance::e() * AxisSpec::DistanceFactor::e())));
         using CMaxSpeedRec = decltype(ExprCast<FpType>(AxisSpec::MaxSpeedRec::e()));
         using CMaxAccelRec = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e()));
+        using CJunctionAccelRec = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e() / AxisSpec::DistanceFactor::e()));
         using CSyncMinStepTime = decltype(ExprCast<FpType>(SyncMinStepTime()));
         using CAsyncMinStepTime = decltype(ExprCast<FpType>(SyncMinStepTime() + typename Constants::TimeConversion() * DriverAsyncMinStepTime()));
         
-        using ConfigExprs = MakeTypeList<CDistanceFactor, CCorneringSpeedComputationFactor, CMaxSpeedRec, CMaxAccelRec, CSyncMinStepTime, CAsyncMinStepTime>;
+        using CJunctionExpr = If<JunctionDeviationParams::Enabled, CJunctionAccelRec, CCorneringSpeedComputationFactor>;
+        
+        using ConfigExprs = MakeTypeList<CDistanceFactor, CJunctionExpr, CMaxSpeedRec, CMaxAccelRec, CSyncMinStepTime, CAsyncMinStepTime>;
+        
+        // The driver has at most SharedInterruptRate interrupts per second more than the
+        // step rate divided by MaxStepsPerInterrupt, which the sync step time assumes.
+        // For the sync time of a segment, the planner either counts the full interrupt
+        // time for each step of these axes (UnsharedStepTime being the difference), or
+        // reserves the time of SharedInterruptRate interrupts per second for each of them
+        // that moves, whichever allows the segment to be faster.
+        static bool const SharesInterrupts = (TheAxisDriver::MaxStepsPerInterrupt() > 1);
+        
+        AMBRO_STRUCT_IF(SharedInterruptsFeature, SharesInterrupts) {
+            using UnsharedStepTimeFactor = APRINTER_FP_CONST_EXPR(1.0 - 1.0 / TheAxisDriver::MaxStepsPerInterrupt());
+            using SharedInterruptRate = APRINTER_FP_CONST_EXPR(TheAxisDriver::SharedInterruptRate());
+            
+            using CUnsharedStepTime = decltype(ExprCast<FpType>(typename Constants::TimeConversion() * MinSecondsPerStep() * UnsharedStepTimeFactor()));
+            using CInterruptReserve = decltype(ExprCast<FpType>(MinSecondsPerStep() * SharedInterruptRate()));
+            
+            template <typename TheComputeStateTuple>
+            static void add_interrupt_time (Context c, Segment *entry, TheComputeStateTuple const *cst, FpType *unshared_time, FpType *reserve)
+            {
+                TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
+                if (axis_entry->x.bitsValue() != 0) {
+                    ComputeState const *cs = TupleFindElem<ComputeState>(cst);
+                    *unshared_time += cs->x * APRINTER_CFG(Config, CUnsharedStepTime, c);
+                    *reserve += APRINTER_CFG(Config, CInterruptReserve, c);
+                }
+            }
+            
+            using ConfigExprs = MakeTypeList<CUnsharedStepTime, CInterruptReserve>;
+            
+            struct Object : public ObjBase<SharedInterruptsFeature, typename Axis::Object, EmptyTypeList> {};
+        }
+        AMBRO_STRUCT_ELSE(SharedInterruptsFeature) {
+            template <typename TheComputeStateTuple>
+            static void add_interrupt_time (Context c, Segment *entry, TheComputeStateTuple const *cst, FpType *unshared_time, FpType *reserve) {}
+            struct Object {};
+        };
+        
+        // Advance (pressure advance for extruders): the axis is kept ahead of its
+        // planned position by AdvanceTime times its current speed. Within each
+        // command the speed changes linearly, so the change of the advance is
+        // added to the command as constant-speed steps. Where the resulting
+        // speed changes sign (e.g. retraction while decelerating), the command
+        // is split into two at the point of zero speed.
+        // The advance is tracked in whole steps, relative to the commands generated
+        // so far; at the end of all planned motion (zero speed), it is zero.
+        AMBRO_STRUCT_IF(AdvanceFeature, AdvanceParams::Enabled) {
+            struct Object;
+            
+            static void init (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_adv = 0;
+                o->m_staging_adv = 0;
+            }
+            
+            // No advance is applied to moves of only advanced axes (retractions).
+            static bool other_axes_moving (bool accum, Context c, Segment *entry)
+            {
+                return accum;
+            }
+            
+            static void write_segment (Context c, Segment *entry, FpType distance_rec)
+            {
+                TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
+                axis_entry->adv_by_v = axis_entry->x.template fpValue<FpType>() * distance_rec * APRINTER_CFG(Config, CAdvanceTimeTicks, c);
+            }
+            
+            static SignedStepsType target (Segment *entry, FpType v)
+            {
+                TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
+                return FloatIntRound<SignedStepsType>(FloatMin(axis_entry->adv_by_v * v, (FpType)MaxAdvance::value()));
+            }
+            
+            static void start_plan (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_adv = o->m_staging_adv;
+            }
+            
+            static void commit_point (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_staging_adv = o->m_adv;
+            }
+            
+            static void underrun (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_staging_adv = 0;
+            }
+            
+            template <typename TheMinTimeType, typename AType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AType a, SignedStepsType adv)
+            {
+                auto *o = Object::self(c);
+                
+                SignedStepsType d = adv - (dir ? o->m_adv : -o->m_adv);
+                o->m_adv = dir ? adv : -adv;
+                
+                if (AMBRO_LIKELY(d == 0)) {
+                    TheCommon::gen_stepper_command(c, dir, x, t, a);
+                    return;
+                }
+                
+                gen_signed_command(c, dir, (SignedStepsType)x.bitsValue() + d, t, a.template fpValue<FpType>());
+            }
+            
+            using MaxAdvance = APRINTER_FP_CONST_EXPR(StepperStepFixedType::maxValue().fpValueConstexpr() / 4.0);
+            
+            using CAdvanceTimeTicks = decltype(ExprCast<FpType>(AdvanceParams::AdvanceTime::e() * typename Constants::TimeConversion()));
+            
+            using ConfigExprs = MakeTypeList<CAdvanceTimeTicks>;
+            
+            struct Object : public ObjBase<AdvanceFeature, typename Axis::Object, EmptyTypeList> {
+                SignedStepsType m_adv; // advance after the commands generated so far, in the positive direction
+                SignedStepsType m_staging_adv; // advance at the end of the committed commands
+            };
+        }
+        AMBRO_STRUCT_ELSE(AdvanceFeature) {
+            static void init (Context c) {}
+            static bool other_axes_moving (bool accum, Context c, Segment *entry)
+            {
+                TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
+                return accum || axis_entry->x.bitsValue() != 0;
+            }
+            static void write_segment (Context c, Segment *entry, FpType distance_rec) {}
+            static SignedStepsType target (Segment *entry, FpType v) { return 0; }
+            static void start_plan (Context c) {}
+            static void commit_point (Context c) {}
+            static void underrun (Context c) {}
+            template <typename TheMinTimeType, typename AType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AType a, SignedStepsType adv)
+            {
+                ShaperFeature::gen_command(c, dir, x, t, a);
+            }
+            struct Object {};
+        };
+        
+        // Input shaping: the motion of the axis is convolved with a train of
+        // impulses which cancels vibration at the configured frequency, that is,
+        // it is replaced by the weighted sum of the motion delayed by the time of
+        // each impulse. The commands are recorded in a history, and after each
+        // one the shaped motion is generated up to its end, as commands which end
+        // where any of the delayed commands begins or ends. Within such a command
+        // each delayed command has constant acceleration, so the shaped command is
+        // exact, up to rounding to whole steps, which is carried over to the next.
+        // At the end of the planned motion, the remaining shaped motion (the time
+        // of the last impulse) is generated into the backup.
+        // If the history fills up, the two adjacent commands with the fewest steps
+        // are merged into one at constant speed.
+        AMBRO_STRUCT_IF(ShaperFeature, ShaperParams::Enabled) {
+            struct Object;
+            
+            // The position within a piece is x0 + (v + a * u) * u, for u in [0, 1].
+            struct Piece {
+                TimeType start;
+                TimeType duration;
+                int32_t x0;
+                FpType v;
+                FpType a;
+            };
+            
+            struct State {
+                Piece pieces[ShaperHistorySize];
+                uint8_t count;
+                TimeType time; // end of the last piece
+                int32_t pos; // position at the end of the last piece
+                int32_t out_pos; // position at the end of the shaped commands generated
+            };
+            
+            static void init (Context c)
+            {
+                auto *o = Object::self(c);
+                reset(&o->m_state);
+                reset(&o->m_staging_state);
+            }
+            
+            static void reset (State *st)
+            {
+                st->count = 0;
+                st->time = 0;
+                st->pos = 0;
+                st->out_pos = 0;
+            }
+            
+            static void start_plan (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_state = o->m_staging_state;
+            }
+            
+            static void commit_point (Context c)
+            {
+                auto *o = Object::self(c);
+                o->m_staging_state = o->m_state;
+            }
+            
+            static void end_plan (Context c)
+            {
+                auto *o = Object::self(c);
+                State *st = &o->m_state;
+                emit(c, st, st->time, st->time + impulse_time(c, ShaperImpulses - 1));
+            }
+            
+            static void underrun (Context c)
+            {
+                auto *o = Object::self(c);
+                reset(&o->m_staging_state);
+            }
+            
+            template <typename TheMinTimeType, typename AType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AType a)
+            {
+                auto *o = Object::self(c);
+                State *st = &o->m_state;
+                
+                int32_t x_steps = dir ? (int32_t)x.bitsValue() : -(int32_t)x.bitsValue();
+                TimeType from = st->time;
+                
+                // Commands with no duration only move the position of the next one.
+                if (AMBRO_LIKELY(t.bitsValue() != 0)) {
+                    if (AMBRO_UNLIKELY(st->count == ShaperHistorySize)) {
+                        merge(st);
+                    }
+                    FpType a_steps = dir ? a.template fpValue<FpType>() : -a.template fpValue<FpType>();
+                    Piece *p = &st->pieces[st->count++];
+                    p->start = from;
+                    p->duration = t.bitsValue();
+                    p->x0 = st->pos;
+                    p->v = (FpType)x_steps - a_steps;
+                    p->a = a_steps;
+                }
+                st->time += t.bitsValue();
+                st->pos += x_steps;
+                
+                emit(c, st, from, st->time);
+                
+                // Drop the pieces which no impulse will reach any more.
+                TimeType max_delay = impulse_time(c, ShaperImpulses - 1);
+                int n = 0;
+                while (n < st->count && (TimeType)(st->time - (st->pieces[n].start + st->pieces[n].duration)) >= max_delay) {
+                    n++;
+                }
+                if (n > 0) {
+                    st->count -= n;
+                    for (int k = 0; k < st->count; k++) {
+                        st->pieces[k] = st->pieces[k + n];
+                    }
+                }
+            }
+            
+            static void emit (Context c, State *st, TimeType from, TimeType to)
+            {
+                FpType amp[ShaperImpulses];
+                amp[0] = 1.0f;
+                for (int i = 1; i < ShaperImpulses; i++) {
+                    amp[i] = (i == 1) ? APRINTER_CFG(Config, CShaperA1, c) : APRINTER_CFG(Config, CShaperA2, c);
+                    amp[0] -= amp[i];
+                }
+                
+                TimeType cur = from;
+                while (cur != to) {
+                    // The command ends at the first start or end of a piece delayed by any impulse.
+                    TimeType step = MinValue((TimeType)(to - cur), (TimeType)MinTimeType::maxValue().bitsValue());
+                    for (int i = 0; i < ShaperImpulses; i++) {
+                        TimeType q = cur - impulse_time(c, i);
+                        for (int k = 0; k <= st->count; k++) {
+                            TimeType b = (k < st->count) ? st->pieces[k].start : st->time;
+                            if (!TheClockUtils::timeGreaterOrEqual(q, b)) {
+                                step = MinValue(step, (TimeType)(b - q));
+                                break;
+                            }
+                        }
+                    }
+                    
+                    FpType x = 0.0f;
+                    FpType a = 0.0f;
+                    for (int i = 0; i < ShaperImpulses; i++) {
+                        FpType piece_a;
+                        x += amp[i] * eval(st, cur + step - impulse_time(c, i), step, st->out_pos, &piece_a);
+                        a += amp[i] * piece_a;
+                    }
+                    
+                    SignedStepsType cmd_x = FloatIntRound<SignedStepsType>(x);
+                    gen_signed_command(c, true, cmd_x, MinTimeType::importBits(step), a);
+                    st->out_pos += cmd_x;
+                    cur += step;
+                }
+            }
+            
+            // Returns the position at time t relative to ref. In *a returns the
+            // acceleration term for an interval of length len ending at t.
+            static FpType eval (State *st, TimeType t, TimeType len, int32_t ref, FpType *a)
+            {
+                for (int k = 0; k < st->count; k++) {
+                    Piece *p = &st->pieces[k];
+                    TimeType rel = t - p->start;
+                    if (rel != 0 && rel <= p->duration) {
+                        FpType duration_rec = 1.0f / (FpType)p->duration;
+                        FpType u = (FpType)rel * duration_rec;
+                        FpType w = (FpType)len * duration_rec;
+                        *a = p->a * w * w;
+                        return (FpType)(p->x0 - ref) + (p->v + p->a * u) * u;
+                    }
+                }
+                *a = 0.0f;
+                bool before = (st->count > 0 && TheClockUtils::timeGreaterOrEqual(st->pieces[0].start, t));
+                return (FpType)((before ? st->pieces[0].x0 : st->pos) - ref);
+            }
+            
+            static void merge (State *st)
+            {
+                int best = 0;
+                FpType best_x = 0.0f;
+                for (int k = 0; k < st->count - 1; k++) {
+                    FpType pair_x = FloatAbs(st->pieces[k].v + st->pieces[k].a) + FloatAbs(st->pieces[k + 1].v + st->pieces[k + 1].a);
+                    if (k == 0 || pair_x < best_x) {
+                        best = k;
+                        best_x = pair_x;
+                    }
+                }
+                Piece *p = &st->pieces[best];
+                int32_t end_x = (best + 2 < st->count) ? st->pieces[best + 2].x0 : st->pos;
+                p->duration += st->pieces[best + 1].duration;
+                p->v = (FpType)(end_x - p->x0);
+                p->a = 0.0f;
+                st->count--;
+                for (int k = best + 1; k < st->count; k++) {
+                    st->pieces[k] = st->pieces[k + 1];
+                }
+            }
+            
+            static TimeType impulse_time (Context c, int i)
+            {
+                return (i == 0) ? 0 : (i == 1) ? APRINTER_CFG(Config, CShaperT1Ticks, c) : APRINTER_CFG(Config, CShaperT2Ticks, c);
+            }
+            
+            // The impulses are at multiples of the damped period with amplitudes
+            // proportional to R * K^i, where K is the decay between them.
+            static int const Type = ShaperParams::ShaperType;
+            using R0 = APRINTER_FP_CONST_EXPR((Type == MotionPlannerShaperZV) ? 1.0 : (Type == MotionPlannerShaperMZV) ? 0.29289321881345 : 0.2625);
+            using R1 = APRINTER_FP_CONST_EXPR((Type == MotionPlannerShaperZV) ? 1.0 : (Type == MotionPlannerShaperMZV) ? 0.41421356237310 : 0.475);
+            using R2 = APRINTER_FP_CONST_EXPR((Type == MotionPlannerShaperZV) ? 0.0 : (Type == MotionPlannerShaperMZV) ? 0.29289321881345 : 0.2625);
+            using T1 = APRINTER_FP_CONST_EXPR((Type == MotionPlannerShaperMZV) ? 0.375 : 0.5);
+            using T2 = APRINTER_FP_CONST_EXPR((Type == MotionPlannerShaperZV) ? 0.0 : (Type == MotionPlannerShaperMZV) ? 0.75 : 1.0);
+            using DecayExponent = APRINTER_FP_CONST_EXPR(-3.14159265358979 * ((Type == MotionPlannerShaperMZV) ? 0.75 : 1.0));
+            using One = APRINTER_FP_CONST_EXPR(1.0);
+            
+            using DampingRatio = decltype(ShaperParams::DampingRatio::e());
+            using DampingFactor = decltype(ExprSqrt(One() - DampingRatio() * DampingRatio()));
+            using K = decltype(ExprExp(DecayExponent() * DampingRatio() / DampingFactor()));
+            using AmplitudeSum = decltype(R0() + R1() * K() + R2() * K() * K());
+            using DampedPeriodTicks = decltype(typename Constants::TimeConversion() / (ShaperParams::Frequency::e() * DampingFactor()));
+            
+            using CShaperA1 = decltype(ExprCast<FpType>(R1() * K() / AmplitudeSum()));
+            using CShaperA2 = decltype(ExprCast<FpType>(R2() * K() * K() / AmplitudeSum()));
+            using CShaperT1Ticks = decltype(ExprCast<TimeType>(T1() * DampedPeriodTicks()));
+            using CShaperT2Ticks = decltype(ExprCast<TimeType>(T2() * DampedPeriodTicks()));
+            
+            using ConfigExprs = MakeTypeList<CShaperA1, CShaperA2, CShaperT1Ticks, CShaperT2Ticks>;
+            
+            struct Object : public ObjBase<ShaperFeature, typename Axis::Object, EmptyTypeList> {
+                State m_state; // state after the commands generated so far
+                State m_staging_state; // state at the end of the committed commands
+            };
+        }
+        AMBRO_STRUCT_ELSE(ShaperFeature) {
+            static void init (Context c) {}
+            static void start_plan (Context c) {}
+            static void commit_point (Context c) {}
+            static void end_plan (Context c) {}
+            static void underrun (Context c) {}
+            template <typename TheMinTimeType, typename AType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AType a)
+            {
+                TheCommon::gen_stepper_command(c, dir, x, t, a);
+            }
+            struct Object {};
+        };
         
-        struct Object : public ObjBase<Axis, typename TheCommon::Object, EmptyTypeList> {
+        struct Object : public ObjBase<Axis, typename TheCommon::Object, MakeTypeList<
+            AdvanceFeature,
+            ShaperFeature,
+            SharedInterruptsFeature
+        >> {
+            // Direction of the previous segment along this axis, x by distance,
+            // or the component of the unit direction vector with junction deviation.
             FpType last_x_by_distance;
         };
     };
@@ -725,6 +1441,8 @@ public:
         using TheCommon = AxisCommon<Laser>;
         using TheStepper = TheLaserDriver;
         static bool const IsFirst = false;
+        static int const StepperCommandsPerSegment = CommandsPerSegment;
+        static int const StepperExtraCommands = 0;
         using TheLaserSegment = LaserSegment<LaserIndex>;
         static TimeType const AdjustmentIntervalTicks = LaserSpec::TheLaserDriverService::AdjustmentInterval::value() / Clock::time_unit;
         
@@ -874,7 +1592,7 @@ public:
     public: // private, workaround gcc bug
         static_assert(ChannelSpec::BufferSize - LookaheadCommitCount > 1, "");
         static const size_t ChannelCommitBufferSize = ChannelSpec::BufferSize;
-        static const size_t ChannelBackupBufferSize = LookaheadBufferSize - LookaheadCommitCount;
+        static const size_t ChannelBackupBufferSize = LookaheadBufferSize - MinCommitCount;
         using ChannelCommitBufferSizeType = ChooseIntForMax<ChannelCommitBufferSize, false>;
         using ChannelBackupBufferSizeType = ChooseIntForMax<2 * ChannelBackupBufferSize, false>;
         using LookaheadSizeType = ChooseIntForMax<LookaheadBufferSize, false>;
@@ -1061,6 +1779,30 @@ private:
     
     struct ComputeStateTuple : public Tuple<MapTypeList<AxisCommonList, GetMemberType_ComputeState>> {};
     
+    template <typename TheAxis, typename AccumValue>
+    using SharedInterruptsHelper = WrapBool<(AccumValue::Value || TheAxis::SharesInterrupts)>;
+    static bool const SharedInterrupts = TypeListFold<AxesList, WrapBool<false>, SharedInterruptsHelper>::Value;
+    
+    // Both limits on the sync step time of a segment from Axis::SharedInterruptsFeature
+    // hold, so the lower one is used. The reserved interrupt time has to leave some
+    // time for the steps, otherwise only the first applies.
+    AMBRO_STRUCT_IF(SharedInterruptsFeature, SharedInterrupts) {
+        static FpType sync_steps_time (Context c, Segment *entry, ComputeStateTuple const *cst, FpType shared_time)
+        {
+            FpType unshared_time = 0.0f;
+            FpType reserve = 0.0f;
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::SharedInterruptsFeature::add_interrupt_time(c, entry, cst, &unshared_time, &reserve)));
+            FpType time = shared_time + unshared_time;
+            if (reserve < 1.0f) {
+                time = FloatMin(time, shared_time / (1.0f - reserve));
+            }
+            return time;
+        }
+    }
+    AMBRO_STRUCT_ELSE(SharedInterruptsFeature) {
+        static FpType sync_steps_time (Context c, Segment *entry, ComputeStateTuple const *cst, FpType shared_time) { return shared_time; }
+    };
+    
 public:
     static void init (Context c, bool prestep_callback_enabled)
     {
@@ -1071,6 +1813,7 @@ public:
         o->m_segments_start = 0;
         o->m_segments_staging_length = 0;
         o->m_segments_length = 0;
+        o->m_segments_final_length = 0;
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
@@ -1078,6 +1821,11 @@ public:
         o->m_last_dir_and_type = 0;
         o->m_split_buffer.type = 0xFF;
         o->m_state = STATE_BUFFERING;
+        JunctionDeviationFeature::init(c);
+        LookaheadTimeFeature::init(c);
+        PlanSliceFeature::init(c);
+        FeedHoldFeature::init(c);
+        TelemetryFeature::init(c);
         o->m_waiting = false;
         o->m_aborted = false;
         o->m_syncing = false;
@@ -1089,6 +1837,7 @@ public:
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::init(c, prestep_callback_enabled)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::init(c)));
         Context::EventLoop::template triggerFastEvent<CallbackFastEvent>(c);
+        bench_init(c);
     }
     
     static void deinit (Context c)
@@ -1099,6 +1848,7 @@ public:
         ListForReverse<AxisCommonList>([&] APRINTER_TL(axis, axis::deinit(c)));
         Context::EventLoop::template resetFastEvent<CallbackFastEvent>(c);
         Context::EventLoop::template resetFastEvent<StepperFastEvent>(c);
+        LookaheadTimeFeature::deinit(c);
     }
     
     static SplitBuffer * getBuffer (Context c)
@@ -1180,6 +1930,29 @@ public:
         return Axis<AxisIndex>::template axis_count_aborted_rem_steps<StepsType>(c);
     }
     
+    // Multiplies the requested time (rel_max_v_rec) of all moves not yet
+    // committed by time_factor, including the move being split.
+    // The change takes effect with the next plan.
+    static void scaleNominalTime (Context c, FpType time_factor)
+    {
+        PlanSliceFeature::finish(c);
+        NominalSpeedScalingFeature::scale(c, time_factor);
+    }
+    
+    // Stops the motion as soon as possible while keeping the moves which
+    // are not reached yet, which are executed after feedResume().
+    static void feedHold (Context c)
+    {
+        PlanSliceFeature::finish(c);
+        FeedHoldFeature::hold(c);
+    }
+    
+    static void feedResume (Context c)
+    {
+        PlanSliceFeature::finish(c);
+        FeedHoldFeature::resume(c);
+    }
+    
 #ifdef AXISDRIVER_DETECT_OVERLOAD
     static bool axisOverloadOccurred (Context c)
     {
@@ -1221,80 +1994,289 @@ private:
 #endif
     }
     
+    // State of plan() which is kept while it yields, see PlanSliceFeature.
+    struct PlanState {
+        TimeType time;
+        TimeType commit_target_time;
+        FpType v;
+        FpType v_start;
+        SegmentBufferSizeType plan_length;
+        SegmentBufferSizeType final_length;
+        SegmentBufferSizeType commit_count;
+        SegmentBufferSizeType i;
+        bool forward;
+    };
+    
+    // Number of segments for which the results of pulling are converted together
+    // in plan(). Batches are enabled with MOTIONPLANNER_BATCH_PLAN, for comparing
+    // them in the benchmark; they are not used on AVR, which has no vector unit
+    // and little stack space. Otherwise plan() goes through the segments one by one.
+#if defined(MOTIONPLANNER_BATCH_PLAN) && !defined(AMBROLIB_AVR)
+    static int const PlanBatchSize = 8;
+    
+    struct PlanBatch {
+        FpType v[PlanBatchSize]; // squared end speeds
+        FpType v_end[PlanBatchSize + 1]; // end speeds, preceded by the start speed
+        FpType const_v[PlanBatchSize];
+        FpType v_const[PlanBatchSize];
+        FpType const_start[PlanBatchSize];
+        FpType const_end[PlanBatchSize];
+        FpType max_accel_rec[PlanBatchSize];
+        FpType rel_max_speed_rec[PlanBatchSize];
+        FpType t0_double[PlanBatchSize];
+        FpType t2_double[PlanBatchSize];
+        FpType t1_double[PlanBatchSize];
+    };
+    
+    // Pulls count segments starting at index i, from the squared speed in *v,
+    // and computes the speeds and the durations of the segment parts for them.
+    // Pulling is sequential, since each segment starts with the end speed of the
+    // previous one, but the rest is independent for each segment, and is done in
+    // loops over the whole batch which the compiler can vectorize, with unused
+    // entries filled in.
+    static void plan_batch (Context c, PlanBatch *b, SegmentBufferSizeType i, int count, FpType *v, FpType v_start)
+    {
+        auto *o = Object::self(c);
+        
+        uint32_t channel_mask = 0;
+        b->v_end[0] = v_start;
+        for (int k = 0; k < count; k++) {
+            SegmentBufferSizeType pos = segments_add(o->m_segments_start, i + k);
+            Segment *entry = &o->m_segments[pos];
+            if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
+                typename TheLinearPlanner::SegmentResult result;
+                *v = TheLinearPlanner::pull(&o->m_lp_push[pos], &entry->axes.lp_seg, &o->m_segment_state[pos], *v, &result);
+                b->const_v[k] = result.const_v;
+                b->const_start[k] = result.const_start;
+                b->const_end[k] = result.const_end;
+                b->max_accel_rec[k] = entry->axes.max_accel_rec;
+                b->rel_max_speed_rec[k] = entry->axes.rel_max_speed_rec;
+            } else {
+                b->const_v[k] = *v;
+                b->const_start[k] = 0.0f;
+                b->const_end[k] = 0.0f;
+                b->max_accel_rec[k] = 0.0f;
+                b->rel_max_speed_rec[k] = 0.0f;
+                channel_mask |= (uint32_t)1 << k;
+            }
+            b->v[k] = *v;
+        }
+        for (int k = count; k < PlanBatchSize; k++) {
+            b->v[k] = *v;
+            b->const_v[k] = *v;
+            b->const_start[k] = 0.0f;
+            b->const_end[k] = 0.0f;
+            b->max_accel_rec[k] = 0.0f;
+            b->rel_max_speed_rec[k] = 0.0f;
+        }
+        
+        for (int k = 0; k < PlanBatchSize; k++) {
+            b->v_end[k + 1] = FloatSqrt(b->v[k]);
+            b->v_const[k] = FloatSqrt(b->const_v[k]);
+        }
+        if (AMBRO_UNLIKELY(channel_mask != 0)) {
+            // Channel segments keep the speed of the previous segment.
+            for (int k = 0; k < count; k++) {
+                if ((channel_mask >> k) & 1) {
+                    b->v_end[k + 1] = b->v_end[k];
+                }
+            }
+        }
+        for (int k = 0; k < PlanBatchSize; k++) {
+            b->t0_double[k] = (b->v_const[k] - b->v_end[k]) * b->max_accel_rec[k];
+            b->t2_double[k] = (b->v_const[k] - b->v_end[k + 1]) * b->max_accel_rec[k];
+            b->t1_double[k] = (1.0f - b->const_start[k] - b->const_end[k]) * b->rel_max_speed_rec[k];
+        }
+    }
+#else
+    static int const PlanBatchSize = 1;
+#endif
+    
+    // Generates the commands for a pulled segment in the forward pass of plan(),
+    // given the speeds at its start, in the middle and at its end, and the
+    // durations of its parts, and advances *time past it.
+    AMBRO_ALWAYS_INLINE
+    static void plan_axes_segment (Context c, Segment *entry, FpType const_start, FpType const_end, FpType v_start, FpType v_const, FpType v_end,
+                                   FpType t0_double, FpType t2_double, FpType t1_double, TimeType *time)
+    {
+        MinTimeType t0 = MinTimeType::importFpSaturatedRound(t0_double);
+        MinTimeType t2 = MinTimeType::importFpSaturatedRound(t2_double);
+        MinTimeType t1 = MinTimeType::importFpSaturatedRound(t1_double);
+        auto t_sum = t0 + t2 + t1;
+        if (AMBRO_UNLIKELY(t_sum > MinTimeType::maxValue())) {
+            t1 = MinTimeType::maxValue();
+            t_sum = t1;
+            t0 = FixedMin(t1, t0);
+            t1.m_bits.m_int -= t0.bitsValue();
+            t2 = FixedMin(t1, t2);
+            t1.m_bits.m_int -= t2.bitsValue();
+        }
+        *time += t_sum.bitsValue();
+        FpType vdiff0 = v_const - v_start;
+        FpType vdiff2 = v_const - v_end;
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::gen_segment_stepper_commands(c, entry,
+                            const_start, const_end, t0, t2, t1,
+                            vdiff0 * vdiff0, vdiff2 * vdiff2, v_start, v_const, v_end)));
+        ListFor<LasersList>([&] APRINTER_TL(laser, laser::gen_segment_stepper_commands(c, entry,
+            t0, t2, t1, v_start, v_end, v_const)));
+    }
+    
+    // Called after each segment in the forward pass of plan(), with i segments
+    // done. If the plan is to be committed here, sets *commit_count to i and
+    // remembers the state at this point, with the end speed v_squared as given
+    // by the LinearPlanner and its square root v.
+    AMBRO_ALWAYS_INLINE
+    static void plan_commit_point (Context c, SegmentBufferSizeType i, SegmentBufferSizeType *commit_count, TimeType commit_target_time, TimeType time, FpType v_squared, FpType v)
+    {
+        auto *o = Object::self(c);
+        
+        if (AMBRO_UNLIKELY(i == *commit_count) || LookaheadTimeFeature::commit_target_reached(c, i, *commit_count, time, commit_target_time)) {
+            *commit_count = i;
+            // It's safe to update these here before committing the new plan,
+            // since in case of commit failure (loss of sync), plan() will
+            // not be called until we're back to buffering state.
+            // A plan which yields is completed before anything else looks
+            // at them, see PlanSliceFeature.
+            o->m_new_to_backup = true;
+            o->m_staging_time = time;
+            o->m_staging_v_squared = v_squared;
+            o->m_staging_v = v;
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::AdvanceFeature::commit_point(c)));
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::ShaperFeature::commit_point(c)));
+        }
+    }
+    
+    // Returns whether the plan was committed, that is, false also
+    // if plan() yielded, with the plan still in progress.
     static bool plan (Context c)
     {
         auto *o = Object::self(c);
+        SegmentBufferSizeType plan_length = FeedHoldFeature::plan_length(c);
         AMBRO_ASSERT(o->m_state != STATE_ABORTED)
-        AMBRO_ASSERT(o->m_segments_staging_length != o->m_segments_length)
+        AMBRO_ASSERT(!PlanSliceFeature::in_progress(c))
+        AMBRO_ASSERT(o->m_segments_staging_length != plan_length)
 #ifdef AMBROLIB_ASSERTIONS
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) { AMBRO_ASSERT(planner_have_commit_space(c)) }
 #endif
+        bench_plan_start(c);
+        TelemetryFeature::plan_start(c);
+        PlanSliceFeature::plan_start(c);
+        
+        PlanState local_state;
+        PlanState *st = PlanSliceFeature::plan_state(c, &local_state);
+        st->plan_length = plan_length;
+        st->final_length = o->m_segments_final_length;
+        st->i = plan_length;
+        st->v = 0.0f;
+        st->forward = false;
+        
+        return plan_work(c, st);
+    }
+    
+    static bool plan_work (Context c, PlanState *st)
+    {
+        auto *o = Object::self(c);
+        SegmentBufferSizeType plan_length = st->plan_length;
+        bench_slice_start(c);
+        TelemetryFeature::slice_start(c);
+        PlanSliceFeature::slice_start(c);
+        
+        if (!st->forward) {
+            // Backward pass. Segments before m_segments_final_length have been
+            // pushed with a start speed of the following segment which cannot
+            // change any more, so their states are still valid. This pass only
+            // uses m_lp_push, where channel segments pass the speed through
+            // unchanged.
+            SegmentBufferSizeType i = st->i;
+            SegmentBufferSizeType final_length = st->final_length;
+            FpType v = st->v;
+            do {
+                i--;
+                SegmentBufferSizeType pos = segments_add(o->m_segments_start, i);
+                v = TheLinearPlanner::push(&o->m_lp_push[pos], &o->m_segment_state[pos], v);
+                if (final_length == o->m_segments_final_length && TheLinearPlanner::startIsMax(&o->m_lp_push[pos], v)) {
+                    final_length = i;
+                }
+                if (AMBRO_UNLIKELY(i != o->m_segments_final_length && PlanSliceFeature::should_yield(c))) {
+                    st->i = i;
+                    st->final_length = final_length;
+                    st->v = v;
+                    return plan_yield(c);
+                }
+            } while (i != o->m_segments_final_length);
+            o->m_segments_final_length = final_length;
+            
+            st->commit_count = MinValue(plan_length, (SegmentBufferSizeType)LookaheadCommitCount);
+            st->commit_target_time = LookaheadTimeFeature::commit_target(c, &st->commit_count);
+            
+            o->m_new_to_backup = false;
+            ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_commands(c)));
+            ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_commands(c)));
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::AdvanceFeature::start_plan(c)));
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::ShaperFeature::start_plan(c)));
+            
+            st->time = o->m_staging_time;
+            st->v = FeedHoldFeature::start_v(c, o->m_staging_v_squared, v);
+            st->v_start = o->m_staging_v;
+            st->i = 0;
+            st->forward = true;
+        }
         
-        SegmentBufferSizeType i = o->m_segments_length;
-        FpType v = 0.0f;
-        do {
-            i--;
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
-            if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
-                v = TheLinearPlanner::push(&entry->axes.lp_seg, &o->m_segment_state[i], v);
-            }
-        } while (i != 0);
-        
-        SegmentBufferSizeType commit_count = MinValue(o->m_segments_length, (SegmentBufferSizeType)LookaheadCommitCount);
-        
-        o->m_new_to_backup = false;
-        ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_commands(c)));
-        ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_commands(c)));
-        
-        TimeType time = o->m_staging_time;
-        v = o->m_staging_v_squared;
-        FpType v_start = o->m_staging_v;
+        SegmentBufferSizeType i = st->i;
+        SegmentBufferSizeType commit_count = st->commit_count;
+        TimeType commit_target_time = st->commit_target_time;
+        TimeType time = st->time;
+        FpType v = st->v;
+        FpType v_start = st->v_start;
         
         do {
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
+#if defined(MOTIONPLANNER_BATCH_PLAN) && !defined(AMBROLIB_AVR)
+            PlanBatch b;
+            int count = MinValue((SegmentBufferSizeType)PlanBatchSize, (SegmentBufferSizeType)(plan_length - i));
+            plan_batch(c, &b, i, count, &v, v_start);
+            for (int k = 0; k < count; k++) {
+                Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
+                if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
+                    plan_axes_segment(c, entry, b.const_start[k], b.const_end[k], b.v_end[k], b.v_const[k], b.v_end[k + 1],
+                                      b.t0_double[k], b.t2_double[k], b.t1_double[k], &time);
+                } else {
+                    ListForOne<ChannelsList, 1>((entry->dir_and_type & TypeMask), [&] APRINTER_TL(channel, channel::gen_command(c, entry, time)));
+                }
+                i++;
+                plan_commit_point(c, i, &commit_count, commit_target_time, time, b.v[k], b.v_end[k + 1]);
+            }
+            v_start = b.v_end[count];
+#else
+            SegmentBufferSizeType pos = segments_add(o->m_segments_start, i);
+            Segment *entry = &o->m_segments[pos];
             if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
                 typename TheLinearPlanner::SegmentResult result;
-                v = TheLinearPlanner::pull(&entry->axes.lp_seg, &o->m_segment_state[i], v, &result);
+                v = TheLinearPlanner::pull(&o->m_lp_push[pos], &entry->axes.lp_seg, &o->m_segment_state[pos], v, &result);
                 FpType v_end = FloatSqrt(v);
                 FpType v_const = FloatSqrt(result.const_v);
-                FpType vdiff0 = v_const - v_start;
-                FpType vdiff2 = v_const - v_end;
-                FpType t0_double = vdiff0 * entry->axes.max_accel_rec;
-                MinTimeType t0 = MinTimeType::importFpSaturatedRound(t0_double);
-                FpType t2_double = vdiff2 * entry->axes.max_accel_rec;
-                MinTimeType t2 = MinTimeType::importFpSaturatedRound(t2_double);
+                FpType t0_double = (v_const - v_start) * entry->axes.max_accel_rec;
+                FpType t2_double = (v_const - v_end) * entry->axes.max_accel_rec;
                 FpType t1_double = (1.0f - result.const_start - result.const_end) * entry->axes.rel_max_speed_rec;
-                MinTimeType t1 = MinTimeType::importFpSaturatedRound(t1_double);
-                auto t_sum = t0 + t2 + t1;
-                if (AMBRO_UNLIKELY(t_sum > MinTimeType::maxValue())) {
-                    t1 = MinTimeType::maxValue();
-                    t_sum = t1;
-                    t0 = FixedMin(t1, t0);
-                    t1.m_bits.m_int -= t0.bitsValue();
-                    t2 = FixedMin(t1, t2);
-                    t1.m_bits.m_int -= t2.bitsValue();
-                }
-                time += t_sum.bitsValue();
-                ListFor<AxesList>([&] APRINTER_TL(axis, axis::gen_segment_stepper_commands(c, entry,
-                                    result.const_start, result.const_end, t0, t2, t1,
-                                    vdiff0 * vdiff0, vdiff2 * vdiff2)));
-                ListFor<LasersList>([&] APRINTER_TL(laser, laser::gen_segment_stepper_commands(c, entry,
-                    t0, t2, t1, v_start, v_end, v_const)));
+                plan_axes_segment(c, entry, result.const_start, result.const_end, v_start, v_const, v_end,
+                                  t0_double, t2_double, t1_double, &time);
                 v_start = v_end;
             } else {
                 ListForOne<ChannelsList, 1>((entry->dir_and_type & TypeMask), [&] APRINTER_TL(channel, channel::gen_command(c, entry, time)));
             }
             i++;
-            if (AMBRO_UNLIKELY(i == commit_count)) {
-                // It's safe to update these here before committing the new plan,
-                // since in case of commit failure (loss of sync), plan() will
-                // not be called until we're back to buffering state.
-                o->m_new_to_backup = true;
-                o->m_staging_time = time;
-                o->m_staging_v_squared = v;
-                o->m_staging_v = v_start;
+            plan_commit_point(c, i, &commit_count, commit_target_time, time, v, v_start);
+#endif
+            if (AMBRO_UNLIKELY(i != plan_length && PlanSliceFeature::should_yield(c))) {
+                st->i = i;
+                st->commit_count = commit_count;
+                st->time = time;
+                st->v = v;
+                st->v_start = v_start;
+                return plan_yield(c);
             }
-        } while (i != o->m_segments_length);
+        } while (i != plan_length);
+        
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::ShaperFeature::end_plan(c)));
         
         bool ok;
         if (AMBRO_UNLIKELY(o->m_state == STATE_BUFFERING)) {
@@ -1313,17 +2295,32 @@ private:
             }
         }
         
+        PlanSliceFeature::plan_end(c);
         if (AMBRO_LIKELY(ok)) {
             o->m_segments_start = segments_add(o->m_segments_start, commit_count);
             o->m_segments_length -= commit_count;
-            o->m_segments_staging_length = o->m_segments_length;
+            o->m_segments_staging_length = plan_length - commit_count;
+            o->m_segments_final_length -= MinValue(o->m_segments_final_length, commit_count);
+            FeedHoldFeature::committed(c, commit_count);
 #ifdef AMBROLIB_ASSERTIONS
             o->m_planned = true;
 #endif
         }
+        TelemetryFeature::slice_end(c);
+        TelemetryFeature::plan_end(c, ok ? commit_count : 0);
+        bench_slice_end(c);
+        bench_plan_end(c, ok ? commit_count : 0);
         return ok;
     }
     
+    static bool plan_yield (Context c)
+    {
+        TelemetryFeature::slice_end(c);
+        bench_slice_end(c);
+        Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+        return false;
+    }
+    
     static void planner_start_stepping (Context c)
     {
         auto *o = Object::self(c);
@@ -1334,6 +2331,7 @@ private:
         o->m_state = STATE_STEPPING;
         TimeType start_time = Clock::getTime(c) + (TimeType)(0.05 * Context::Clock::time_freq);
         o->m_staging_time += start_time;
+        TelemetryFeature::stepping_started(c, start_time);
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_stepping(c, start_time)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_stepping(c, start_time)));
     }
@@ -1395,20 +2393,41 @@ private:
             
             if (AMBRO_UNLIKELY(!busy)) {
                 recover_from_underrun(c);
-            }
-        }
-        
+            } else if (AMBRO_UNLIKELY(PlanSliceFeature::in_progress(c))) {
+                return PlanSliceFeature::resume(c);
+            } else if (LookaheadTimeFeature::starved_below_target(c) || FeedHoldFeature::plan_pending(c)) {
+                bool cleared;
+                AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+                    cleared = o->m_syncing && planner_have_commit_space(c);
+                }
+                if (cleared) {
+                    plan(c);
+                    if (AMBRO_UNLIKELY(PlanSliceFeature::in_progress(c))) {
+                        return;
+                    }
+                }
+            }
+        } else if (AMBRO_UNLIKELY(PlanSliceFeature::in_progress(c))) {
+            return PlanSliceFeature::resume(c);
+        }
+        
         if (AMBRO_UNLIKELY(o->m_waiting)) {
             if (AMBRO_UNLIKELY(o->m_state == STATE_BUFFERING)) {
                 if (o->m_segments_length == 0) {
                     Context::EventLoop::template triggerFastEvent<CallbackFastEvent>(c);
                     return;
                 }
+                if (AMBRO_UNLIKELY(FeedHoldFeature::is_holding(c))) {
+                    return;
+                }
                 if (o->m_segments_staging_length != o->m_segments_length && planner_have_commit_space(c)) {
                     plan(c);
+                    if (AMBRO_UNLIKELY(PlanSliceFeature::in_progress(c))) {
+                        return;
+                    }
                 }
                 planner_start_stepping(c);
-            } else if (o->m_segments_staging_length != o->m_segments_length) {
+            } else if (o->m_segments_staging_length != FeedHoldFeature::plan_length(c)) {
                 bool cleared;
                 AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
                     cleared = o->m_syncing && planner_have_commit_space(c);
@@ -1422,6 +2441,9 @@ private:
         
         while (1) {
             if (AMBRO_LIKELY(o->m_segments_length == LookaheadBufferSize)) {
+                if (AMBRO_UNLIKELY(FeedHoldFeature::is_holding(c) && !FeedHoldFeature::plan_pending(c))) {
+                    return;
+                }
                 if (AMBRO_UNLIKELY(o->m_state == STATE_BUFFERING)) {
                     if (AMBRO_UNLIKELY(!planner_have_commit_space(c))) {
                         planner_start_stepping(c);
@@ -1432,7 +2454,7 @@ private:
                     AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
                         cleared = o->m_syncing && planner_have_commit_space(c);
                     }
-                    if (AMBRO_UNLIKELY(!cleared)) {
+                    if (AMBRO_UNLIKELY(!cleared) || LookaheadTimeFeature::delay_plan(c)) {
                         return;
                     }
                 }
@@ -1458,6 +2480,7 @@ private:
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::abort(c)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::abort(c)));
         Context::EventLoop::template resetFastEvent<StepperFastEvent>(c);
+        PlanSliceFeature::cancel(c);
         o->m_state = STATE_ABORTED;
         Context::EventLoop::template resetFastEvent<CallbackFastEvent>(c);
         return AbortedHandler::call(c);
@@ -1469,16 +2492,29 @@ private:
         AMBRO_ASSERT(o->m_state == STATE_STEPPING)
         AMBRO_ASSERT(!o->m_syncing)
         
+        PlanSliceFeature::cancel(c);
         o->m_state = STATE_BUFFERING;
         o->m_segments_start = segments_add(o->m_segments_start, o->m_segments_staging_length);
         o->m_segments_length -= o->m_segments_staging_length;
+        o->m_segments_final_length -= MinValue(o->m_segments_final_length, o->m_segments_staging_length);
         o->m_segments_staging_length = 0;
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::AdvanceFeature::underrun(c)));
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::ShaperFeature::underrun(c)));
 #ifdef AMBROLIB_ASSERTIONS
         o->m_planned = false;
 #endif
+        if (AMBRO_UNLIKELY(FeedHoldFeature::is_holding(c))) {
+            // Stopped for a feed hold, not an underrun.
+            FeedHoldFeature::stopped(c);
+            return;
+        }
+#ifdef MOTIONPLANNER_BENCHMARK
+        bench()->underruns++;
+#endif
+        TelemetryFeature::underrun(c);
         UnderrunCallback::call(c);
     }
     
@@ -1489,7 +2525,8 @@ private:
         AMBRO_ASSERT(o->m_split_buffer.type != 0xFF)
         AMBRO_ASSERT(o->m_split_buffer.type != 0 || o->m_split_buffer.axes.split_pos < o->m_split_buffer.axes.split_count)
         
-        Segment *entry = &o->m_segments[segments_add(o->m_segments_start, o->m_segments_length)];
+        SegmentBufferSizeType pos = segments_add(o->m_segments_start, o->m_segments_length);
+        Segment *entry = &o->m_segments[pos];
         entry->dir_and_type = o->m_split_buffer.type;
         
         if (AMBRO_LIKELY(o->m_split_buffer.type == 0)) {
@@ -1502,8 +2539,9 @@ private:
             FpType sync_steps_time = 0.0f;
             FpType async_steps_time = APRINTER_CFG(Config, CMinSegmentTime, c); // ensure a minimum duration even in absence of any axes
             ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::compute_steps_time(c, entry, &cst, &sync_steps_time, &async_steps_time)));
-            FpType base_rel_max_speed = FloatMax(o->m_split_buffer.axes.rel_max_v_rec, FloatMax(sync_steps_time, async_steps_time));
-            entry->axes.rel_max_speed_rec = ListForFold<AxisCommonList>(base_rel_max_speed, [&] APRINTER_TLA(axis, (FpType accum), return axis::compute_segment_buffer_entry_speed(accum, c, entry, &cst)));
+            sync_steps_time = SharedInterruptsFeature::sync_steps_time(c, entry, &cst, sync_steps_time);
+            FpType limit_rel_max_speed = ListForFold<AxisCommonList>(FloatMax(sync_steps_time, async_steps_time), [&] APRINTER_TLA(axis, (FpType accum), return axis::compute_segment_buffer_entry_speed(accum, c, entry, &cst)));
+            entry->axes.rel_max_speed_rec = FloatMax(o->m_split_buffer.axes.rel_max_v_rec, limit_rel_max_speed);
             
             FpType distance = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_segment_buffer_entry_distance(accum, c, &cst)));
             bool degenerate = (distance == 0.0f);
@@ -1514,36 +2552,696 @@ private:
             
             ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_segment_buffer_entry_extra(c, entry, distance_rec)));
             
+            bool other_axes_moving = ListForFold<AxesList>(false, [&] APRINTER_TLA(axis, (bool accum), return axis::AdvanceFeature::other_axes_moving(accum, c, entry)));
+            FpType advance_distance_rec = other_axes_moving ? distance_rec : 0.0f;
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::AdvanceFeature::write_segment(c, entry, advance_distance_rec)));
+            
             FpType rel_max_accel_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_segment_buffer_entry_accel(accum, c, &cst)));
+            rel_max_accel_rec *= (FpType)SCurvePeakAccelFactor;
             entry->axes.max_accel_rec = rel_max_accel_rec * distance_rec;
             FpType half_rel_max_accel = 0.5f / rel_max_accel_rec;
             
             FpType distance_rec_for_junction = AMBRO_UNLIKELY(degenerate) ? NAN : distance_rec;
-            FpType junction_max_v_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::do_junction_limit(accum, c, entry, distance_rec_for_junction, &cst)));
+            FpType junction_max_v_rec = JunctionDeviationFeature::junction_max_v_rec(c, entry, distance_rec_for_junction, &cst);
             FpType junction_max_start_v = AMBRO_UNLIKELY(FloatIsNan(junction_max_v_rec)) ? 0.0f : (1.0f / junction_max_v_rec);
             o->m_last_dir_and_type = entry->dir_and_type;
             
             FpType distance_squared = distance * distance;
             FpType max_v = distance_squared / (entry->axes.rel_max_speed_rec * entry->axes.rel_max_speed_rec);
             FpType a_x = FloatLdexp(half_rel_max_accel * distance_squared, 2);
-            TheLinearPlanner::initSegment(&entry->axes.lp_seg, o->m_last_max_v, junction_max_start_v, max_v, a_x);
+            TheLinearPlanner::initSegment(&o->m_lp_push[pos], &entry->axes.lp_seg, o->m_last_max_v, junction_max_start_v, max_v, a_x);
             o->m_last_max_v = max_v;
+            NominalSpeedScalingFeature::write_segment(c, entry, limit_rel_max_speed, distance_squared, junction_max_start_v);
             
             if (AMBRO_LIKELY(o->m_split_buffer.axes.split_pos == o->m_split_buffer.axes.split_count)) {
                 o->m_split_buffer.type = 0xFF;
             }
         } else {
             ListForOne<ChannelsList, 1>((entry->dir_and_type & TypeMask), [&] APRINTER_TL(channel, channel::write_segment(c, entry)));
+            TheLinearPlanner::initPassSegment(&o->m_lp_push[pos]);
             o->m_split_buffer.type = 0xFF;
         }
         
         o->m_segments_length++;
+#ifdef MOTIONPLANNER_BENCHMARK
+        bench()->segments++;
+#endif
         
         if (AMBRO_LIKELY(o->m_split_buffer.type == 0xFF)) {
             Context::EventLoop::template triggerFastEvent<CallbackFastEvent>(c);
         }
     }
     
+    AMBRO_STRUCT_IF(JunctionDeviationFeature, JunctionDeviationParams::Enabled) {
+        struct Object;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_last_dir_norm_sq = 0.0f;
+        }
+        
+        // Junction deviation: the junction speed is the speed at which a circular arc
+        // tangent to both segments, which deviates from the corner by JunctionDeviation,
+        // could be followed with the maximum acceleration in the direction of the velocity
+        // change. Directions are taken in the space of steps scaled by distance factors.
+        // The result is converted to planner speed units using the larger of the ratios
+        // of Euclidean distance to planner distance of the two segments.
+        template <typename TheComputeStateTuple>
+        static FpType junction_max_v_rec (Context c, Segment *entry, FpType distance_rec, TheComputeStateTuple const *cst)
+        {
+            auto *o = Object::self(c);
+            
+            FpType norm_sq = ListForFold<AxesList>((FpType)0.0f, [&] APRINTER_TLA(axis, (FpType accum), return axis::junction_dir_norm_sq(accum, c, cst)));
+            FpType norm_rec = 1.0f / FloatSqrt(norm_sq);
+            
+            FpType j_sq = 0.0f;
+            FpType j_accel_rec = 0.0f;
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::junction_dir_update(c, entry, norm_rec, cst, &j_sq, &j_accel_rec)));
+            
+            FpType dir_norm_sq = norm_sq * (distance_rec * distance_rec);
+            FpType max_dir_norm_sq = FloatMax(dir_norm_sq, o->m_last_dir_norm_sq);
+            o->m_last_dir_norm_sq = dir_norm_sq;
+            
+            // With unit direction vectors, |j|^2 = 4 - 4 sin(theta/2)^2, theta being
+            // the angle between the reversed previous direction and the new direction.
+            // The acceleration limit is j_accel_rec / |j|, and 1 - sin(theta/2) is
+            // computed as (|j|^2 / 4) / (1 + sin(theta/2)) for accuracy with small |j|.
+            FpType sin_theta_d2 = FloatSqrt(FloatMax((FpType)0.0f, (FpType)(1.0f - 0.25f * j_sq)));
+            return j_accel_rec * FloatSqrt(j_sq) * max_dir_norm_sq * APRINTER_CFG(Config, CJunctionDeviationRec, c) / (4.0f * (1.0f + sin_theta_d2) * sin_theta_d2);
+        }
+        
+        using CJunctionDeviationRec = decltype(ExprCast<FpType>(ExprRec(JunctionDeviationParams::JunctionDeviation::e())));
+        
+        using ConfigExprs = MakeTypeList<CJunctionDeviationRec>;
+        
+        struct Object : public ObjBase<JunctionDeviationFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            FpType m_last_dir_norm_sq;
+        };
+    }
+    AMBRO_STRUCT_ELSE(JunctionDeviationFeature) {
+        static void init (Context c) {}
+        
+        template <typename TheComputeStateTuple>
+        static FpType junction_max_v_rec (Context c, Segment *entry, FpType distance_rec, TheComputeStateTuple const *cst)
+        {
+            return ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::do_junction_limit(accum, c, entry, distance_rec, cst)));
+        }
+        
+        struct Object {};
+    };
+    
+    // Nominal speed scaling (real-time speed override): the requested and the
+    // limiting parts of the maximum speed of segments are stored separately, so
+    // that the requested part can be changed for the segments in the lookahead.
+    // The segments are then planned again from the committed motion. Where the
+    // speed is lowered below the speed at the end of the committed motion,
+    // the maximum speeds are kept at what is reachable by decelerating from
+    // it, so that the new limit is reached as soon as possible.
+    AMBRO_STRUCT_IF(NominalSpeedScalingFeature, NominalSpeedScaling) {
+        static void write_segment (Context c, Segment *entry, FpType limit_rel_max_speed, FpType distance_squared, FpType junction_max_start_v)
+        {
+            auto *o = Object::self(c);
+            entry->axes.nominal_rel_max_speed_rec = o->m_split_buffer.axes.rel_max_v_rec;
+            entry->axes.limit_rel_max_speed_rec = limit_rel_max_speed;
+            entry->axes.distance_squared = distance_squared;
+            entry->axes.junction_max_start_v = junction_max_start_v;
+        }
+        
+        static void scale (Context c, FpType time_factor)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(FloatIsPosOrPosZero(time_factor))
+            
+            if (AMBRO_UNLIKELY(o->m_state == STATE_ABORTED)) {
+                return;
+            }
+            
+            if (o->m_split_buffer.type == 0) {
+                o->m_split_buffer.axes.rel_max_v_rec *= time_factor;
+            }
+            
+            // Lowest speed which each segment can start with, given the
+            // speed at the end of the committed motion.
+            FpType min_v = o->m_staging_v_squared;
+            FpType prev_max_v = INFINITY;
+            bool have_axes_segment = false;
+            
+            for (SegmentBufferSizeType i = 0; i < o->m_segments_length; i++) {
+                SegmentBufferSizeType pos = segments_add(o->m_segments_start, i);
+                Segment *entry = &o->m_segments[pos];
+                if ((entry->dir_and_type & TypeMask) != 0) {
+                    continue;
+                }
+                typename TheLinearPlanner::SegmentPushData *lp_push = &o->m_lp_push[pos];
+                entry->axes.nominal_rel_max_speed_rec *= time_factor;
+                FpType rel_max_speed_rec = FloatMax(entry->axes.nominal_rel_max_speed_rec, entry->axes.limit_rel_max_speed_rec);
+                FpType max_v = entry->axes.distance_squared / (rel_max_speed_rec * rel_max_speed_rec);
+                if (AMBRO_UNLIKELY(max_v < min_v)) {
+                    max_v = min_v;
+                    rel_max_speed_rec = FloatSqrt(entry->axes.distance_squared / max_v);
+                }
+                entry->axes.rel_max_speed_rec = rel_max_speed_rec;
+                entry->axes.lp_seg.max_v = max_v;
+                lp_push->max_start_v = FloatMax(min_v, FloatMin(prev_max_v, FloatMin(entry->axes.junction_max_start_v, max_v)));
+                min_v = FloatMax((FpType)0.0f, min_v - lp_push->a_x);
+                prev_max_v = max_v;
+                have_axes_segment = true;
+            }
+            
+            if (have_axes_segment) {
+                o->m_last_max_v = prev_max_v;
+            }
+            o->m_segments_final_length = 0;
+        }
+    }
+    AMBRO_STRUCT_ELSE(NominalSpeedScalingFeature) {
+        static void write_segment (Context c, Segment *entry, FpType limit_rel_max_speed, FpType distance_squared, FpType junction_max_start_v) {}
+        static void scale (Context c, FpType time_factor) {}
+    };
+    
+    // Feed hold. The segments are planned as if the buffer ended at the first
+    // segment boundary where the motion can stop, decelerating at the maximum
+    // rate from the end of the committed motion (but not later than where the
+    // current plan stops), and nothing beyond it is planned until the hold is
+    // released. When the hold is requested before stepping has started, the
+    // planner just does not start.
+    AMBRO_STRUCT_IF(FeedHoldFeature, FeedHold) {
+        struct Object;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_holding = false;
+            o->m_hold_length = 0;
+        }
+        
+        static void hold (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            
+            if (AMBRO_UNLIKELY(m->m_state == STATE_ABORTED) || o->m_holding) {
+                return;
+            }
+            
+            SegmentBufferSizeType i = 0;
+            if (m->m_state == STATE_STEPPING && m->m_segments_staging_length > 0) {
+                FpType v = m->m_staging_v_squared;
+                do {
+                    v -= m->m_lp_push[segments_add(m->m_segments_start, i)].a_x;
+                    i++;
+                } while (v > 0.0f && i < m->m_segments_staging_length);
+            }
+            
+            o->m_holding = true;
+            o->m_hold_length = i;
+            m->m_segments_final_length = 0;
+            Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+        }
+        
+        static void resume (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            
+            if (!o->m_holding) {
+                return;
+            }
+            
+            o->m_holding = false;
+            m->m_segments_final_length = 0;
+            if (m->m_state != STATE_ABORTED) {
+                Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+            }
+        }
+        
+        static bool is_holding (Context c)
+        {
+            auto *o = Object::self(c);
+            return o->m_holding;
+        }
+        
+        static bool plan_pending (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            return o->m_holding && m->m_state == STATE_STEPPING && m->m_segments_staging_length != o->m_hold_length;
+        }
+        
+        static SegmentBufferSizeType plan_length (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            return o->m_holding ? o->m_hold_length : m->m_segments_length;
+        }
+        
+        // The stop point is found by subtracting, and the plan by adding, so the
+        // start speed of the plan may exceed the staging speed by rounding.
+        static FpType start_v (Context c, FpType staging_v, FpType planned_start_v)
+        {
+            auto *o = Object::self(c);
+            return o->m_holding ? FloatMin(staging_v, planned_start_v) : staging_v;
+        }
+        
+        static void committed (Context c, SegmentBufferSizeType commit_count)
+        {
+            auto *o = Object::self(c);
+            if (o->m_holding) {
+                o->m_hold_length -= commit_count;
+            }
+        }
+        
+        static void stopped (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_hold_length = 0;
+        }
+        
+        struct Object : public ObjBase<FeedHoldFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            bool m_holding;
+            SegmentBufferSizeType m_hold_length;
+        };
+    }
+    AMBRO_STRUCT_ELSE(FeedHoldFeature) {
+        static void init (Context c) {}
+        static void hold (Context c) {}
+        static void resume (Context c) {}
+        static bool is_holding (Context c) { return false; }
+        static bool plan_pending (Context c) { return false; }
+        static SegmentBufferSizeType plan_length (Context c) { return MotionPlanner::Object::self(c)->m_segments_length; }
+        static FpType start_v (Context c, FpType staging_v, FpType planned_start_v) { return staging_v; }
+        static void committed (Context c, SegmentBufferSizeType commit_count) {}
+        static void stopped (Context c) {}
+        struct Object {};
+    };
+    
+    // Whether the plan is to end with the segments planned, that is, when
+    // waiting for the end of motion or stopping for a feed hold.
+    static bool planning_to_stop (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->m_waiting || FeedHoldFeature::is_holding(c);
+    }
+    
+    // Time-based lookahead. A plan commits only as many segments as are needed for the
+    // committed motion to reach TargetTime ahead of the current time, at most LookaheadCommitCount;
+    // the backup buffers are sized for a commit of a single segment. Additionally, when the
+    // planner is starved for input and the committed motion falls below the target, new
+    // segments are planned without waiting for the lookahead buffer to fill up, leaving at
+    // least one segment uncommitted. With a full lookahead buffer, planning is delayed
+    // while the committed motion reaches beyond the target, so that it stays close to the
+    // target and the uncommitted segments can still be changed (e.g. by a feed hold).
+    // Not applied when waiting for the end of motion or stopping for a feed hold.
+    AMBRO_STRUCT_IF(LookaheadTimeFeature, LookaheadTimeParams::Enabled) {
+        static TimeType commit_target (Context c, SegmentBufferSizeType *commit_count)
+        {
+            auto *o = MotionPlanner::Object::self(c);
+            TimeType ref_time = 0;
+            if (!planning_to_stop(c)) {
+                *commit_count = MinValue(*commit_count, (SegmentBufferSizeType)(o->m_segments_length - 1));
+                if (o->m_state == STATE_STEPPING) {
+                    ref_time = Clock::getTime(c);
+                }
+            }
+            return ref_time + APRINTER_CFG(Config, CTargetTimeTicks, c);
+        }
+        
+        static bool commit_target_reached (Context c, SegmentBufferSizeType i, SegmentBufferSizeType commit_count, TimeType time, TimeType target_time)
+        {
+            return !planning_to_stop(c) && i < commit_count && TheClockUtils::timeGreaterOrEqual(time, target_time);
+        }
+        
+        static bool starved_below_target (Context c)
+        {
+            auto *o = MotionPlanner::Object::self(c);
+            AMBRO_ASSERT(o->m_state == STATE_STEPPING)
+            return !planning_to_stop(c) && o->m_split_buffer.type == 0xFF && o->m_segments_length >= 2 &&
+                   o->m_segments_staging_length != o->m_segments_length &&
+                   !TheClockUtils::timeGreaterOrEqual(o->m_staging_time, Clock::getTime(c) + APRINTER_CFG(Config, CTargetTimeTicks, c));
+        }
+        
+        static bool delay_plan (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            AMBRO_ASSERT(m->m_state == STATE_STEPPING)
+            if (planning_to_stop(c)) {
+                return false;
+            }
+            TimeType plan_time = m->m_staging_time - APRINTER_CFG(Config, CTargetTimeTicks, c);
+            if (TheClockUtils::timeGreaterOrEqual(Clock::getTime(c), plan_time)) {
+                return false;
+            }
+            o->m_plan_timer.appendAt(c, plan_time);
+            return true;
+        }
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_plan_timer.init(c, APRINTER_CB_STATFUNC_T(&LookaheadTimeFeature::plan_timer_handler));
+        }
+        
+        static void deinit (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_plan_timer.deinit(c);
+        }
+        
+        static void plan_timer_handler (Context c)
+        {
+            auto *m = MotionPlanner::Object::self(c);
+            if (m->m_state == STATE_STEPPING) {
+                Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+            }
+        }
+        
+        using CTargetTimeTicks = decltype(ExprCast<TimeType>(LookaheadTimeParams::TargetTime::e() * typename Constants::TimeConversion()));
+        
+        using ConfigExprs = MakeTypeList<CTargetTimeTicks>;
+        
+        struct Object : public ObjBase<LookaheadTimeFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            typename Context::EventLoop::TimedEvent m_plan_timer;
+        };
+    }
+    AMBRO_STRUCT_ELSE(LookaheadTimeFeature) {
+        static TimeType commit_target (Context c, SegmentBufferSizeType *commit_count) { return 0; }
+        static bool commit_target_reached (Context c, SegmentBufferSizeType i, SegmentBufferSizeType commit_count, TimeType time, TimeType target_time) { return false; }
+        static bool starved_below_target (Context c) { return false; }
+        static bool delay_plan (Context c) { return false; }
+        static void init (Context c) {}
+        static void deinit (Context c) {}
+        struct Object {};
+    };
+    
+    // Time-sliced planning. After TimeSlice of work on a plan(), it saves its state
+    // and yields to other events, continuing from the stepper event, so that long
+    // lookahead buffers do not delay the other events by the whole plan. It does not
+    // yield while stepping if the committed motion would end within DeadlineMargin,
+    // finishing the plan before the steppers need it. While a plan is in progress,
+    // no segments are added to the lookahead, and requests which change the planned
+    // segments (speed scaling, feed hold) first finish it without yielding.
+    AMBRO_STRUCT_IF(PlanSliceFeature, PlanSliceParams::Enabled) {
+        struct Object;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_in_progress = false;
+            o->m_finishing = false;
+        }
+        
+        static bool in_progress (Context c)
+        {
+            auto *o = Object::self(c);
+            return o->m_in_progress;
+        }
+        
+        static PlanState * plan_state (Context c, PlanState *local_state)
+        {
+            auto *o = Object::self(c);
+            return &o->m_plan_state;
+        }
+        
+        static void plan_start (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            o->m_in_progress = true;
+            o->m_deadline = m->m_staging_time;
+        }
+        
+        static void slice_start (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_slice_end = Clock::getTime(c) + APRINTER_CFG(Config, CTimeSliceTicks, c);
+        }
+        
+        static bool should_yield (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            TimeType now = Clock::getTime(c);
+            return !o->m_finishing && TheClockUtils::timeGreaterOrEqual(now, o->m_slice_end) &&
+                   (m->m_state == STATE_BUFFERING || !TheClockUtils::timeGreaterOrEqual((TimeType)(now + APRINTER_CFG(Config, CDeadlineMarginTicks, c)), o->m_deadline));
+        }
+        
+        static void plan_end (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_in_progress = false;
+        }
+        
+        static void resume (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->m_in_progress)
+            
+            plan_work(c, &o->m_plan_state);
+            Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+        }
+        
+        static void finish (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->m_in_progress) {
+                o->m_finishing = true;
+                plan_work(c, &o->m_plan_state);
+                o->m_finishing = false;
+                AMBRO_ASSERT(!o->m_in_progress)
+                Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
+            }
+        }
+        
+        static void cancel (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_in_progress = false;
+        }
+        
+        using CTimeSliceTicks = decltype(ExprCast<TimeType>(PlanSliceParams::TimeSlice::e() * typename Constants::TimeConversion()));
+        using CDeadlineMarginTicks = decltype(ExprCast<TimeType>(PlanSliceParams::DeadlineMargin::e() * typename Constants::TimeConversion()));
+        
+        using ConfigExprs = MakeTypeList<CTimeSliceTicks, CDeadlineMarginTicks>;
+        
+        struct Object : public ObjBase<PlanSliceFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            PlanState m_plan_state;
+            TimeType m_deadline;
+            TimeType m_slice_end;
+            bool m_in_progress;
+            bool m_finishing;
+        };
+    }
+    AMBRO_STRUCT_ELSE(PlanSliceFeature) {
+        static void init (Context c) {}
+        static bool in_progress (Context c) { return false; }
+        static PlanState * plan_state (Context c, PlanState *local_state) { return local_state; }
+        static void plan_start (Context c) {}
+        static void slice_start (Context c) {}
+        static bool should_yield (Context c) { return false; }
+        static void plan_end (Context c) {}
+        static void resume (Context c) {}
+        static void finish (Context c) {}
+        static void cancel (Context c) {}
+        struct Object {};
+    };
+    
+    // Telemetry for tuning the lookahead. Each plan() is reported together with the
+    // buffer occupancy and the committed motion time which was left when it started.
+    // The duration of an underrun is taken from its detection until the planned start
+    // of stepping, and is reported only if stepping restarts.
+    AMBRO_STRUCT_IF(TelemetryFeature, TelemetryParams::Enabled) {
+        struct Object;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_underrun_pending = false;
+        }
+        
+        static void plan_start (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            
+            o->m_plan_start_time = Clock::getTime(c);
+            o->m_slice_time_max = 0;
+            o->m_plan_segments = m->m_segments_length;
+            o->m_buffered_time = m->m_staging_time;
+            if (m->m_state == STATE_STEPPING) {
+                o->m_buffered_time = TheClockUtils::timeGreaterOrEqual(m->m_staging_time, o->m_plan_start_time) ? (TimeType)(m->m_staging_time - o->m_plan_start_time) : 0;
+            }
+        }
+        
+        static void slice_start (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_slice_start_time = Clock::getTime(c);
+        }
+        
+        static void slice_end (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_slice_time_max = MaxValue(o->m_slice_time_max, (TimeType)(Clock::getTime(c) - o->m_slice_start_time));
+        }
+        
+        static void plan_end (Context c, SegmentBufferSizeType committed)
+        {
+            auto *o = Object::self(c);
+            
+            MotionPlannerPlanInfo<TimeType> info;
+            info.segments = o->m_plan_segments;
+            info.buffer_size = LookaheadBufferSize;
+            info.committed = committed;
+            info.backup = (committed > 0) ? (o->m_plan_segments - committed) : 0;
+            info.backup_size = LookaheadBufferSize - MinCommitCount;
+            info.buffered_time = o->m_buffered_time;
+            info.plan_time = Clock::getTime(c) - o->m_plan_start_time;
+            info.slice_time = o->m_slice_time_max;
+            info.stepping = (MotionPlanner::Object::self(c)->m_state == STATE_STEPPING);
+            PlanCallback::call(c, &info);
+        }
+        
+        static void underrun (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_underrun_pending = true;
+            o->m_underrun_time = Clock::getTime(c);
+        }
+        
+        static void stepping_started (Context c, TimeType start_time)
+        {
+            auto *o = Object::self(c);
+            if (o->m_underrun_pending) {
+                o->m_underrun_pending = false;
+                UnderrunEndCallback::call(c, (TimeType)(start_time - o->m_underrun_time));
+            }
+        }
+        
+        using PlanCallback = typename TelemetryParams::PlanCallback;
+        using UnderrunEndCallback = typename TelemetryParams::UnderrunEndCallback;
+        
+        struct Object : public ObjBase<TelemetryFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            TimeType m_plan_start_time;
+            TimeType m_slice_start_time;
+            TimeType m_slice_time_max;
+            TimeType m_buffered_time;
+            TimeType m_underrun_time;
+            SegmentBufferSizeType m_plan_segments;
+            bool m_underrun_pending;
+        };
+    }
+    AMBRO_STRUCT_ELSE(TelemetryFeature) {
+        static void init (Context c) {}
+        static void plan_start (Context c) {}
+        static void slice_start (Context c) {}
+        static void slice_end (Context c) {}
+        static void plan_end (Context c, SegmentBufferSizeType committed) {}
+        static void underrun (Context c) {}
+        static void stepping_started (Context c, TimeType start_time) {}
+        struct Object {};
+    };
+    
+    // Benchmarking of plan(), reported on exit. The counters are kept outside
+    // of the Object, since the planner shares memory with the homing planners,
+    // and are not reset in init() so that they accumulate across homing.
+    // Only the time when plan() is running is counted, slice_max_ns being
+    // the longest time it ran without yielding (see PlanSliceFeature).
+    
+#ifdef MOTIONPLANNER_BENCHMARK
+    struct BenchState {
+        uint64_t enter_ns;
+        uint64_t plan_calls;
+        uint64_t plan_ns;
+        uint64_t cur_plan_ns;
+        uint64_t plan_max_ns;
+        uint64_t slice_max_ns;
+        uint64_t segments;
+        uint64_t planned_segments;
+        uint64_t committed_segments;
+        uint64_t commands;
+        uint64_t underruns;
+    };
+    
+    static BenchState * bench ()
+    {
+        static BenchState state;
+        return &state;
+    }
+#endif
+    
+    static void bench_init (Context c)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        static bool registered;
+        if (!registered) {
+            registered = true;
+            atexit(MotionPlanner::bench_report);
+        }
+#endif
+    }
+    
+    static void bench_plan_start (Context c)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        auto *o = Object::self(c);
+        bench()->cur_plan_ns = 0;
+        bench()->planned_segments += o->m_segments_length;
+#endif
+    }
+    
+    static void bench_slice_start (Context c)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        bench()->enter_ns = linux_monotonic_ns();
+#endif
+    }
+    
+    static void bench_slice_end (Context c)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        auto *b = bench();
+        uint64_t ns = linux_monotonic_ns() - b->enter_ns;
+        b->plan_ns += ns;
+        b->cur_plan_ns += ns;
+        if (ns > b->slice_max_ns) {
+            b->slice_max_ns = ns;
+        }
+#endif
+    }
+    
+    static void bench_plan_end (Context c, SegmentBufferSizeType committed)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        auto *b = bench();
+        b->plan_calls++;
+        if (b->cur_plan_ns > b->plan_max_ns) {
+            b->plan_max_ns = b->cur_plan_ns;
+        }
+        b->committed_segments += committed;
+#endif
+    }
+    
+#ifdef MOTIONPLANNER_BENCHMARK
+    static void bench_report ()
+    {
+        auto *b = bench();
+        if (b->plan_calls == 0) {
+            return;
+        }
+        fprintf(stderr, "MotionPlannerBenchmark: axes=%d lookahead=%d commit=%d batch=%d plan_calls=%llu plan_avg_ns=%.0f plan_max_ns=%llu slice_max_ns=%llu "
+                "segments=%llu planned_segments=%llu committed_segments=%llu segments_per_s=%.0f stepper_commands=%llu underruns=%llu\n",
+                NumAxes, LookaheadBufferSize, LookaheadCommitCount, PlanBatchSize,
+                (unsigned long long)b->plan_calls, b->plan_ns / (double)b->plan_calls,
+                (unsigned long long)b->plan_max_ns, (unsigned long long)b->slice_max_ns, (unsigned long long)b->segments,
+                (unsigned long long)b->planned_segments, (unsigned long long)b->committed_segments,
+                b->committed_segments / (b->plan_ns * 1e-9), (unsigned long long)b->commands,
+                (unsigned long long)b->underruns);
+    }
+#endif
+    
     static SegmentBufferSizeType segments_add (SegmentBufferSizeType i, SegmentBufferSizeType j)
     {
         SegmentBufferSizeType res = i + j;
@@ -1556,11 +3254,13 @@ private:
 public:
     struct Object : public ObjBase<MotionPlanner, ParentObject, JoinTypeLists<
         AxisCommonList,
-        ChannelsList
+        ChannelsList,
+        MakeTypeList<JunctionDeviationFeature, LookaheadTimeFeature, PlanSliceFeature, FeedHoldFeature, TelemetryFeature>
     >> {
         SegmentBufferSizeType m_segments_start;
         SegmentBufferSizeType m_segments_staging_length;
         SegmentBufferSizeType m_segments_length;
+        SegmentBufferSizeType m_segments_final_length;
         TimeType m_staging_time;
         FpType m_staging_v_squared;
         FpType m_staging_v;
@@ -1578,6 +3278,11 @@ public:
 #endif
         SplitBuffer m_split_buffer;
         Segment m_segments[LookaheadBufferSize];
+        // The data used by the backward pass is kept apart from the segments,
+        // so that it goes through contiguous arrays. The rest of the
+        // LinearPlanner data is in the segments, not taking space for channel
+        // segments.
+        typename TheLinearPlanner::SegmentPushData m_lp_push[LookaheadBufferSize];
         typename TheLinearPlanner::SegmentState m_segment_state[LookaheadBufferSize];
     };
 };
@@ -1590,12 +3295,19 @@ APRINTER_ALIAS_STRUCT_EXT(MotionPlannerArg, (
     APRINTER_AS_VALUE(int, StepperSegmentBufferSize),
     APRINTER_AS_VALUE(int, LookaheadBufferSize),
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
+    APRINTER_AS_TYPE(LookaheadTimeParams),
+    APRINTER_AS_TYPE(PlanSliceParams),
+    APRINTER_AS_VALUE(int, SCurvePieces),
+    APRINTER_AS_TYPE(JunctionDeviationParams),
     APRINTER_AS_TYPE(FpType),
     APRINTER_AS_TYPE(MaxStepsPerCycle),
     APRINTER_AS_TYPE(PullHandler),
     APRINTER_AS_TYPE(FinishedHandler),
     APRINTER_AS_TYPE(AbortedHandler),
     APRINTER_AS_TYPE(UnderrunCallback),
+    APRINTER_AS_TYPE(TelemetryParams),
+    APRINTER_AS_VALUE(bool, NominalSpeedScaling),
+    APRINTER_AS_VALUE(bool, FeedHold),
     APRINTER_AS_TYPE(ParamsChannelsList),
     APRINTER_AS_TYPE(ParamsLasersList)
 ), (
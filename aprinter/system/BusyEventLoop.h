@@ -100,28 +100,44 @@ public:
         TheDebugObject::access(c);
         
         while (1) {
+#ifdef AMBROLIB_VIRTUAL_TIME
+            bool idle = true;
+            bool have_deadline = false;
+            TimeType deadline = 0;
+#endif
             for (typename Delay::Extra::FastEventSizeType i = 0; i < Delay::Extra::NumFastEvents; i++) {
                 Delay::extra(c)->m_fast_event_pos++;
                 if (AMBRO_UNLIKELY(Delay::extra(c)->m_fast_event_pos == Delay::Extra::NumFastEvents)) {
                     Delay::extra(c)->m_fast_event_pos = 0;
                 }
-                cli();
-                if (!Delay::extra(c)->m_fast_events[Delay::extra(c)->m_fast_event_pos].not_triggered) {
-                    Delay::extra(c)->m_fast_events[Delay::extra(c)->m_fast_event_pos].not_triggered = true;
-                    sei();
+                if (take_fast_event(c)) {
                     bench_start_measuring(c);
                     Delay::extra(c)->m_fast_events[Delay::extra(c)->m_fast_event_pos].handler(c);
                     c.check();
                     bench_stop_measuring(c);
+#ifdef AMBROLIB_VIRTUAL_TIME
+                    idle = false;
+#endif
                     break;
                 }
-                sei();
             }
             
         again:;
             TimeType now = Clock::getTime(c);
+#ifdef AMBROLIB_VIRTUAL_TIME
+            have_deadline = false;
+#endif
             for (BaseEventStruct *ev = o->m_event_list.first(); ev; ev = o->m_event_list.next(ev)) {
                 AMBRO_ASSERT(!EventList::isRemoved(ev))
+#ifdef AMBROLIB_VIRTUAL_TIME
+                if (!ev->handler_or_hack) {
+                    TimeType ev_time = static_cast<TimedEventStruct *>(ev)->time;
+                    if (!have_deadline || (TimeType)(ev_time - now) < (TimeType)(deadline - now)) {
+                        deadline = ev_time;
+                    }
+                    have_deadline = true;
+                }
+#endif
                 if (ev->handler_or_hack || TheClockUtils::timeGreaterOrEqual(now, static_cast<TimedEventStruct *>(ev)->time)) {
                     o->m_event_list.remove(ev);
                     EventList::markRemoved(ev);
@@ -138,10 +154,20 @@ public:
                     if (o->m_quitting) {
                         return;
                     }
+#endif
+#ifdef AMBROLIB_VIRTUAL_TIME
+                    idle = false;
 #endif
                     goto again;
                 }
             }
+            
+#ifdef AMBROLIB_VIRTUAL_TIME
+            // With a virtual clock, time only passes when we let it.
+            if (idle) {
+                Clock::advanceTime(c, have_deadline, deadline);
+            }
+#endif
         }
     }
     
@@ -183,7 +209,7 @@ public:
     {
         TheDebugObject::access(c);
         
-        Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()].not_triggered = true;
+        set_not_triggered(&Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()], true);
     }
     
     template <typename EventSpec, typename ThisContext>
@@ -192,9 +218,13 @@ public:
     {
         TheDebugObject::access(c);
         
+#ifdef AMBROLIB_LINUX
+        set_not_triggered(&Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()], false);
+#else
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
             Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()].not_triggered = false;
         }
+#endif
     }
     
 private:
@@ -220,6 +250,39 @@ private:
         static typename Extra::Object * extra (Context c) { return Extra::Object::self(c); }
     };
     
+    // On Linux, interrupts are emulated with threads and cli()/sei() lock a mutex,
+    // which we don't want to do for every fast event on every loop iteration.
+    // Atomic operations on the flag give the same guarantees there.
+    
+    AMBRO_ALWAYS_INLINE
+    static bool take_fast_event (Context c)
+    {
+        auto *ev = &Delay::extra(c)->m_fast_events[Delay::extra(c)->m_fast_event_pos];
+#ifdef AMBROLIB_LINUX
+        return !__atomic_exchange_n(&ev->not_triggered, true, __ATOMIC_ACQ_REL);
+#else
+        cli();
+        if (!ev->not_triggered) {
+            ev->not_triggered = true;
+            sei();
+            return true;
+        }
+        sei();
+        return false;
+#endif
+    }
+    
+    template <typename FastEventState>
+    AMBRO_ALWAYS_INLINE
+    static void set_not_triggered (FastEventState *ev, bool not_triggered)
+    {
+#ifdef AMBROLIB_LINUX
+        __atomic_store_n(&ev->not_triggered, not_triggered, __ATOMIC_RELEASE);
+#else
+        ev->not_triggered = not_triggered;
+#endif
+    }
+    
     static void bench_start_measuring (Context c)
     {
 #ifdef EVENTLOOP_BENCHMARK
@@ -424,6 +424,12 @@ def setup_platform(gen, config, key):
         gen.add_final_init_call(-1, 'platform_init_final();')
         gen.register_singleton_object('lwip_cpu_info', lwip_cpu_info_arm)
     
+    @platform_sel.option('Linux')
+    def option(platform):
+        gen.add_platform_include('aprinter/platform/linux/linux_support.h')
+        gen.add_init_call(-1, 'platform_init();')
+        gen.register_singleton_object('lwip_cpu_info', {'alignment': 'u32_t'})
+    
     config.do_selection(key, platform_sel)
 
 def setup_debug_interface(gen, config, key):
@@ -487,7 +493,8 @@ class CommonClock(object):
         self._interrupt_timers.append(it)
         clearance_name = '{}_{}_Clearance'.format(self._my_clock, name)
         self._gen.add_float_constant(clearance_name, clearance)
-        self._gen.add_isr(self._clockdef.INTERRUPT_TIMER_ISR(it, user))
+        if hasattr(self._clockdef, 'INTERRUPT_TIMER_ISR'):
+            self._gen.add_isr(self._clockdef.INTERRUPT_TIMER_ISR(it, user))
         return self._clockdef.INTERRUPT_TIMER_EXPR(it, clearance_name)
     
     def finalize (self):
@@ -587,6 +594,22 @@ def Stm32f4ClockDef(x):
     x.TIMER_EXPR = lambda tc: 'Stm32f4ClockTIM{}'.format(tc)
     x.TIMER_ISR = lambda my_clock, tc: 'AMBRO_STM32F4_CLOCK_TC_GLOBAL({}, {}, Context())'.format(tc, my_clock)
 
+def LinuxClockDef(x):
+    x.INCLUDE = 'hal/linux/LinuxClock.h'
+    x.CLOCK_SERVICE = lambda config: TemplateExpr('LinuxClockService', [config.get_int_constant('prescaler')])
+    x.TIMER_RE = '\\ATC([0-9])\\Z'
+    x.CHANNEL_RE = '\\ATC([0-9])_([0-9]{1,2})\\Z'
+    x.INTERRUPT_TIMER_EXPR = lambda it, clearance: 'LinuxClockInterruptTimerService'
+    x.TIMER_EXPR = lambda tc: 'LinuxClockTc<{}>'.format(tc)
+
+def LinuxVirtualClockDef(x):
+    x.INCLUDE = 'hal/linux/LinuxVirtualClock.h'
+    x.CLOCK_SERVICE = lambda config: TemplateExpr('LinuxVirtualClockService', [config.get_int_constant('prescaler')])
+    x.TIMER_RE = '\\ATC([0-9])\\Z'
+    x.CHANNEL_RE = '\\ATC([0-9])_([0-9]{1,2})\\Z'
+    x.INTERRUPT_TIMER_EXPR = lambda it, clearance: 'LinuxVirtualClockInterruptTimerService'
+    x.TIMER_EXPR = lambda tc: 'LinuxVirtualClockTc<{}>'.format(tc)
+
 def setup_clock(gen, config, key, clock_name, priority, allow_disabled):
     clock_sel = selection.Selection()
     
@@ -616,6 +639,15 @@ def setup_clock(gen, config, key, clock_name, priority, allow_disabled):
     def option(clock):
         return CommonClock(gen, clock, clock_name, priority, Stm32f4ClockDef)
     
+    @clock_sel.option('LinuxClock')
+    def option(clock):
+        return CommonClock(gen, clock, clock_name, priority, LinuxClockDef)
+    
+    @clock_sel.option('LinuxVirtualClock')
+    def option(clock):
+        gen.add_define('AMBROLIB_VIRTUAL_TIME', 1)
+        return CommonClock(gen, clock, clock_name, priority, LinuxVirtualClockDef)
+    
     clock_object = config.do_selection(key, clock_sel)
     if clock_object is not None:
         gen.register_singleton_object(clock_name, clock_object)
@@ -667,6 +699,12 @@ def setup_pins (gen, config, key):
         pin_regexes.append('\\AStm32f4Pin<Stm32f4Port[A-Z],[0-9]{1,3}>\\Z')
         return TemplateLiteral('Stm32f4PinsService')
     
+    @pins_sel.option('LinuxPins')
+    def options(pin_config):
+        gen.add_aprinter_include('hal/linux/LinuxPins.h')
+        pin_regexes.append('\\ALinuxPin<[0-9]{1,3}>\\Z')
+        return TemplateLiteral('LinuxPinsService')
+    
     service_expr = config.do_selection(key, pins_sel)
     service_code = 'using PinsService = {};'.format(service_expr.build(indent=0))
     pins_expr = TemplateExpr('PinsService::Pins', ['Context', 'Program'])
@@ -721,6 +759,11 @@ def setup_watchdog (gen, config, key, disable_watchdog, user):
             watchdog.get_int('Reload'),
         ])
     
+    @watchdog_sel.option('NullWatchdog')
+    def option(watchdog):
+        gen.add_aprinter_include('hal/generic/NullWatchdog.h')
+        return 'NullWatchdogService'
+    
     return config.do_selection(key, watchdog_sel)
 
 def setup_adc (gen, config, key):
@@ -805,6 +848,15 @@ def setup_adc (gen, config, key):
             'pin_func': lambda pin: pin
         }
     
+    @adc_sel.option('LinuxAdc')
+    def option(adc_config):
+        gen.add_aprinter_include('hal/linux/LinuxAdc.h')
+        
+        return {
+            'service_expr': TemplateLiteral('LinuxAdcService'),
+            'pin_func': lambda pin: pin
+        }
+    
     result = config.do_selection(key, adc_sel)
     if result is None:
         return
@@ -865,6 +917,10 @@ def use_input_mode (config, key):
     def option(im_config):
         return im_config.do_enum('PullMode', {'Normal': 'Mk20PinInputModeNormal', 'Pull-up': 'Mk20PinInputModePullUp', 'Pull-down': 'Mk20PinInputModePullDown'})
     
+    @im_sel.option('LinuxPinInputMode')
+    def option(im_config):
+        return im_config.do_enum('PullMode', {'Normal': 'LinuxPinInputModeNormal', 'Pull-up': 'LinuxPinInputModePullUp'})
+    
     return config.do_selection(key, im_sel)
 
 def use_digital_input (gen, config, key):
@@ -1118,6 +1174,16 @@ def use_serial(gen, config, key, user):
         gen.add_aprinter_include('hal/stm32/Stm32f4UsbSerial.h')
         return 'Stm32f4UsbSerialService'
     
+    @serial_sel.option('LinuxPtySerial')
+    def option(serial_service):
+        gen.add_aprinter_include('hal/linux/LinuxPtySerial.h')
+        return 'LinuxPtySerialService'
+    
+    @serial_sel.option('LinuxStdioSerial')
+    def option(serial_service):
+        gen.add_aprinter_include('hal/linux/LinuxStdioSerial.h')
+        return 'LinuxStdioSerialService'
+    
     @serial_sel.option('NullSerial')
     def option(serial_service):
         gen.add_aprinter_include('hal/generic/NullSerial.h')
@@ -1448,6 +1514,24 @@ def generate(config_root_data, cfg_name, main_template):
                 
                 event_channel_timer_expr = use_interrupt_timer(gen, board_data, 'EventChannelTimer', user='{}::GetEventChannelTimer<>'.format(aux_control_module_user), clearance=event_channel_timer_clearance)
                 
+                shared_step_timer_params = 'PrinterMainNoSharedStepTimerParams'
+                if board_data.has('step_timer'):
+                    step_timer_sel = selection.Selection()
+                    
+                    @step_timer_sel.option('PerAxisStepTimers')
+                    def option(step_timer_config):
+                        return 'PrinterMainNoSharedStepTimerParams'
+                    
+                    @step_timer_sel.option('SharedStepTimer')
+                    def option(step_timer_config):
+                        return TemplateExpr('PrinterMainSharedStepTimerParams', [
+                            use_interrupt_timer(gen, step_timer_config, 'Timer', user='MyPrinter::GetSharedStepTimer<>'),
+                        ])
+                    
+                    shared_step_timer_params = board_data.do_selection('step_timer', step_timer_sel)
+                
+                use_shared_step_timer = shared_step_timer_params != 'PrinterMainNoSharedStepTimerParams'
+                
                 for development in board_data.enter_config('development'):
                     assertions_enabled = development.get_bool('AssertionsEnabled')
                     event_loop_benchmark_enabled = development.get_bool('EventLoopBenchmarkEnabled')
@@ -1457,6 +1541,17 @@ def generate(config_root_data, cfg_name, main_template):
                     verbose_build = development.get_bool('VerboseBuild')
                     debug_symbols = development.get_bool('DebugSymbols')
                     
+                    if development.has('MotionPlannerBenchmarkEnabled') and development.get_bool('MotionPlannerBenchmarkEnabled'):
+                        gen.add_define('MOTIONPLANNER_BENCHMARK', 1)
+                    
+                    if development.has('MotionPlannerBatchPlan') and development.get_bool('MotionPlannerBatchPlan'):
+                        gen.add_define('MOTIONPLANNER_BATCH_PLAN', 1)
+                    
+                    if development.has('PlannerTelemetryEnabled') and development.get_bool('PlannerTelemetryEnabled'):
+                        gen.add_aprinter_include('printer/modules/PlannerTelemetryModule.h')
+                        planner_telemetry_module = gen.add_module()
+                        planner_telemetry_module.set_expr('PlannerTelemetryModuleService')
+                    
                     if development.get_bool('EnableBulkOutputTest'):
                         gen.add_aprinter_include('printer/modules/BulkOutputTestModule.h')
                         bulk_output_test_module = gen.add_module()
@@ -1732,9 +1827,14 @@ def generate(config_root_data, cfg_name, main_template):
             
             current_control_channel_list = []
             microstep_axis_list = []
+            stepper_names = []
+            extruder_stepper_names = []
             
             def stepper_cb(stepper, stepper_index):
                 name = stepper.get_id_char('Name')
+                stepper_names.append(name)
+                if stepper.get_bool('IsExtruder'):
+                    extruder_stepper_names.append(name)
                 
                 homing_sel = selection.Selection()
                 
@@ -1764,6 +1864,7 @@ def generate(config_root_data, cfg_name, main_template):
                 gen.add_aprinter_include('printer/actuators/AxisDriver.h')
                 
                 stepper_ports_for_axis = []
+                axis_microsteps = []
                 
                 def slave_steppers_cb(slave_stepper, slave_stepper_index):
                     slave_stepper_port = gen.get_object('stepper_port', slave_stepper, 'stepper_port')
@@ -1792,7 +1893,7 @@ def generate(config_root_data, cfg_name, main_template):
                     
                     @microstep_sel.option('NoMicroStep')
                     def option(microstep_config):
-                        pass
+                        axis_microsteps.append(None)
                     
                     @microstep_sel.option('MicroStep')
                     def option(microstep_config):
@@ -1800,7 +1901,8 @@ def generate(config_root_data, cfg_name, main_template):
                             use_microstep(gen, microstep_config, 'MicroStepDriver'),
                             slave_stepper.get_int('MicroSteps'),
                         ])
-                        microstep_axis_list.append(microstep_expr)
+                        driver = microstep_config.get_config('MicroStepDriver').get_string('_compoundName')
+                        axis_microsteps.append((microstep_expr, driver, slave_stepper))
                     
                     slave_stepper_port.do_selection('microstep', microstep_sel)
                     
@@ -1831,8 +1933,105 @@ def generate(config_root_data, cfg_name, main_template):
                         gen.add_float_constant('{}StepLowTime'.format(name), delay_config.get_float('StepLowTime')),
                     ])
                 
+                delay_params = stepper.do_selection('delay', delay_sel)
+                
+                precompute_params = 'AxisDriverNoPrecomputeParams'
+                recurrence_params = 'AxisDriverNoRecurrenceParams'
+                if stepper.has('step_time_computation'):
+                    step_time_sel = selection.Selection()
+                    
+                    @step_time_sel.option('Exact')
+                    def option(step_time_config):
+                        return ('AxisDriverNoPrecomputeParams', 'AxisDriverNoRecurrenceParams')
+                    
+                    @step_time_sel.option('Precompute')
+                    def option(step_time_config):
+                        ring_size = step_time_config.get_int('RingSize')
+                        if not (2 <= ring_size <= 128 and (ring_size & (ring_size - 1)) == 0):
+                            step_time_config.key_path('RingSize').error('Must be a power of two between 2 and 128.')
+                        if delay_params == 'AxisDriverNoDelayParams':
+                            step_time_config.path().error('Precomputed step times require step signal timing (the step pulse width is only ensured by the delays).')
+                        return (TemplateExpr('AxisDriverPrecomputeParams', [ring_size]), 'AxisDriverNoRecurrenceParams')
+                    
+                    @step_time_sel.option('Recurrence')
+                    def option(step_time_config):
+                        resync_interval = step_time_config.get_int('ResyncInterval')
+                        if not (2 <= resync_interval <= 128 and (resync_interval & (resync_interval - 1)) == 0):
+                            step_time_config.key_path('ResyncInterval').error('Must be a power of two between 2 and 128.')
+                        if delay_params == 'AxisDriverNoDelayParams':
+                            step_time_config.path().error('The step time recurrence requires step signal timing (the step pulse width is only ensured by the delays).')
+                        return ('AxisDriverNoPrecomputeParams', TemplateExpr('AxisDriverRecurrenceParams', [resync_interval]))
+                    
+                    precompute_params, recurrence_params = stepper.do_selection('step_time_computation', step_time_sel)
+                
+                multi_step_params = 'AxisDriverNoMultiStepParams'
+                if stepper.has('multi_step'):
+                    multi_step_sel = selection.Selection()
+                    
+                    @multi_step_sel.option('NoMultiStep')
+                    def option(multi_step_config):
+                        return 'AxisDriverNoMultiStepParams'
+                    
+                    @multi_step_sel.option('MultiStep')
+                    def option(multi_step_config):
+                        if precompute_params != 'AxisDriverNoPrecomputeParams' or recurrence_params != 'AxisDriverNoRecurrenceParams':
+                            multi_step_config.path().error('Multiple steps per interrupt require exact step time computation in the interrupt.')
+                        if delay_params == 'AxisDriverNoDelayParams':
+                            multi_step_config.path().error('Multiple steps per interrupt require step signal timing (the step pulse width and low time are only ensured by the delays).')
+                        double_step_rate = multi_step_config.get_float('DoubleStepRate')
+                        if not double_step_rate > 0.0:
+                            multi_step_config.key_path('DoubleStepRate').error('Must be positive.')
+                        quad_step_rate = multi_step_config.get_float('QuadStepRate')
+                        if not quad_step_rate >= double_step_rate:
+                            multi_step_config.key_path('QuadStepRate').error('Must not be less than the double stepping rate.')
+                        return TemplateExpr('AxisDriverMultiStepParams', [
+                            gen.add_float_constant('{}DoubleStepRate'.format(name), double_step_rate),
+                            gen.add_float_constant('{}QuadStepRate'.format(name), quad_step_rate),
+                        ])
+                    
+                    multi_step_params = stepper.do_selection('multi_step', multi_step_sel)
+                
+                microstep_switch_params = 'AxisDriverNoMicroStepSwitchParams'
+                if stepper.has('microstep_switch'):
+                    microstep_switch_sel = selection.Selection()
+                    
+                    @microstep_switch_sel.option('NoMicroStepSwitch')
+                    def option(microstep_switch_config):
+                        return 'AxisDriverNoMicroStepSwitchParams'
+                    
+                    @microstep_switch_sel.option('MicroStepSwitch')
+                    def option(microstep_switch_config):
+                        if precompute_params != 'AxisDriverNoPrecomputeParams' or recurrence_params != 'AxisDriverNoRecurrenceParams' or multi_step_params != 'AxisDriverNoMultiStepParams':
+                            microstep_switch_config.path().error('Micro-step switching requires exact step time computation in the interrupt and no multiple steps per interrupt.')
+                        factor = microstep_switch_config.get_int('Factor')
+                        if factor not in (2, 4, 8, 16):
+                            microstep_switch_config.key_path('Factor').error('Must be 2, 4, 8 or 16.')
+                        switch_rate = microstep_switch_config.get_float('SwitchRate')
+                        if not switch_rate > 0.0:
+                            microstep_switch_config.key_path('SwitchRate').error('Must be positive.')
+                        for axis_microstep in axis_microsteps:
+                            if axis_microstep is None:
+                                microstep_switch_config.path().error('Micro-step switching requires controlled micro-stepping of all steppers of the axis.')
+                            microstep_expr, driver, slave_stepper = axis_microstep
+                            supported = (1, 2, 4, 16) if driver == 'A4982' else (1, 2, 4, 8, 16)
+                            microsteps = slave_stepper.get_int('MicroSteps')
+                            if microsteps not in supported or microsteps % factor != 0 or microsteps // factor not in supported:
+                                slave_stepper.key_path('MicroSteps').error('Must be supported by the driver, also when divided by the micro-step switching factor.')
+                        gen.add_aprinter_include('printer/modules/MicroStepConfigModule.h')
+                        return TemplateExpr('AxisDriverMicroStepSwitchParams', [
+                            factor,
+                            gen.add_float_constant('{}MicroStepSwitchRate'.format(name), switch_rate),
+                            TemplateList([axis_microstep[0] for axis_microstep in axis_microsteps]),
+                        ])
+                    
+                    microstep_switch_params = stepper.do_selection('microstep_switch', microstep_switch_sel)
+                
+                # With micro-step switching, the axis driver controls the micro-stepping.
+                if microstep_switch_params == 'AxisDriverNoMicroStepSwitchParams':
+                    microstep_axis_list.extend(axis_microstep[0] for axis_microstep in axis_microsteps if axis_microstep is not None)
+                
                 first_stepper_port = stepper_ports_for_axis[0]
-                if first_stepper_port.get_config('StepperTimer').get_string('_compoundName') != 'interrupt_timer':
+                if not use_shared_step_timer and first_stepper_port.get_config('StepperTimer').get_string('_compoundName') != 'interrupt_timer':
                     first_stepper_port.key_path('StepperTimer').error('Stepper port of first stepper in axis must have a timer unit defined.')
                 
                 return TemplateExpr('PrinterMainAxisParams', [
@@ -1849,10 +2048,15 @@ def generate(config_root_data, cfg_name, main_template):
                     stepper.get_bool('IsExtruder'),
                     32,
                     TemplateExpr('AxisDriverService', [
-                        use_interrupt_timer(gen, first_stepper_port, 'StepperTimer', user='MyPrinter::GetAxisTimer<{}>'.format(stepper_index)),
+                        # With a shared step timer, PrinterMain gives the axis driver a channel of it.
+                        'void' if use_shared_step_timer else use_interrupt_timer(gen, first_stepper_port, 'StepperTimer', user='MyPrinter::GetAxisTimer<{}>'.format(stepper_index)),
                         'TheAxisDriverPrecisionParams',
                         stepper.get_bool('PreloadCommands'),
-                        stepper.do_selection('delay', delay_sel),
+                        delay_params,
+                        precompute_params,
+                        recurrence_params,
+                        multi_step_params,
+                        microstep_switch_params,
                     ]),
                     slave_steppers_expr,
                 ])
@@ -2257,6 +2461,7 @@ def generate(config_root_data, cfg_name, main_template):
                 ])
             
             lasers_expr = config.do_list('lasers', laser_cb, max_count=15)
+            num_lasers = len(list(config.iter_list_config('lasers', max_count=15)))
             
             current_sel = selection.Selection()
             
@@ -2349,6 +2554,207 @@ def generate(config_root_data, cfg_name, main_template):
                 millisecond_clock_module = gen.add_module()
                 millisecond_clock_module.set_expr('MillisecondClockInfoModuleService')
             
+            scurve_pieces = 0
+            if config.has('motion_profile'):
+                motion_profile_sel = selection.Selection()
+                
+                @motion_profile_sel.option('Trapezoidal')
+                def option(profile_config):
+                    return 0
+                
+                @motion_profile_sel.option('SCurve')
+                def option(profile_config):
+                    pieces = profile_config.get_int('Pieces')
+                    if not 2 <= pieces <= 16:
+                        profile_config.key_path('Pieces').error('Value out of range.')
+                    return pieces
+                
+                scurve_pieces = config.do_selection('motion_profile', motion_profile_sel)
+            
+            lookahead_time_params = 'PrinterMainNoLookaheadTimeParams'
+            if config.has('lookahead_mode'):
+                lookahead_mode_sel = selection.Selection()
+                
+                @lookahead_mode_sel.option('SegmentCount')
+                def option(lookahead_config):
+                    return 'PrinterMainNoLookaheadTimeParams'
+                
+                @lookahead_mode_sel.option('BufferedTime')
+                def option(lookahead_config):
+                    target_time = lookahead_config.get_float('TargetTime')
+                    if not 0.0 < target_time <= 2.0:
+                        lookahead_config.key_path('TargetTime').error('Value out of range.')
+                    return TemplateExpr('PrinterMainLookaheadTimeParams', [
+                        gen.add_float_config('LookaheadTargetTime', target_time),
+                    ])
+                
+                lookahead_time_params = config.do_selection('lookahead_mode', lookahead_mode_sel)
+            
+            plan_slice_params = 'PrinterMainNoPlanSliceParams'
+            if config.has('plan_slicing'):
+                plan_slicing_sel = selection.Selection()
+                
+                @plan_slicing_sel.option('NoPlanSlicing')
+                def option(plan_slicing_config):
+                    return 'PrinterMainNoPlanSliceParams'
+                
+                @plan_slicing_sel.option('PlanSlicing')
+                def option(plan_slicing_config):
+                    time_slice = plan_slicing_config.get_float('TimeSlice')
+                    if not 0.0 <= time_slice <= 0.1:
+                        plan_slicing_config.key_path('TimeSlice').error('Value out of range.')
+                    deadline_margin = plan_slicing_config.get_float('DeadlineMargin')
+                    if not 0.0 <= deadline_margin <= 1.0:
+                        plan_slicing_config.key_path('DeadlineMargin').error('Value out of range.')
+                    return TemplateExpr('PrinterMainPlanSliceParams', [
+                        gen.add_float_config('PlanTimeSlice', time_slice),
+                        gen.add_float_config('PlanDeadlineMargin', deadline_margin),
+                    ])
+                
+                plan_slice_params = config.do_selection('plan_slicing', plan_slicing_sel)
+            
+            junction_deviation_params = 'PrinterMainNoJunctionDeviationParams'
+            if config.has('cornering'):
+                cornering_sel = selection.Selection()
+                
+                @cornering_sel.option('PerAxisCornering')
+                def option(cornering_config):
+                    return 'PrinterMainNoJunctionDeviationParams'
+                
+                @cornering_sel.option('JunctionDeviation')
+                def option(cornering_config):
+                    return TemplateExpr('PrinterMainJunctionDeviationParams', [
+                        gen.add_float_config('JunctionDeviation', cornering_config.get_float('JunctionDeviation')),
+                    ])
+                
+                junction_deviation_params = config.do_selection('cornering', cornering_sel)
+            
+            arc_params = 'PrinterMainNoArcParams'
+            if config.has('arcs'):
+                arcs_sel = selection.Selection()
+                
+                @arcs_sel.option('NoArcs')
+                def option(arcs_config):
+                    return 'PrinterMainNoArcParams'
+                
+                @arcs_sel.option('Arcs')
+                def option(arcs_config):
+                    for axis_name in ('X', 'Y'):
+                        if axis_name not in stepper_names + transform_axes:
+                            arcs_config.path().error('Arcs require an {} axis.'.format(axis_name))
+                    if not arcs_config.get_float('ChordalTolerance') > 0.0:
+                        arcs_config.key_path('ChordalTolerance').error('Value out of range.')
+                    return TemplateExpr('PrinterMainArcParams', [
+                        gen.add_float_config('ArcChordalTolerance', arcs_config.get_float('ChordalTolerance')),
+                    ])
+                
+                arc_params = config.do_selection('arcs', arcs_sel)
+            
+            coalesce_params = 'PrinterMainNoCoalesceParams'
+            if config.has('coalescing'):
+                coalescing_sel = selection.Selection()
+                
+                @coalescing_sel.option('NoCoalescing')
+                def option(coalescing_config):
+                    return 'PrinterMainNoCoalesceParams'
+                
+                @coalescing_sel.option('Coalescing')
+                def option(coalescing_config):
+                    if transform_expr != 'PrinterMainNoTransformParams':
+                        coalescing_config.path().error('Move coalescing is not supported with a coordinate transformation.')
+                    if num_lasers > 0:
+                        coalescing_config.path().error('Move coalescing is not supported with lasers.')
+                    max_direction_change = coalescing_config.get_float('MaxDirectionChange')
+                    if not 0.0 <= max_direction_change <= 90.0:
+                        coalescing_config.key_path('MaxDirectionChange').error('Value out of range.')
+                    max_merged_moves = coalescing_config.get_int('MaxMergedMoves')
+                    if not 1 <= max_merged_moves <= 255:
+                        coalescing_config.key_path('MaxMergedMoves').error('Value out of range.')
+                    return TemplateExpr('PrinterMainCoalesceParams', [
+                        gen.add_float_config('CoalesceMaxDeviation', coalescing_config.get_float('MaxDeviation')),
+                        gen.add_float_config('CoalesceMaxDirectionChange', max_direction_change),
+                        gen.add_float_config('CoalesceSpeedTolerance', coalescing_config.get_float('SpeedTolerance')),
+                        max_merged_moves,
+                    ])
+                
+                coalesce_params = config.do_selection('coalescing', coalescing_sel)
+            
+            blend_params = 'PrinterMainNoBlendParams'
+            if config.has('blending'):
+                blending_sel = selection.Selection()
+                
+                @blending_sel.option('NoBlending')
+                def option(blending_config):
+                    return 'PrinterMainNoBlendParams'
+                
+                @blending_sel.option('Blending')
+                def option(blending_config):
+                    if transform_expr != 'PrinterMainNoTransformParams':
+                        blending_config.path().error('Path blending is not supported with a coordinate transformation.')
+                    if coalesce_params != 'PrinterMainNoCoalesceParams':
+                        blending_config.path().error('Path blending is not supported together with move coalescing.')
+                    if not blending_config.get_float('DefaultTolerance') >= 0.0:
+                        blending_config.key_path('DefaultTolerance').error('Value out of range.')
+                    max_chord_angle = blending_config.get_float('MaxChordAngle')
+                    if not 1.0 <= max_chord_angle <= 90.0:
+                        blending_config.key_path('MaxChordAngle').error('Value out of range.')
+                    return TemplateExpr('PrinterMainBlendParams', [
+                        gen.add_float_config('BlendDefaultTolerance', blending_config.get_float('DefaultTolerance')),
+                        gen.add_float_config('BlendMaxChordAngle', max_chord_angle),
+                    ])
+                
+                blend_params = config.do_selection('blending', blending_sel)
+            
+            pressure_advance_params = 'PrinterMainNoPressureAdvanceParams'
+            if config.has('pressure_advance'):
+                pressure_advance_sel = selection.Selection()
+                
+                @pressure_advance_sel.option('NoPressureAdvance')
+                def option(pressure_advance_config):
+                    return 'PrinterMainNoPressureAdvanceParams'
+                
+                @pressure_advance_sel.option('PressureAdvance')
+                def option(pressure_advance_config):
+                    advance_time = pressure_advance_config.get_float('AdvanceTime')
+                    if not 0.0 <= advance_time <= 1.0:
+                        pressure_advance_config.key_path('AdvanceTime').error('Value out of range.')
+                    return TemplateExpr('PrinterMainPressureAdvanceParams', [
+                        gen.add_float_config('PressureAdvanceTime', advance_time),
+                    ])
+                
+                pressure_advance_params = config.do_selection('pressure_advance', pressure_advance_sel)
+            
+            input_shaping_params = 'PrinterMainNoInputShapingParams'
+            if config.has('input_shaping'):
+                input_shaping_sel = selection.Selection()
+                
+                @input_shaping_sel.option('NoInputShaping')
+                def option(input_shaping_config):
+                    return 'PrinterMainNoInputShapingParams'
+                
+                @input_shaping_sel.option('InputShaping')
+                def option(input_shaping_config):
+                    shaper_type = input_shaping_config.get_identifier('ShaperType', lambda x: x in ('ZV', 'MZV', 'EI'))
+                    if not input_shaping_config.get_float('Frequency') > 0.0:
+                        input_shaping_config.key_path('Frequency').error('Value out of range.')
+                    if not 0.0 <= input_shaping_config.get_float('DampingRatio') < 1.0:
+                        input_shaping_config.key_path('DampingRatio').error('Value out of range.')
+                    axes_exprs = []
+                    for axis_name in input_shaping_config.get_string('Axes'):
+                        if axis_name not in stepper_names:
+                            input_shaping_config.key_path('Axes').error('Unknown stepper {}.'.format(axis_name))
+                        if axis_name in extruder_stepper_names:
+                            input_shaping_config.key_path('Axes').error('Input shaping cannot be used on extruder {}.'.format(axis_name))
+                        axes_exprs.append(TemplateExpr('WrapInt', [TemplateChar(axis_name)]))
+                    return TemplateExpr('PrinterMainInputShapingParams', [
+                        'MotionPlannerShaper{}'.format(shaper_type),
+                        gen.add_float_config('InputShapingFrequency', input_shaping_config.get_float('Frequency')),
+                        gen.add_float_config('InputShapingDampingRatio', input_shaping_config.get_float('DampingRatio')),
+                        TemplateList(axes_exprs),
+                    ])
+                
+                input_shaping_params = config.do_selection('input_shaping', input_shaping_sel)
+            
             printer_params = TemplateExpr('PrinterMainParams', [
                 led_pin_expr,
                 'LedBlinkInterval',
@@ -2361,8 +2767,20 @@ def generate(config_root_data, cfg_name, main_template):
                 performance.get_int_constant('StepperSegmentBufferSize'),
                 performance.get_int_constant('LookaheadBufferSize'),
                 performance.get_int_constant('LookaheadCommitCount'),
+                lookahead_time_params,
+                plan_slice_params,
+                scurve_pieces,
+                junction_deviation_params,
+                arc_params,
+                coalesce_params,
+                blend_params,
+                pressure_advance_params,
+                input_shaping_params,
+                'true' if config.has('RealtimeSpeedRatio') and config.get_bool('RealtimeSpeedRatio') else 'false',
+                'true' if config.has('FeedHold') and config.get_bool('FeedHold') else 'false',
                 'ForceTimeout',
                 performance.get_identifier('FpType', lambda x: x in ('float', 'double')),
+                shared_step_timer_params,
                 setup_watchdog(gen, platform, 'watchdog', disable_watchdog, 'MyPrinter::GetWatchdog'),
                 config_manager_expr,
                 'ConfigList',
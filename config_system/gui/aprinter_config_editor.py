@@ -56,6 +56,9 @@ def input_mode_choice(context, **kwargs):
         ce.Compound('Mk20PinInputMode', attrs=[
             ce.String(key='PullMode', title='Pull mode', enum=['Normal', 'Pull-up', 'Pull-down']),
         ]),
+        ce.Compound('LinuxPinInputMode', attrs=[
+            ce.String(key='PullMode', title='Pull mode', enum=['Normal', 'Pull-up']),
+        ]),
     ], **kwargs)
 
 def i2c_choice(**kwargs):
@@ -297,6 +300,29 @@ def platform_Stm32f4():
         ]),
     ])
 
+def platform_Linux():
+    return ce.Compound('Linux', attrs=[
+        ce.OneOf(key='clock', title='Clock', collapsable=True, choices=[
+            ce.Compound(clock_type, title=clock_title, attrs=[
+                ce.Integer(key='prescaler', title='Prescaler (clock runs at 1GHz/(prescaler+1))'),
+                ce.String(key='primary_timer', title='Primary timer'),
+                ce.Constant(key='avail_oc_units', value=[
+                    {
+                        'value': 'TC0_{}'.format(i)
+                    } for i in range(32)
+                ])
+            ]) for (clock_type, clock_title) in [
+                ('LinuxClock', 'Real time'),
+                ('LinuxVirtualClock', 'Virtual time (simulation)'),
+            ]
+        ]),
+        ce.Compound('LinuxAdc', key='adc', title='ADC', collapsable=True, attrs=[]),
+        ce.Compound('NullWatchdog', key='watchdog', title='Watchdog', collapsable=True, attrs=[]),
+        ce.Compound('LinuxPins', key='pins', title='Pins', collapsable=True, attrs=[
+            ce.Constant(key='input_mode_type', value='LinuxPinInputMode'),
+        ]),
+    ])
+
 def hard_pwm_choice(**kwargs):
     return ce.OneOf(title='Hard-PWM driver', choices=[
         ce.Compound('AvrClockPwm', ident='id_pwm_output', attrs=[
@@ -462,6 +488,70 @@ def editor():
             ce.Float(key='InactiveTime', title='Disable steppers after [s]', default=480),
             ce.Float(key='WaitTimeout', title='Timeout when waiting for heater temperatures (M116) [s]', default=500),
             ce.Float(key='WaitReportPeriod', title='Period of temperature reports when waiting for heaters [s]', default=1),
+            ce.OneOf(key='lookahead_mode', title='Lookahead planning', choices=[
+                ce.Compound('SegmentCount', title='By segment count (plan when the lookahead buffer is full)', attrs=[]),
+                ce.Compound('BufferedTime', title='By buffered motion time (also plan early, with adaptive commit size)', attrs=[
+                    ce.Float(key='TargetTime', title='Target committed motion time [s]', default=0.25),
+                ]),
+            ]),
+            ce.OneOf(key='plan_slicing', title='Time-sliced planning (bounds the time other events wait for planning)', choices=[
+                ce.Compound('NoPlanSlicing', title='Disabled (plan the whole lookahead at once)', attrs=[]),
+                ce.Compound('PlanSlicing', title='Enabled', attrs=[
+                    ce.Float(key='TimeSlice', title='Max. planning time before yielding to other events [s]', default=0.0002),
+                    ce.Float(key='DeadlineMargin', title='Do not yield when the committed motion ends within [s]', default=0.01),
+                ]),
+            ]),
+            ce.OneOf(key='motion_profile', title='Acceleration profile', choices=[
+                ce.Compound('Trapezoidal', title='Trapezoidal (constant acceleration)', attrs=[]),
+                ce.Compound('SCurve', title='S-curve (limited jerk, max. acceleration reached only mid-ramp)', attrs=[
+                    ce.Integer(key='Pieces', title='Constant-acceleration pieces per acceleration phase (2-16)', default=4),
+                ]),
+            ]),
+            ce.OneOf(key='cornering', title='Cornering speed limit', choices=[
+                ce.Compound('PerAxisCornering', title='Per-axis (Cornering distance of each axis)', attrs=[]),
+                ce.Compound('JunctionDeviation', title='Junction deviation', attrs=[
+                    ce.Float(key='JunctionDeviation', title='Junction deviation (greater values allow greater speed at corners) [step]', default=2),
+                ]),
+            ]),
+            ce.OneOf(key='arcs', title='Arc moves (G2/G3)', choices=[
+                ce.Compound('NoArcs', title='Not supported', attrs=[]),
+                ce.Compound('Arcs', title='Supported', attrs=[
+                    ce.Float(key='ChordalTolerance', title='Chordal tolerance (max. distance of chords from the arc) [mm]', default=0.01),
+                ]),
+            ]),
+            ce.OneOf(key='coalescing', title='Coalescing of short collinear moves', choices=[
+                ce.Compound('NoCoalescing', title='Disabled', attrs=[]),
+                ce.Compound('Coalescing', title='Enabled (not with coordinate transformation or lasers)', attrs=[
+                    ce.Float(key='MaxDeviation', title='Max. deviation of the merged move from the original path [mm]', default=0.01),
+                    ce.Float(key='MaxDirectionChange', title='Max. direction change between merged moves [deg]', default=5),
+                    ce.Float(key='SpeedTolerance', title='Max. relative difference of speed limits of merged moves', default=0.05),
+                    ce.Integer(key='MaxMergedMoves', title='Max. number of moves merged into one (1-255)', default=8),
+                ]),
+            ]),
+            ce.OneOf(key='blending', title='Path blending (G64 P/G61)', choices=[
+                ce.Compound('NoBlending', title='Not supported', attrs=[]),
+                ce.Compound('Blending', title='Supported (not with coordinate transformation or coalescing)', attrs=[
+                    ce.Float(key='DefaultTolerance', title='Tolerance for G64 without P (max. distance of the path from corners) [mm]', default=0.05),
+                    ce.Float(key='MaxChordAngle', title='Max. direction change between blend chords (smaller corners are not blended) [deg]', default=10),
+                ]),
+            ]),
+            ce.OneOf(key='pressure_advance', title='Pressure advance (extruder axes)', choices=[
+                ce.Compound('NoPressureAdvance', title='Disabled', attrs=[]),
+                ce.Compound('PressureAdvance', title='Enabled', attrs=[
+                    ce.Float(key='AdvanceTime', title='Advance time (extra extruder position per extruder speed) [s]', default=0.05),
+                ]),
+            ]),
+            ce.OneOf(key='input_shaping', title='Input shaping (resonance suppression)', choices=[
+                ce.Compound('NoInputShaping', title='Disabled', attrs=[]),
+                ce.Compound('InputShaping', title='Enabled', attrs=[
+                    ce.String(key='ShaperType', title='Shaper type', enum=['ZV', 'MZV', 'EI'], default='MZV'),
+                    ce.Float(key='Frequency', title='Resonance frequency [Hz]', default=40),
+                    ce.Float(key='DampingRatio', title='Damping ratio [1]', default=0.1),
+                    ce.String(key='Axes', title='Shaped axes (names of the steppers, not extruders)', default='XY'),
+                ]),
+            ]),
+            ce.Boolean(key='RealtimeSpeedRatio', title='Speed override (M220) applies to', default=False, false_title='New moves', true_title='Buffered moves too (real-time)'),
+            ce.Boolean(key='FeedHold', title='Feed hold (M928/M929)', default=False, false_title='Disabled', true_title='Enabled'),
             ce.Compound('advanced', key='advanced', title='Advanced parameters', collapsable=True, attrs=[
                 ce.Float(key='LedBlinkInterval', title='LED blink interval [s]', default=0.5),
                 ce.Float(key='ForceTimeout', title='Force motion timeout [s]', default=0.1),
@@ -493,6 +583,29 @@ def editor():
                         ce.Float(key='StepLowTime', title='Minimum step low time [us]', default=1.0),
                     ]),
                 ]),
+                ce.OneOf(key='step_time_computation', title='Step time computation', choices=[
+                    ce.Compound('Exact', title='Exact, in the step interrupt', attrs=[]),
+                    ce.Compound('Precompute', title='Exact, ahead in the main loop (requires step signal timing)', attrs=[
+                        ce.Integer(key='RingSize', title='Precomputed step times per axis (power of two, 2-128)', default=32),
+                    ]),
+                    ce.Compound('Recurrence', title='Incrementally, with periodic exact steps (requires step signal timing)', attrs=[
+                        ce.Integer(key='ResyncInterval', title='Steps between exact steps (power of two, 2-128)', default=16),
+                    ]),
+                ]),
+                ce.OneOf(key='multi_step', title='Multiple steps per interrupt', choices=[
+                    ce.Compound('NoMultiStep', title='Disabled', attrs=[]),
+                    ce.Compound('MultiStep', title='Enabled (requires exact step time computation in the interrupt and step signal timing)', attrs=[
+                        ce.Float(key='DoubleStepRate', title='Two steps per interrupt above [steps/s]', default=20000),
+                        ce.Float(key='QuadStepRate', title='Four steps per interrupt above [steps/s]', default=40000),
+                    ]),
+                ]),
+                ce.OneOf(key='microstep_switch', title='Micro-step switching', choices=[
+                    ce.Compound('NoMicroStepSwitch', title='Disabled', attrs=[]),
+                    ce.Compound('MicroStepSwitch', title='Enabled (requires controlled micro-stepping and exact step time computation in the interrupt)', attrs=[
+                        ce.Integer(key='Factor', title='Micro-step reduction factor (2, 4, 8 or 16)', default=4),
+                        ce.Float(key='SwitchRate', title='Reduce micro-steps for moves faster than [micro-steps/s]', default=10000),
+                    ]),
+                ]),
             ])),
             ce.OneOf(key='transform', title='Coordinate transformation', choices=[
                 ce.Compound('NoTransform', title='None (cartesian)', attrs=[]),
@@ -694,6 +807,7 @@ def editor():
                     platform_Avr('ATmega2560'),
                     platform_Avr('ATmega1284p'),
                     platform_Stm32f4(),
+                    platform_Linux(),
                 ]),
                 ce.OneOf(key='debug_interface', title='Debug interface', choices=[
                     ce.Compound('NoDebug', title='None or specified elsewhere', attrs=[]),
@@ -704,6 +818,12 @@ def editor():
             ]),
             pin_choice(key='LedPin', title='LED pin'),
             interrupt_timer_choice(key='EventChannelTimer', title='Event channel timer'),
+            ce.OneOf(key='step_timer', title='Step timing', choices=[
+                ce.Compound('PerAxisStepTimers', title='One timer per axis (stepper port timers)', attrs=[]),
+                ce.Compound('SharedStepTimer', title='One timer shared by all axes', attrs=[
+                    interrupt_timer_choice(key='Timer', title='Step timer'),
+                ]),
+            ]),
             ce.Compound('RuntimeConfig', key='runtime_config', title='Runtime configuration', collapsable=True, attrs=[
                 ce.OneOf(key='config_manager', title='Runtime configuration', choices=[
                     ce.Compound('ConstantConfigManager', title='Disabled', attrs=[]),
@@ -753,6 +873,8 @@ def editor():
                         ce.Boolean(key='DoubleSpeed'),
                     ]),
                     ce.Compound('Stm32f4UsbSerial', title='STM32F4 USB', attrs=[]),
+                    ce.Compound('LinuxPtySerial', title='Linux pseudo-terminal', attrs=[]),
+                    ce.Compound('LinuxStdioSerial', title='Linux standard input/output', attrs=[]),
                     ce.Compound('NullSerial', title='Null serial driver', attrs=[]),
                 ])
             ])),
@@ -869,6 +991,9 @@ def editor():
                 ce.Boolean(key='AssertionsEnabled', title='Enable assertions', default=False),
                 ce.Boolean(key='EventLoopBenchmarkEnabled', title='Enable event-loop execution timing', default=False),
                 ce.Boolean(key='DetectOverloadEnabled', title='Enable interrupt overload detection', default=False),
+                ce.Boolean(key='MotionPlannerBenchmarkEnabled', title='Enable motion planner benchmark (Linux host only)', default=False),
+                ce.Boolean(key='MotionPlannerBatchPlan', title='Motion planner: convert plan results in batches of segments', default=False),
+                ce.Boolean(key='PlannerTelemetryEnabled', title='Enable motion planner telemetry (M927, JSON status)', default=False),
                 ce.Boolean(key='DisableWatchdog', title='Disable the watchdog timer', default=False),
                 ce.Boolean(key='BuildWithClang', title='Build with the Clang compiler', default=False),
                 ce.Boolean(key='VerboseBuild', title='Verbose build output', default=False),
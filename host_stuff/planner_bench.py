@@ -0,0 +1,165 @@
+#!/usr/bin/env python
+# Copyright (c) 2016 Ambroz Bizjak
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Benchmarks the MotionPlanner on real g-code, for a range of lookahead
+# settings. For each setting, the given configuration (which must use the
+# Linux host board) is built in virtual-time mode with the motion planner
+# benchmark enabled, and run with the g-code files as input.
+# With --compare-batch, each setting is also built with the plan results
+# converted in batches of segments (MotionPlannerBatchPlan).
+#
+# The host build has no thermal simulation, so cold extrusion prevention
+# is disabled and commands waiting for temperatures are removed from the
+# g-code. M400 is appended so that the run includes all the motion.
+#
+# Example:
+#   planner_bench.py --config config.json --cfg-name "Linux host example" \
+#       --lookahead 16:8 28:10 48:16 -- print1.gcode print2.gcode
+
+from __future__ import print_function
+import sys
+import os
+import argparse
+import json
+import shutil
+import subprocess
+import tempfile
+import time
+
+GENERATOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'config_system', 'generator', 'generate.py')
+RESULT_PREFIX = 'MotionPlannerBenchmark:'
+
+def parse_lookahead (arg):
+    try:
+        size, commit = arg.split(':')
+        return (int(size), int(commit))
+    except ValueError:
+        raise argparse.ArgumentTypeError('Expected SIZE:COMMIT, got {}'.format(arg))
+
+def make_config (config, cfg_name, size, commit, batch):
+    config = json.loads(json.dumps(config))
+    config['selected_config'] = cfg_name
+    configuration = [c for c in config['configurations'] if c['name'] == cfg_name][0]
+    board = [b for b in config['boards'] if b['name'] == configuration['board']][0]
+
+    platform = board['platform_config']['platform']
+    if platform['_compoundName'] != 'Linux':
+        raise Exception('The configuration must use the Linux host platform.')
+    platform['clock']['_compoundName'] = 'LinuxVirtualClock'
+    for serial in board['serial_ports']:
+        serial['Service'] = {'_compoundName': 'LinuxStdioSerial'}
+
+    performance = board['performance']
+    performance['LookaheadBufferSize'] = size
+    performance['LookaheadCommitCount'] = commit
+    performance['StepperSegmentBufferSize'] = max(performance['StepperSegmentBufferSize'], commit + 6)
+
+    board['development']['MotionPlannerBenchmarkEnabled'] = True
+    board['development']['MotionPlannerBatchPlan'] = batch
+
+    for heater in configuration['heaters']:
+        heater['cold_extrusion_prevention'] = {'_compoundName': 'NoColdExtrusionPrevention'}
+
+    return config
+
+def build (args, config, work_dir):
+    config_path = os.path.join(work_dir, 'config.json')
+    with open(config_path, 'w') as f:
+        json.dump(config, f)
+    result_path = os.path.join(work_dir, 'result')
+    generator = subprocess.Popen([args.python, '-B', GENERATOR, '--config', config_path], stdout=subprocess.PIPE)
+    subprocess.check_call([args.nix_build, '-', '-o', result_path], stdin=generator.stdout)
+    generator.stdout.close()
+    if generator.wait() != 0:
+        raise Exception('Generator failed.')
+    return os.path.join(result_path, 'aprinter-nixbuild.elf')
+
+WAIT_COMMANDS = set([b'M109', b'M190', b'M116'])
+
+def prepare_gcode (gcode_path, work_dir):
+    out_path = os.path.join(work_dir, 'input.gcode')
+    with open(gcode_path, 'rb') as src, open(out_path, 'wb') as dst:
+        for line in src:
+            words = line.split()
+            if len(words) > 0 and words[0].upper() in WAIT_COMMANDS:
+                continue
+            dst.write(line.rstrip(b'\r\n') + b'\n')
+        dst.write(b'M400\n')
+    return out_path
+
+def run (program, gcode_path):
+    with open(gcode_path, 'rb') as gcode, open(os.devnull, 'wb') as devnull:
+        start = time.time()
+        proc = subprocess.Popen([program], stdin=gcode, stdout=devnull, stderr=subprocess.PIPE)
+        _, err = proc.communicate()
+        wall = time.time() - start
+    if proc.returncode != 0:
+        raise Exception('Firmware exited with status {}.'.format(proc.returncode))
+    results = []
+    for line in err.decode('utf-8', 'replace').splitlines():
+        if line.startswith(RESULT_PREFIX):
+            results.append(dict(item.split('=') for item in line[len(RESULT_PREFIX):].split()))
+    # Homing uses separate planner instances; report the one with the most segments.
+    if len(results) == 0:
+        raise Exception('No benchmark results reported.')
+    result = max(results, key=lambda r: int(r['segments']))
+    result['wall_s'] = '{:.3f}'.format(wall)
+    return result
+
+COLUMNS = ['path', 'lookahead', 'commit', 'plan_calls', 'plan_avg_ns', 'plan_max_ns', 'slice_max_ns', 'segments_per_s', 'stepper_commands', 'underruns', 'wall_s']
+
+def main ():
+    parser = argparse.ArgumentParser(description='Benchmark the motion planner on g-code, sweeping lookahead settings.')
+    parser.add_argument('--config', required=True, help='JSON configuration file')
+    parser.add_argument('--cfg-name', required=True, help='Configuration to build (must use the Linux host board)')
+    parser.add_argument('--lookahead', type=parse_lookahead, nargs='+', required=True, help='LookaheadBufferSize:LookaheadCommitCount pairs')
+    parser.add_argument('--compare-batch', action='store_true', help='Also benchmark converting plan results in batches of segments')
+    parser.add_argument('--python', default='python', help='Python 2 interpreter for the generator')
+    parser.add_argument('--nix-build', default='nix-build', help='nix-build program')
+    parser.add_argument('gcode', nargs='+', help='G-code files')
+    args = parser.parse_args()
+
+    with open(args.config, 'r') as f:
+        config = json.load(f)
+
+    print('\t'.join(['file'] + COLUMNS))
+
+    paths = [('scalar', False)] + ([('batch', True)] if args.compare_batch else [])
+
+    for (size, commit) in args.lookahead:
+        for (path, batch) in paths:
+            work_dir = tempfile.mkdtemp(prefix='planner_bench.')
+            try:
+                program = build(args, make_config(config, args.cfg_name, size, commit, batch), work_dir)
+                for gcode_path in args.gcode:
+                    result = run(program, prepare_gcode(gcode_path, work_dir))
+                    result['path'] = path
+                    print('\t'.join([os.path.basename(gcode_path)] + [result.get(col, '') for col in COLUMNS]))
+                    sys.stdout.flush()
+            finally:
+                shutil.rmtree(work_dir)
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,214 @@
+#!/usr/bin/env python
+# Copyright (c) 2016 Ambroz Bizjak
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Benchmarks the MotionPlanner on real g-code, for a range of lookahead
+
+# Checks the step times of the step interval recurrence ("Step time
+# computation" set to "Incrementally, with periodic exact steps") against
+# the exact step times, for a range of accelerations. The given
+# configuration (which must use the Linux host board) is built twice in
+# virtual-time mode, with all steppers using the exact computation and
+# with all of them using the recurrence. The recurrence needs step signal
+# timing, so steppers without it get the same default delays in both
+# builds. For each acceleration, the maximum acceleration of the X and Y
+# axes is set with M926 and the same moves are run through both builds
+# with the step trace enabled.
+#
+# The n-th step of each step pin is compared between the two traces. The
+# error is reported in ticks and relative to the exact interval before
+# the step, and the check fails if the relative error exceeds --max-error
+# or the number of steps differs.
+#
+# Example:
+#   step_time_check.py --config config.json --cfg-name "Linux host example" \
+#       --accel 100 300 1000 3000 10000
+
+from __future__ import print_function
+import sys
+import os
+import argparse
+import json
+import shutil
+import struct
+import subprocess
+import tempfile
+
+GENERATOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'config_system', 'generator', 'generate.py')
+
+HEADER_MAGIC = b'APSTRC01'
+RECORD = struct.Struct('<QBBHi')
+TYPE_PIN = 1
+
+DEFAULT_DELAY = {'_compoundName': 'Delay', 'DirSetTime': 0.2, 'StepHighTime': 1, 'StepLowTime': 1}
+
+MOVES = [
+    'G1 X100 Y60 F6000',
+    'G1 X20 Y50 F12000',
+    'G1 X120 Y10 F3000',
+    'G1 X10 Y90 F18000',
+    'G1 X0 Y0 F9000',
+]
+
+def make_config (config, cfg_name, step_time_computation):
+    config = json.loads(json.dumps(config))
+    config['selected_config'] = cfg_name
+    configuration = [c for c in config['configurations'] if c['name'] == cfg_name][0]
+    board = [b for b in config['boards'] if b['name'] == configuration['board']][0]
+
+    platform = board['platform_config']['platform']
+    if platform['_compoundName'] != 'Linux':
+        raise Exception('The configuration must use the Linux host platform.')
+    platform['clock']['_compoundName'] = 'LinuxVirtualClock'
+    for serial in board['serial_ports']:
+        serial['Service'] = {'_compoundName': 'LinuxStdioSerial'}
+
+    for stepper in configuration['steppers']:
+        if stepper['delay']['_compoundName'] == 'NoDelay':
+            stepper['delay'] = dict(DEFAULT_DELAY)
+        stepper['step_time_computation'] = step_time_computation
+        stepper['multi_step'] = {'_compoundName': 'NoMultiStep'}
+
+    for heater in configuration['heaters']:
+        heater['cold_extrusion_prevention'] = {'_compoundName': 'NoColdExtrusionPrevention'}
+
+    return config
+
+def build (args, config, work_dir):
+    config_path = os.path.join(work_dir, 'config.json')
+    with open(config_path, 'w') as f:
+        json.dump(config, f)
+    result_path = os.path.join(work_dir, 'result')
+    generator = subprocess.Popen([args.python, '-B', GENERATOR, '--config', config_path], stdout=subprocess.PIPE)
+    subprocess.check_call([args.nix_build, '-', '-o', result_path], stdin=generator.stdout)
+    generator.stdout.close()
+    if generator.wait() != 0:
+        raise Exception('Generator failed.')
+    return os.path.join(result_path, 'aprinter-nixbuild.elf')
+
+def write_gcode (accel, work_dir):
+    gcode_path = os.path.join(work_dir, 'accel.gcode')
+    lines = ['G21', 'G90', 'G92 X0 Y0 Z0 E0']
+    lines += ['M926 I{}MaxAccel V{}'.format(axis, accel) for axis in ('X', 'Y')]
+    lines += ['M930'] + MOVES + ['M400']
+    with open(gcode_path, 'w') as f:
+        f.write(''.join(line + '\n' for line in lines))
+    return gcode_path
+
+# Returns the times of the steps (changes away from the initial level) of each pin.
+def run (program, gcode_path, work_dir):
+    trace_path = os.path.join(work_dir, 'trace.bin')
+    env = dict(os.environ)
+    env['APRINTER_TRACE'] = trace_path
+    with open(gcode_path, 'rb') as gcode, open(os.devnull, 'wb') as devnull:
+        status = subprocess.call([program], stdin=gcode, stdout=devnull, env=env)
+    if status != 0:
+        raise Exception('Firmware exited with status {}.'.format(status))
+    with open(trace_path, 'rb') as f:
+        data = f.read()
+    os.remove(trace_path)
+    if len(data) < 16 or data[0:8] != HEADER_MAGIC:
+        raise Exception('Not a trace file.')
+    idle = {}
+    steps = {}
+    for offset in range(16, len(data) - RECORD.size + 1, RECORD.size):
+        time, rec_type, value, pin, _ = RECORD.unpack_from(data, offset)
+        if rec_type != TYPE_PIN:
+            continue
+        if pin not in idle:
+            idle[pin] = value
+            steps[pin] = []
+        elif value != idle[pin]:
+            steps[pin].append(time)
+    return steps
+
+def compare (exact_steps, rec_steps):
+    result = {'steps': 0, 'abs_sum': 0, 'abs_max': 0, 'rel_max': 0.0, 'mismatch': []}
+    for pin in sorted(set(exact_steps) | set(rec_steps)):
+        exact = exact_steps.get(pin, [])
+        rec = rec_steps.get(pin, [])
+        if len(exact) != len(rec):
+            result['mismatch'].append('pin {}: {} != {} steps'.format(pin, len(exact), len(rec)))
+            continue
+        for k in range(1, len(exact)):
+            error = abs(rec[k] - exact[k])
+            result['steps'] += 1
+            result['abs_sum'] += error
+            result['abs_max'] = max(result['abs_max'], error)
+            interval = exact[k] - exact[k - 1]
+            if interval > 0:
+                result['rel_max'] = max(result['rel_max'], error / float(interval))
+    return result
+
+def main ():
+    parser = argparse.ArgumentParser(description='Check the step time recurrence against exact step times, sweeping accelerations.')
+    parser.add_argument('--config', required=True, help='JSON configuration file')
+    parser.add_argument('--cfg-name', required=True, help='Configuration to build (must use the Linux host board)')
+    parser.add_argument('--accel', type=float, nargs='+', default=[100, 300, 1000, 3000, 10000], help='Maximum accelerations of X and Y [mm/s^2]')
+    parser.add_argument('--resync-interval', type=int, default=16, help='Steps between exact steps of the recurrence')
+    parser.add_argument('--max-error', type=float, default=0.25, help='Largest allowed error relative to the step interval')
+    parser.add_argument('--python', default='python', help='Python 2 interpreter for the generator')
+    parser.add_argument('--nix-build', default='nix-build', help='nix-build program')
+    args = parser.parse_args()
+
+    with open(args.config, 'r') as f:
+        config = json.load(f)
+
+    variants = [
+        {'_compoundName': 'Exact'},
+        {'_compoundName': 'Recurrence', 'ResyncInterval': args.resync_interval},
+    ]
+
+    ok = True
+    work_dir = tempfile.mkdtemp(prefix='step_time_check.')
+    try:
+        programs = []
+        for variant in variants:
+            build_dir = os.path.join(work_dir, variant['_compoundName'])
+            os.mkdir(build_dir)
+            programs.append(build(args, make_config(config, args.cfg_name, variant), build_dir))
+
+        print('\t'.join(['accel', 'steps', 'err_avg_ticks', 'err_max_ticks', 'err_max_rel', 'result']))
+        for accel in args.accel:
+            gcode_path = write_gcode(accel, work_dir)
+            exact_steps, rec_steps = [run(program, gcode_path, work_dir) for program in programs]
+            result = compare(exact_steps, rec_steps)
+            good = len(result['mismatch']) == 0 and result['rel_max'] <= args.max_error
+            ok = ok and good
+            print('\t'.join([
+                '{:g}'.format(accel),
+                '{}'.format(result['steps']),
+                '{:.1f}'.format(result['abs_sum'] / float(max(1, result['steps']))),
+                '{}'.format(result['abs_max']),
+                '{:.3f}'.format(result['rel_max']),
+                'ok' if good else 'FAIL',
+            ]))
+            for mismatch in result['mismatch']:
+                print('  {}'.format(mismatch))
+            sys.stdout.flush()
+    finally:
+        shutil.rmtree(work_dir)
+
+    return 0 if ok else 1
+
+if __name__ == '__main__':
+    sys.exit(main())
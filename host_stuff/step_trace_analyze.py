@@ -0,0 +1,184 @@
+#!/usr/bin/env python
+# Copyright (c) 2016 Ambroz Bizjak
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Analyzes a trace written by the Linux host build when run with
+# APRINTER_TRACE=<file>. The trace starts with a 16-byte header, the magic
+# "APSTRC01" followed by the clock frequency as a double. Then follow
+# 16-byte records (time:u64, type:u8, value:u8, id:u16, aux:i32), with
+# time in clock ticks. Type 1 is a pin change (id=pin, value=level),
+# type 2 is a timer interrupt (id=timer, aux=lateness in ticks).
+#
+# Step and direction pins are given per axis, e.g.:
+#   step_trace_analyze.py trace.bin --axis X=54:55 --axis Y=60:61
+# The idle level of a step pin is taken to be its first recorded level.
+
+from __future__ import print_function
+import sys
+import argparse
+import struct
+
+HEADER_MAGIC = b'APSTRC01'
+RECORD = struct.Struct('<QBBHi')
+TYPE_PIN = 1
+TYPE_TIMER = 2
+
+def percentile (sorted_values, p):
+    if len(sorted_values) == 0:
+        return float('nan')
+    index = int(round(p / 100.0 * (len(sorted_values) - 1)))
+    return sorted_values[index]
+
+def format_stats (values, unit_scale, unit_name):
+    if len(values) == 0:
+        return 'n/a'
+    s = sorted(values)
+    mean = sum(s) / float(len(s))
+    return 'min={:.3f} p50={:.3f} mean={:.3f} p99={:.3f} max={:.3f} {}'.format(
+        s[0] * unit_scale, percentile(s, 50) * unit_scale, mean * unit_scale,
+        percentile(s, 99) * unit_scale, s[-1] * unit_scale, unit_name)
+
+class Axis (object):
+    def __init__ (self, name, step_pin, dir_pin):
+        self.name = name
+        self.step_pin = step_pin
+        self.dir_pin = dir_pin
+        self.step_idle = None
+        self.step_active_time = None
+        self.dir_level = None
+        self.dir_change_time = None
+        self.last_step_time = None
+        self.last_interval = None
+        self.steps = [0, 0]
+        self.intervals = []
+        self.jitter = []
+        self.pulse_widths = []
+        self.dir_setups = []
+        self.timers = {}
+
+    def pin_change (self, time, pin, value, last_timer):
+        if pin == self.dir_pin:
+            if self.dir_level is not None:
+                self.dir_change_time = time
+            self.dir_level = value
+            self.last_step_time = None
+            self.last_interval = None
+        elif pin == self.step_pin:
+            if self.step_idle is None:
+                self.step_idle = value
+            elif value != self.step_idle:
+                self.step_active_time = time
+                self.step(time, last_timer)
+            elif self.step_active_time is not None:
+                self.pulse_widths.append(time - self.step_active_time)
+                self.step_active_time = None
+
+    def step (self, time, last_timer):
+        self.steps[1 if self.dir_level else 0] += 1
+        if last_timer is not None:
+            self.timers[last_timer] = self.timers.get(last_timer, 0) + 1
+        if self.dir_change_time is not None:
+            self.dir_setups.append(time - self.dir_change_time)
+            self.dir_change_time = None
+        if self.last_step_time is not None:
+            interval = time - self.last_step_time
+            self.intervals.append(interval)
+            if self.last_interval is not None:
+                self.jitter.append(abs(interval - self.last_interval))
+            self.last_interval = interval
+        self.last_step_time = time
+
+def parse_axis (arg):
+    try:
+        name, pins = arg.split('=')
+        step_pin, dir_pin = pins.split(':')
+        return Axis(name, int(step_pin), int(dir_pin))
+    except ValueError:
+        raise argparse.ArgumentTypeError('Expected NAME=STEP_PIN:DIR_PIN, got {}'.format(arg))
+
+def main ():
+    parser = argparse.ArgumentParser(description='Analyze a step trace from the Linux host build.')
+    parser.add_argument('trace', help='Trace file')
+    parser.add_argument('--axis', type=parse_axis, action='append', default=[], help='NAME=STEP_PIN:DIR_PIN')
+    parser.add_argument('--peak-window', type=int, default=10, help='Number of steps to average peak step rate over')
+    args = parser.parse_args()
+
+    with open(args.trace, 'rb') as f:
+        data = f.read()
+
+    if len(data) < 16 or data[0:8] != HEADER_MAGIC:
+        print('ERROR: not a trace file')
+        return 1
+    time_freq = struct.unpack('<d', data[8:16])[0]
+    us = 1e6 / time_freq
+
+    axes_by_pin = {}
+    for axis in args.axis:
+        axes_by_pin[axis.step_pin] = axis
+        axes_by_pin[axis.dir_pin] = axis
+
+    timer_lateness = {}
+    last_timer = None
+    end_time = 0
+    num_records = (len(data) - 16) // RECORD.size
+
+    for i in range(num_records):
+        time, rec_type, value, rec_id, aux = RECORD.unpack_from(data, 16 + i * RECORD.size)
+        end_time = max(end_time, time)
+        if rec_type == TYPE_TIMER:
+            timer_lateness.setdefault(rec_id, []).append(aux)
+            last_timer = rec_id
+        elif rec_type == TYPE_PIN:
+            axis = axes_by_pin.get(rec_id)
+            if axis is not None:
+                axis.pin_change(time, rec_id, value, last_timer)
+
+    print('Records: {}, duration: {:.6f} s, clock: {:.0f} Hz'.format(num_records, end_time / time_freq, time_freq))
+
+    for axis in args.axis:
+        print('')
+        print('Axis {} (step pin {}, dir pin {})'.format(axis.name, axis.step_pin, axis.dir_pin))
+        print('  steps:        {} (dir=0: {}, dir=1: {})'.format(sum(axis.steps), axis.steps[0], axis.steps[1]))
+        print('  interval:     {}'.format(format_stats(axis.intervals, us, 'us')))
+        print('  jitter:       {}'.format(format_stats(axis.jitter, us, 'us')))
+        print('  pulse width:  {}'.format(format_stats(axis.pulse_widths, us, 'us')))
+        print('  dir setup:    {}'.format(format_stats(axis.dir_setups, us, 'us')))
+        if len(axis.intervals) > 0:
+            # Steps emitted together in one interrupt (multiple steps per interrupt) are 0 apart.
+            min_interval = min(axis.intervals)
+            peak = (time_freq / min_interval) if min_interval > 0 else float('inf')
+            window = args.peak_window
+            sums = [sum(axis.intervals[j:j + window]) for j in range(0, len(axis.intervals) - window + 1)]
+            peak_avg = (window * time_freq / min(sums)) if len(sums) > 0 else float('nan')
+            print('  peak rate:    {:.0f} steps/s (over {} steps: {:.0f} steps/s)'.format(peak, window, peak_avg))
+        if len(axis.timers) > 0:
+            print('  timers:       {}'.format(', '.join('{}: {} steps'.format(t, n) for (t, n) in sorted(axis.timers.items()))))
+
+    print('')
+    print('Timer interrupt lateness:')
+    for timer_id in sorted(timer_lateness):
+        print('  timer {}: count={} {}'.format(timer_id, len(timer_lateness[timer_id]), format_stats(timer_lateness[timer_id], us, 'us')))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -67,6 +67,8 @@ let
     
     isArm = builtins.elem board.platform [ "sam3x" "teensy" "stm32f4" ];
     
+    isLinux = board.platform == "linux";
+    
     needAsf = board.platform == "sam3x";
     
     needStm32CubeF4 = board.platform == "stm32f4";
@@ -76,6 +78,7 @@ let
     targetFile = writeText "aprinter-nixbuild.sh" ''
         ${stdenv.lib.optionalString isAvr "AVR_GCC_PREFIX=${avrgcclibc}/bin/avr-"}
         ${stdenv.lib.optionalString isArm "ARM_GCC_PREFIX=${gcc-arm-embedded}/bin/arm-none-eabi-"}
+        ${stdenv.lib.optionalString isLinux "LINUX_CXX=${stdenv.cc}/bin/c++"}
         ${stdenv.lib.optionalString buildWithClang "BUILD_WITH_CLANG=1"}
         ${stdenv.lib.optionalString buildWithClang "CLANG_ARM_EMBEDDED=${clang-arm-embedded}/bin/arm-none-eabi-"}
         ${stdenv.lib.optionalString needAsf "ASF_DIR=${asf}"}
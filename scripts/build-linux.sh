@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+# 
+# Simple build script crafted for the APrinter project to support multiple 
+# architecture targets and build actions using an elegant commandline.
+# 
+# Copyright (c) 2016 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+# 
+#####################################################################################
+# LINUX (HOST) SPECIFIC STUFF
+
+LINUX_CXX=${LINUX_CXX:-g++}
+
+check_depends_linux() {
+    echo "   Checking depends"
+    check_build_tool "${LINUX_CXX}" "host C++ compiler"
+}
+
+configure_linux() {
+    echo "  Configuring Linux build"
+    
+    FLAGS_OPT=( -O$( [[ $OPTIMIZE_FOR_SIZE = "1" ]] && echo s || echo 2 ) )
+    CXXFLAGS=(
+        -std=c++14 -DNDEBUG "${FLAGS_OPT[@]}" -pthread \
+        -fno-math-errno -fno-trapping-math \
+        -fno-access-control -ftemplate-depth=1024 \
+        -D__STDC_LIMIT_MACROS -D__STDC_FORMAT_MACROS -D__STDC_CONSTANT_MACROS \
+        -DAMBROLIB_LINUX -I. -Wfatal-errors \
+        "${EXTRA_COMPILE_FLAGS[@]}" \
+        ${CXXFLAGS} ${CCXXLDFLAGS}
+    )
+    
+    CXX_SOURCES=( $(eval echo "$EXTRA_CXX_SOURCES") "aprinter/platform/linux/linux_support.cpp" "${SOURCE}" )
+    
+    RUNBUILD=build_linux
+    CHECK=check_depends_linux
+}
+
+build_linux() {
+    echo "  Compiling for Linux"
+    ${CHECK}
+    
+    echo "   Compiling and linking"
+    ($V; "${LINUX_CXX}" "${CXXFLAGS[@]}" "${CXX_SOURCES[@]}" -o "${TARGET}.elf" -lm || exit 2)
+}
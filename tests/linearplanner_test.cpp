@@ -51,8 +51,10 @@ struct Path {
 
 using TheLinearPlanner = LinearPlanner<FpType>;
 
+TheLinearPlanner::SegmentPushData lp_pd[max_path_len];
 TheLinearPlanner::SegmentData lp_sd[max_path_len];
 TheLinearPlanner::SegmentState lp_ss[max_path_len];
+TheLinearPlanner::SegmentState lp_ss_inc[max_path_len];
 
 static void test_path (Path path)
 {
@@ -63,7 +65,7 @@ static void test_path (Path path)
         Segment const *seg = &path.segs[i];
         FpType max_v = seg->max_speed_squared;
         FpType a_x = seg->two_max_accel * seg->distance;
-        TheLinearPlanner::initSegment(&lp_sd[i], prev_max_v, INFINITY, max_v, a_x);
+        TheLinearPlanner::initSegment(&lp_pd[i], &lp_sd[i], prev_max_v, INFINITY, max_v, a_x);
         prev_max_v = max_v;
     }
     
@@ -71,15 +73,41 @@ static void test_path (Path path)
     
     for (size_t j = path.num_segs; j > 0; j--) {
         size_t i = j - 1;
-        v = TheLinearPlanner::push(&lp_sd[i], &lp_ss[i], v);
+        v = TheLinearPlanner::push(&lp_pd[i], &lp_ss[i], v);
+    }
+    
+    // Plan incrementally as MotionPlanner does, adding one segment at a time
+    // and stopping the backward pass at the last segment whose start speed
+    // was limited only by itself.
+    size_t final_length = 0;
+    for (size_t n = 1; n <= path.num_segs; n++) {
+        size_t new_final_length = final_length;
+        FpType inc_v = 0.0;
+        size_t i = n;
+        do {
+            i--;
+            inc_v = TheLinearPlanner::push(&lp_pd[i], &lp_ss_inc[i], inc_v);
+            if (new_final_length == final_length && TheLinearPlanner::startIsMax(&lp_pd[i], inc_v)) {
+                new_final_length = i;
+            }
+        } while (i != final_length);
+        final_length = new_final_length;
     }
     
     v = 0.0;
+    FpType inc_v = 0.0;
     
     for (size_t i = 0; i < path.num_segs; i++) {
         FpType start_v = v;
         TheLinearPlanner::SegmentResult result;
-        v = TheLinearPlanner::pull(&lp_sd[i], &lp_ss[i], v, &result);
+        v = TheLinearPlanner::pull(&lp_pd[i], &lp_sd[i], &lp_ss[i], v, &result);
+        
+        TheLinearPlanner::SegmentResult inc_result;
+        inc_v = TheLinearPlanner::pull(&lp_pd[i], &lp_sd[i], &lp_ss_inc[i], inc_v, &inc_result);
+        AMBRO_ASSERT_FORCE(inc_v == v)
+        AMBRO_ASSERT_FORCE(inc_result.const_start == result.const_start)
+        AMBRO_ASSERT_FORCE(inc_result.const_end == result.const_end)
+        AMBRO_ASSERT_FORCE(inc_result.const_v == result.const_v)
         
         FpType speed_limit = path.segs[i].max_speed_squared + SpeedEpsilon;
         AMBRO_ASSERT_FORCE(start_v <= speed_limit)